@@ -13,10 +13,175 @@
 #include "nbt.h"
 #include "nbt_parse.h"
 #include "nbt_traverse.h"
+#include "nbt_scan.h"
+#include "nbt_server.h"
+#include "nbt_backup.h"
+#include "nbt_spatial.h"
 
 #define traverse(root) traverse(root, 0)
 
+static void print_match(void* userdata, const char* region, int x, int z) {
+    (void) userdata;
+    printf("%s %d %d\n", region, x, z);
+}
+
+// main --scan <world> <predicate> [threads]
+static int scan_main(int argc, char* argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s --scan <world> <predicate> [threads]\n", argv[0]);
+        return 2;
+    }
+    ScanPredicate* predicate = ScanPredicate_parse(argv[3]);
+    if (!predicate) {
+        return 2;
+    }
+    ScanStats stats;
+    bool ok = scan_world(argv[2], predicate, argc > 4 ? atoi(argv[4]) : 0, print_match, NULL, &stats);
+    ScanPredicate_free(predicate);
+    if (!ok) {
+        fprintf(stderr, "No region files found in %s\n", argv[2]);
+        return 1;
+    }
+    fprintf(stderr, "%llu matches in %llu chunks of %llu regions, %llu errors\n",
+            (unsigned long long) stats.matches, (unsigned long long) stats.chunks,
+            (unsigned long long) stats.regions, (unsigned long long) stats.errors);
+    return 0;
+}
+
+// main --serve <socket> [threads]
+static int serve_main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s --serve <socket> [threads]\n", argv[0]);
+        return 2;
+    }
+    ServerOptions options = { .threads = argc > 3 ? atoi(argv[3]) : 0 };
+    return serve(argv[2], &options) ? 0 : 1;
+}
+
+// main --query <socket> <command> [file] [path] [value], fields joined by tabs
+static int query_main(int argc, char* argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s --query <socket> <command> [file] [path] [value]\n", argv[0]);
+        return 2;
+    }
+    size_t length = 0;
+    for (int i = 3; i < argc; i++) {
+        length += strlen(argv[i]) + 1;
+    }
+    char* request = (char*) malloc(length);
+    if (!request) {
+        return 1;
+    }
+    request[0] = '\0';
+    for (int i = 3; i < argc; i++) {
+        if (i > 3) {
+            strcat(request, "\t");
+        }
+        strcat(request, argv[i]);
+    }
+    bool ok = server_query(argv[2], request, stdout);
+    free(request);
+    return ok ? 0 : 1;
+}
+
+// main --backup <world> <store> <snapshot> [previous]
+static int backup_main(int argc, char* argv[]) {
+    if (argc < 5) {
+        fprintf(stderr, "usage: %s --backup <world> <store> <snapshot> [previous]\n", argv[0]);
+        return 2;
+    }
+    BackupOptions options = { .previous = argc > 5 ? argv[5] : NULL };
+    BackupStats stats;
+    if (!backup_world(argv[2], argv[3], argv[4], &options, &stats)) {
+        return 1;
+    }
+    fprintf(stderr, "%llu chunks in %llu regions, %llu unchanged, %llu new payloads (%llu bytes)\n",
+            (unsigned long long) stats.chunks, (unsigned long long) stats.regions,
+            (unsigned long long) stats.unchanged, (unsigned long long) stats.stored,
+            (unsigned long long) stats.bytes_stored);
+    return 0;
+}
+
+// main --restore <store> <snapshot> <world>
+static int restore_main(int argc, char* argv[]) {
+    if (argc < 5) {
+        fprintf(stderr, "usage: %s --restore <store> <snapshot> <world>\n", argv[0]);
+        return 2;
+    }
+    return backup_restore(argv[2], argv[3], argv[4], NULL) ? 0 : 1;
+}
+
+// main --spatial <dimension> <index> [threads]
+static int spatial_main(int argc, char* argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s --spatial <dimension> <index> [threads]\n", argv[0]);
+        return 2;
+    }
+    SpatialStats stats;
+    if (!spatial_build(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : 0, &stats)) {
+        return 1;
+    }
+    fprintf(stderr, "%llu chunks, %llu entities and %llu block entities in %llu regions, %llu errors\n",
+            (unsigned long long) stats.chunks, (unsigned long long) stats.entities,
+            (unsigned long long) stats.block_entities, (unsigned long long) stats.regions,
+            (unsigned long long) stats.errors);
+    return 0;
+}
+
+static bool print_record(void* userdata, const SpatialRecord* record, const char* label) {
+    (void) userdata;
+    static const char* const kinds[] = { [SPATIAL_CHUNK] = "chunk", [SPATIAL_ENTITY] = "entity",
+                                         [SPATIAL_BLOCK_ENTITY] = "block_entity" };
+    printf("%s %d %d %d %s\n", kinds[record->kind], record->x, record->y, record->z, label);
+    return true;
+}
+
+// main --within <index> <x1> <y1> <z1> <x2> <y2> <z2>
+static int within_main(int argc, char* argv[]) {
+    if (argc < 9) {
+        fprintf(stderr, "usage: %s --within <index> <x1> <y1> <z1> <x2> <y2> <z2>\n", argv[0]);
+        return 2;
+    }
+    int32_t c[6];
+    for (int i = 0; i < 6; i++) {
+        c[i] = atoi(argv[3 + i]);
+    }
+    SpatialBox box = {
+        c[0] < c[3] ? c[0] : c[3], c[1] < c[4] ? c[1] : c[4], c[2] < c[5] ? c[2] : c[5],
+        c[0] < c[3] ? c[3] : c[0], c[1] < c[4] ? c[4] : c[1], c[2] < c[5] ? c[5] : c[2],
+    };
+    SpatialIndex* index = SpatialIndex_open(argv[2]);
+    if (!index) {
+        return 1;
+    }
+    SpatialIndex_query(index, &box, SPATIAL_CHUNK | SPATIAL_ENTITY | SPATIAL_BLOCK_ENTITY, print_record, NULL);
+    SpatialIndex_close(index);
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--scan") == 0) {
+        return scan_main(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+        return serve_main(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--query") == 0) {
+        return query_main(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--backup") == 0) {
+        return backup_main(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--restore") == 0) {
+        return restore_main(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--spatial") == 0) {
+        return spatial_main(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--within") == 0) {
+        return within_main(argc, argv);
+    }
+
     static const char* default_file = "./nbt/bigtest.nbt";
 
     const char* filename = argc > 1 ? argv[1] : default_file;
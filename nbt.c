@@ -42,6 +42,9 @@ struct GenericArray {
     void* data;
 };
 
+_Static_assert(sizeof(String) == 16, "String should stay two words");
+_Static_assert(sizeof(NamedTag) <= 40, "NamedTag should stay five words");
+
 /* free functions */
 void NamedTag_free(NamedTag* tag) {
     NamedTag_destroy(tag);
@@ -93,22 +96,22 @@ void NamedTag_destroy(NamedTag* tag) {
     case TAG_Float:
         break; // no additional free needed for primitives
     case TAG_Byte_Array:
-        Byte_Array_free(tag->byte_array_value);
+        Byte_Array_destroy(&tag->byte_array_value);
         break;
     case TAG_String:
-        String_free(tag->string_value);
+        String_destroy(&tag->string_value);
         break;
     case TAG_List:
-        List_free(tag->list_value);
+        List_destroy(&tag->list_value);
         break;
     case TAG_Compound:
-        Compound_free(tag->compound_value);
+        Compound_destroy(&tag->compound_value);
         break;
     case TAG_Int_Array:
-        IntArray_free(tag->int_array_value);
+        IntArray_destroy(&tag->int_array_value);
         break;
     case TAG_Long_Array:
-        LongArray_free(tag->long_array_value);
+        LongArray_destroy(&tag->long_array_value);
         break;
     }
     String_destroy(&tag->name);
@@ -119,10 +122,40 @@ void Byte_Array_destroy(Byte_Array* arr) {
 }
 
 void String_destroy(String* str) {
-    free(str->data);
+    if (!String_is_inline(str)) {
+        free(str->heap);
+    }
+    str->length = 0;
+}
+
+static void _ColumnarList_destroy(ColumnarList* columns, Int length) {
+    for (Int k = 0; k < columns->width; k++) {
+        // absent payloads are zeroed, which destroys as nothing
+        List column = { .type = columns->types[k], .length = length, .tags = columns->columns[k] };
+        List_destroy(&column);
+        String_destroy(&columns->keys[k]);
+        free(columns->present[k]);
+    }
+    if (columns->irregular) {
+        for (Int i = 0; i < length; i++) {
+            Compound_destroy(&columns->irregular[i]);
+        }
+    }
+    free(columns->keys);
+    free(columns->types);
+    free(columns->columns);
+    free(columns->present);
+    free(columns->irregular);
 }
 
 void List_destroy(List* list) {
+    if (list->columnar) {
+        if (list->tags) {
+            _ColumnarList_destroy((ColumnarList*) list->tags, list->length);
+        }
+        free(list->tags);
+        return;
+    }
     switch (list->type) {
     case TAG_End:
     case TAG_Byte:
@@ -147,9 +180,9 @@ void List_destroy(List* list) {
         break;
     }
     case TAG_List: {
-        String* data = (String*)(list->tags);
+        List* data = (List*)(list->tags);
         for (Int i = 0; i < list->length; ++i) {
-            String_destroy(&data[i]);
+            List_destroy(&data[i]);
         }
         break;
     }
@@ -201,9 +234,29 @@ static inline void _GenericArray_destroy(GenericArray* arr) {
 NamedTag* Compound_find(Compound* obj, const char* key) {
     for (Int i = 0; i < obj->size; ++i) {
         NamedTag* tag = &obj->tags[i];
-        if (strcmp(tag->name.data, key) == 0) {
+        if (strcmp(String_data(&tag->name), key) == 0) {
             return tag;
         }
     }
     return NULL;
 }
+
+bool String_set(String* str, const char* data, size_t length) {
+    if (length > UINT16_MAX) {
+        return false;
+    }
+    char* dest;
+    if (length <= STRING_INLINE_CAPACITY) {
+        dest = str->small;
+    } else {
+        dest = (char*) malloc(length + 1);
+        if (!dest) {
+            return false;
+        }
+        str->heap = dest;
+    }
+    str->length = length;
+    memcpy(dest, data, length);
+    dest[length] = '\0';
+    return true;
+}
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 enum TAGType {
     TAG_End = 0,
@@ -57,23 +58,54 @@ struct Long_Array {
     Long* data;
 };
 
+/*
+ * Strings of up to STRING_INLINE_CAPACITY bytes are stored inside the struct,
+ * longer ones in a single heap block. Always go through String_data().
+ */
+#define STRING_INLINE_CAPACITY 13
+
 struct String {
-    Short length;
-    char* data;
+    union {
+        struct {
+            uint16_t length;
+            char small[STRING_INLINE_CAPACITY + 1];
+        };
+        struct {
+            uint16_t _heap_length;
+            char* heap;
+        };
+    };
 };
 
 struct List {
-    enum TAGType type;
+    enum TAGType type : 8;
+    bool columnar : 1; // tags is a ColumnarList, see nbt_columnar.h
     Int length;
     void* tags;
 };
 
+/*
+ * A list of compounds stored as one key schema, taken from its first element,
+ * and one dense column of payloads per key. Whatever an element holds beyond
+ * the schema, or with another type, stays in its own irregular compound, and
+ * so does all of an element whose keys are not in schema order.
+ */
+typedef struct ColumnarList {
+    Int width;
+    String* keys;
+    enum TAGType* types;
+    void** columns;      // columns[k] holds length payloads of types[k]; absent ones are zeroed
+    uint8_t** present;   // present[k] has bit i set when element i has key k; NULL when all have it
+    Compound* irregular; // one per element, NULL when no element needed one
+} ColumnarList;
+
 // TODO: make this into a hash table
 struct Compound {
     Int size;
     NamedTag* tags;
 };
 
+/* array, string, list and compound headers live inside the node */
 struct NamedTag {
     enum TAGType type;
     String name;
@@ -85,15 +117,26 @@ struct NamedTag {
         Long long_value;
         Float float_value;
         Double double_value;
-        struct Byte_Array* byte_array_value;
-        struct String* string_value;
-        struct List* list_value;
-        struct Compound* compound_value;
-        struct Int_Array* int_array_value;
-        struct Long_Array* long_array_value;
+        struct Byte_Array byte_array_value;
+        struct String string_value;
+        struct List list_value;
+        struct Compound compound_value;
+        struct Int_Array int_array_value;
+        struct Long_Array long_array_value;
     };
 };
 
+static inline char* String_data(const String* str) {
+    return str->length <= STRING_INLINE_CAPACITY ? (char*) str->small : str->heap;
+}
+
+static inline bool String_is_inline(const String* str) {
+    return str->length <= STRING_INLINE_CAPACITY;
+}
+
+/* copies length bytes of data into str; returns false when out of memory */
+bool String_set(String*, const char* data, size_t length);
+
 /* free functions */
 void NamedTag_free(NamedTag*);
 void Byte_Array_free(Byte_Array*);
@@ -0,0 +1,525 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_aggregate.h"
+#include "nbt.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "nbt_endian.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define AGGREGATE_AVX2
+#  include <immintrin.h>
+#endif
+
+bool NumericView_of(enum TAGType type, const void* value, NumericView* view) {
+    *view = (NumericView){0};
+    switch (type) {
+    case TAG_Byte_Array:
+        view->type = TAG_Byte;
+        view->data = ((const Byte_Array*) value)->data;
+        view->count = ((const Byte_Array*) value)->length;
+        return true;
+    case TAG_Int_Array:
+        view->type = TAG_Int;
+        view->data = ((const Int_Array*) value)->data;
+        view->count = ((const Int_Array*) value)->length;
+        return true;
+    case TAG_Long_Array:
+        view->type = TAG_Long;
+        view->data = ((const Long_Array*) value)->data;
+        view->count = ((const Long_Array*) value)->length;
+        return true;
+    case TAG_List:
+    {
+        const List* list = (const List*) value;
+        if (list->type < TAG_Byte || list->type > TAG_Double) {
+            return list->length == 0 && list->type == TAG_End;
+        }
+        view->type = list->type;
+        view->data = list->tags;
+        view->count = list->length;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/* scalar kernels, which also finish what the vector ones leave over */
+
+static bool _integral(const NumericView* view) {
+    return view->type >= TAG_Byte && view->type <= TAG_Long;
+}
+
+// data from a file need not be aligned, hence the memcpy
+static inline Long _integer_at(const NumericView* view, size_t i) {
+    const unsigned char* p = (const unsigned char*) view->data + i * sizeof_type[view->type];
+    switch (view->type) {
+    case TAG_Byte:
+        return (Byte) p[0];
+    case TAG_Short:
+    {
+        uint16_t v;
+        memcpy(&v, p, sizeof(v));
+        return (Short) (view->big_endian ? be16toh(v) : v);
+    }
+    case TAG_Int:
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return (Int) (view->big_endian ? be32toh(v) : v);
+    }
+    default:
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return (Long) (view->big_endian ? be64toh(v) : v);
+    }
+    }
+}
+
+static inline Double _real_at(const NumericView* view, size_t i) {
+    const unsigned char* p = (const unsigned char*) view->data + i * sizeof_type[view->type];
+    if (view->type == TAG_Float) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        v = view->big_endian ? be32toh(v) : v;
+        Float f;
+        memcpy(&f, &v, sizeof(f));
+        return f;
+    }
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    v = view->big_endian ? be64toh(v) : v;
+    Double d;
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+static void _summary_scalar(const NumericView* view, size_t start, NumericSummary* summary) {
+    if (_integral(view)) {
+        uint64_t sum = (uint64_t) summary->sum;
+        for (size_t i = start; i < view->count; i++) {
+            Long v = _integer_at(view, i);
+            sum += (uint64_t) v;
+            summary->min = v < summary->min ? v : summary->min;
+            summary->max = v > summary->max ? v : summary->max;
+        }
+        summary->sum = (Long) sum;
+        return;
+    }
+    for (size_t i = start; i < view->count; i++) {
+        Double v = _real_at(view, i);
+        summary->real_sum += v;
+        summary->real_min = v < summary->real_min ? v : summary->real_min;
+        summary->real_max = v > summary->real_max ? v : summary->real_max;
+    }
+}
+
+static size_t _count_equal_scalar(const NumericView* view, size_t start, Long value) {
+    size_t count = 0;
+    for (size_t i = start; i < view->count; i++) {
+        count += _integer_at(view, i) == value;
+    }
+    return count;
+}
+
+/* AVX2 kernels: each handles whole vectors and returns where the scalar code takes over */
+
+#ifdef AGGREGATE_AVX2
+
+static bool _has_avx2(void) {
+    static int cached = -1;
+    int has = __atomic_load_n(&cached, __ATOMIC_RELAXED);
+    if (has < 0) {
+        __builtin_cpu_init();
+        has = __builtin_cpu_supports("avx2") ? 1 : 0;
+        __atomic_store_n(&cached, has, __ATOMIC_RELAXED);
+    }
+    return has;
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+// byte shuffles that reverse every 2, 4 or 8 byte element
+AVX2 static __m256i _swap_mask(size_t width) {
+    char mask[32];
+    for (int i = 0; i < 32; i++) {
+        mask[i] = (char) ((i % 16) / width * width + (width - 1 - i % width));
+    }
+    return _mm256_loadu_si256((const __m256i*) mask);
+}
+
+AVX2 static size_t _summary8_avx2(const int8_t* data, size_t count, NumericSummary* summary) {
+    const __m256i bias = _mm256_set1_epi8((char) 0x80);
+    __m256i sum = _mm256_setzero_si256();
+    __m256i lo = _mm256_set1_epi8(INT8_MAX);
+    __m256i hi = _mm256_set1_epi8(INT8_MIN);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+        lo = _mm256_min_epi8(lo, v);
+        hi = _mm256_max_epi8(hi, v);
+        // sums of 8 unsigned bytes at a time; the bias is taken off at the end
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(_mm256_xor_si256(v, bias), _mm256_setzero_si256()));
+    }
+    int64_t sums[4];
+    int8_t los[32], his[32];
+    _mm256_storeu_si256((__m256i*) sums, sum);
+    _mm256_storeu_si256((__m256i*) los, lo);
+    _mm256_storeu_si256((__m256i*) his, hi);
+    summary->sum += sums[0] + sums[1] + sums[2] + sums[3] - (int64_t) (128 * i);
+    for (int j = 0; j < 32 && i > 0; j++) {
+        summary->min = los[j] < summary->min ? los[j] : summary->min;
+        summary->max = his[j] > summary->max ? his[j] : summary->max;
+    }
+    return i;
+}
+
+AVX2 static size_t _summary16_avx2(const int16_t* data, size_t count, bool swap, NumericSummary* summary) {
+    const __m256i mask = _swap_mask(2);
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+    __m256i lo = _mm256_set1_epi16(INT16_MAX);
+    __m256i hi = _mm256_set1_epi16(INT16_MIN);
+    size_t i = 0;
+    while (i + 16 <= count) {
+        // pairs summed into 32-bit lanes, widened before they can overflow
+        __m256i pairs = _mm256_setzero_si256();
+        for (int j = 0; j < 16384 && i + 16 <= count; j++, i += 16) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+            if (swap) {
+                v = _mm256_shuffle_epi8(v, mask);
+            }
+            lo = _mm256_min_epi16(lo, v);
+            hi = _mm256_max_epi16(hi, v);
+            pairs = _mm256_add_epi32(pairs, _mm256_madd_epi16(v, ones));
+        }
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(pairs)));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(pairs, 1)));
+    }
+    int64_t sums[4];
+    int16_t los[16], his[16];
+    _mm256_storeu_si256((__m256i*) sums, sum);
+    _mm256_storeu_si256((__m256i*) los, lo);
+    _mm256_storeu_si256((__m256i*) his, hi);
+    summary->sum += sums[0] + sums[1] + sums[2] + sums[3];
+    for (int j = 0; j < 16 && i > 0; j++) {
+        summary->min = los[j] < summary->min ? los[j] : summary->min;
+        summary->max = his[j] > summary->max ? his[j] : summary->max;
+    }
+    return i;
+}
+
+AVX2 static size_t _summary32_avx2(const int32_t* data, size_t count, bool swap, NumericSummary* summary) {
+    const __m256i mask = _swap_mask(4);
+    __m256i sum = _mm256_setzero_si256();
+    __m256i lo = _mm256_set1_epi32(INT32_MAX);
+    __m256i hi = _mm256_set1_epi32(INT32_MIN);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+        if (swap) {
+            v = _mm256_shuffle_epi8(v, mask);
+        }
+        lo = _mm256_min_epi32(lo, v);
+        hi = _mm256_max_epi32(hi, v);
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+    int64_t sums[4];
+    int32_t los[8], his[8];
+    _mm256_storeu_si256((__m256i*) sums, sum);
+    _mm256_storeu_si256((__m256i*) los, lo);
+    _mm256_storeu_si256((__m256i*) his, hi);
+    summary->sum = (Long) ((uint64_t) summary->sum + sums[0] + sums[1] + sums[2] + sums[3]);
+    for (int j = 0; j < 8 && i > 0; j++) {
+        summary->min = los[j] < summary->min ? los[j] : summary->min;
+        summary->max = his[j] > summary->max ? his[j] : summary->max;
+    }
+    return i;
+}
+
+AVX2 static size_t _summary64_avx2(const int64_t* data, size_t count, bool swap, NumericSummary* summary) {
+    const __m256i mask = _swap_mask(8);
+    __m256i sum = _mm256_setzero_si256();
+    __m256i lo = _mm256_set1_epi64x(INT64_MAX);
+    __m256i hi = _mm256_set1_epi64x(INT64_MIN);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+        if (swap) {
+            v = _mm256_shuffle_epi8(v, mask);
+        }
+        lo = _mm256_blendv_epi8(lo, v, _mm256_cmpgt_epi64(lo, v));
+        hi = _mm256_blendv_epi8(hi, v, _mm256_cmpgt_epi64(v, hi));
+        sum = _mm256_add_epi64(sum, v);
+    }
+    uint64_t sums[4];
+    int64_t los[4], his[4];
+    _mm256_storeu_si256((__m256i*) sums, sum);
+    _mm256_storeu_si256((__m256i*) los, lo);
+    _mm256_storeu_si256((__m256i*) his, hi);
+    summary->sum = (Long) ((uint64_t) summary->sum + sums[0] + sums[1] + sums[2] + sums[3]);
+    for (int j = 0; j < 4 && i > 0; j++) {
+        summary->min = los[j] < summary->min ? los[j] : summary->min;
+        summary->max = his[j] > summary->max ? his[j] : summary->max;
+    }
+    return i;
+}
+
+AVX2 static size_t _summary_float_avx2(const float* data, size_t count, bool swap, NumericSummary* summary) {
+    const __m256i mask = _swap_mask(4);
+    __m256d sum = _mm256_setzero_pd();
+    __m256 lo = _mm256_set1_ps(INFINITY);
+    __m256 hi = _mm256_set1_ps(-INFINITY);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i bits = _mm256_loadu_si256((const __m256i*) (data + i));
+        if (swap) {
+            bits = _mm256_shuffle_epi8(bits, mask);
+        }
+        __m256 v = _mm256_castsi256_ps(bits);
+        // the second operand wins when either is NaN, which leaves NaNs out
+        lo = _mm256_min_ps(v, lo);
+        hi = _mm256_max_ps(v, hi);
+        sum = _mm256_add_pd(sum, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+        sum = _mm256_add_pd(sum, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+    }
+    double sums[4];
+    float los[8], his[8];
+    _mm256_storeu_pd(sums, sum);
+    _mm256_storeu_ps(los, lo);
+    _mm256_storeu_ps(his, hi);
+    summary->real_sum += sums[0] + sums[1] + sums[2] + sums[3];
+    for (int j = 0; j < 8; j++) {
+        summary->real_min = los[j] < summary->real_min ? los[j] : summary->real_min;
+        summary->real_max = his[j] > summary->real_max ? his[j] : summary->real_max;
+    }
+    return i;
+}
+
+AVX2 static size_t _summary_double_avx2(const double* data, size_t count, bool swap, NumericSummary* summary) {
+    const __m256i mask = _swap_mask(8);
+    __m256d sum = _mm256_setzero_pd();
+    __m256d lo = _mm256_set1_pd(INFINITY);
+    __m256d hi = _mm256_set1_pd(-INFINITY);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i bits = _mm256_loadu_si256((const __m256i*) (data + i));
+        if (swap) {
+            bits = _mm256_shuffle_epi8(bits, mask);
+        }
+        __m256d v = _mm256_castsi256_pd(bits);
+        lo = _mm256_min_pd(v, lo);
+        hi = _mm256_max_pd(v, hi);
+        sum = _mm256_add_pd(sum, v);
+    }
+    double sums[4], los[4], his[4];
+    _mm256_storeu_pd(sums, sum);
+    _mm256_storeu_pd(los, lo);
+    _mm256_storeu_pd(his, hi);
+    summary->real_sum += sums[0] + sums[1] + sums[2] + sums[3];
+    for (int j = 0; j < 4; j++) {
+        summary->real_min = los[j] < summary->real_min ? los[j] : summary->real_min;
+        summary->real_max = his[j] > summary->real_max ? his[j] : summary->real_max;
+    }
+    return i;
+}
+
+/*
+ * Counting needs no byte swap at all: the needle is compared in the byte
+ * order of the data. raw is the value's bytes in that order.
+ */
+AVX2 static size_t _count_equal_avx2(const unsigned char* data, size_t count, size_t width,
+                                     const unsigned char* raw, size_t* matches) {
+    __m256i needle;
+    switch (width) {
+    case 1:
+        needle = _mm256_set1_epi8((char) raw[0]);
+        break;
+    case 2:
+    {
+        int16_t v;
+        memcpy(&v, raw, sizeof(v));
+        needle = _mm256_set1_epi16(v);
+        break;
+    }
+    case 4:
+    {
+        int32_t v;
+        memcpy(&v, raw, sizeof(v));
+        needle = _mm256_set1_epi32(v);
+        break;
+    }
+    default:
+    {
+        int64_t v;
+        memcpy(&v, raw, sizeof(v));
+        needle = _mm256_set1_epi64x(v);
+        break;
+    }
+    }
+    size_t per_vector = 32 / width;
+    size_t total = 0;
+    size_t i = 0;
+    for (; i + per_vector <= count; i += per_vector) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + i * width));
+        switch (width) {
+        case 1:
+            total += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+            break;
+        case 2:
+            total += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, needle))) / 2;
+            break;
+        case 4:
+            total += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, needle))));
+            break;
+        default:
+            total += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, needle))));
+            break;
+        }
+    }
+    *matches = total;
+    return i;
+}
+
+#endif // AGGREGATE_AVX2
+
+NumericSummary numeric_summary(const NumericView* view) {
+    NumericSummary summary = {
+        .count = view->count,
+        .min = INT64_MAX,
+        .max = INT64_MIN,
+        .real_min = INFINITY,
+        .real_max = -INFINITY,
+    };
+    size_t done = 0;
+#ifdef AGGREGATE_AVX2
+    if (_has_avx2()) {
+        switch (view->type) {
+        case TAG_Byte:
+            done = _summary8_avx2((const int8_t*) view->data, view->count, &summary);
+            break;
+        case TAG_Short:
+            done = _summary16_avx2((const int16_t*) view->data, view->count, view->big_endian, &summary);
+            break;
+        case TAG_Int:
+            done = _summary32_avx2((const int32_t*) view->data, view->count, view->big_endian, &summary);
+            break;
+        case TAG_Long:
+            done = _summary64_avx2((const int64_t*) view->data, view->count, view->big_endian, &summary);
+            break;
+        case TAG_Float:
+            done = _summary_float_avx2((const float*) view->data, view->count, view->big_endian, &summary);
+            break;
+        case TAG_Double:
+            done = _summary_double_avx2((const double*) view->data, view->count, view->big_endian, &summary);
+            break;
+        default:
+            break;
+        }
+    }
+#endif
+    _summary_scalar(view, done, &summary);
+    if (!_integral(view) || view->count == 0) {
+        summary.min = summary.max = 0;
+    }
+    if (_integral(view) || !(summary.real_min <= summary.real_max)) {
+        summary.real_min = summary.real_max = 0; // nothing but NaNs, or no reals at all
+    }
+    return summary;
+}
+
+static const Long _lowest[] = { [TAG_Byte] = INT8_MIN, [TAG_Short] = INT16_MIN, [TAG_Int] = INT32_MIN, [TAG_Long] = INT64_MIN };
+static const Long _highest[] = { [TAG_Byte] = INT8_MAX, [TAG_Short] = INT16_MAX, [TAG_Int] = INT32_MAX, [TAG_Long] = INT64_MAX };
+
+size_t numeric_count_equal(const NumericView* view, Long value) {
+    if (!_integral(view) || value < _lowest[view->type] || value > _highest[view->type]) {
+        return 0;
+    }
+    size_t matches = 0;
+    size_t done = 0;
+#ifdef AGGREGATE_AVX2
+    if (_has_avx2()) {
+        size_t width = sizeof_type[view->type];
+        unsigned char raw[8];
+        uint64_t bits = (uint64_t) value;
+        for (size_t i = 0; i < width; i++) {
+            // little-endian host: lowest byte first, unless the data is big-endian
+            size_t shift = view->big_endian ? width - 1 - i : i;
+            raw[i] = (unsigned char) (bits >> (8 * shift));
+        }
+        done = _count_equal_avx2((const unsigned char*) view->data, view->count, width, raw, &matches);
+    }
+#endif
+    return matches + _count_equal_scalar(view, done, value);
+}
+
+size_t numeric_histogram(const NumericView* view, Long lowest, uint64_t* counts, size_t bins) {
+    if (!_integral(view)) {
+        return 0;
+    }
+    size_t in_range = 0;
+    for (size_t i = 0; i < view->count; i++) {
+        uint64_t bin = (uint64_t) _integer_at(view, i) - (uint64_t) lowest;
+        if (bin < bins) {
+            counts[bin]++;
+            in_range++;
+        }
+    }
+    return in_range;
+}
+
+static size_t _distinct_bitmap(const NumericView* view, uint8_t* seen, Long offset) {
+    size_t distinct = 0;
+    for (size_t i = 0; i < view->count; i++) {
+        size_t v = (size_t) (_integer_at(view, i) + offset);
+        uint8_t bit = (uint8_t) (1u << (v % 8));
+        distinct += !(seen[v / 8] & bit);
+        seen[v / 8] |= bit;
+    }
+    return distinct;
+}
+
+size_t numeric_distinct(const NumericView* view) {
+    if (!_integral(view)) {
+        return 0;
+    }
+    if (view->type == TAG_Byte || view->type == TAG_Short) {
+        uint8_t seen[65536 / 8] = {0};
+        return _distinct_bitmap(view, seen, -_lowest[view->type]);
+    }
+
+    // open addressing, at most half full
+    size_t capacity = 16;
+    while (capacity < view->count * 2) {
+        capacity *= 2;
+    }
+    uint64_t* keys = (uint64_t*) malloc(capacity * sizeof(uint64_t));
+    uint8_t* used = (uint8_t*) calloc(capacity, sizeof(uint8_t));
+    if (!keys || !used) {
+        free(keys);
+        free(used);
+        return SIZE_MAX;
+    }
+    size_t distinct = 0;
+    for (size_t i = 0; i < view->count; i++) {
+        uint64_t key = (uint64_t) _integer_at(view, i);
+        size_t slot = (size_t) ((key * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+        while (used[slot] && keys[slot] != key) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (!used[slot]) {
+            used[slot] = 1;
+            keys[slot] = key;
+            distinct++;
+        }
+    }
+    free(keys);
+    free(used);
+    return distinct;
+}
@@ -0,0 +1,55 @@
+#ifndef NBT_AGGREGATE_H
+#define NBT_AGGREGATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nbt.h"
+
+/*
+ * Reductions over runs of numbers: the payload of a Byte_Array, Int_Array,
+ * Long_Array or a List of a primitive type, or the same elements still in
+ * big-endian file order, in which case the byte swap happens in the same pass
+ * as the reduction. On x86 the hot loops use AVX2 when the CPU has it, which
+ * is checked once at run time; elsewhere they are plain C.
+ */
+
+typedef struct NumericView {
+    enum TAGType type; // element type, TAG_Byte to TAG_Double
+    const void* data;
+    size_t count;
+    bool big_endian;   // straight from a Java file rather than a parsed tree
+} NumericView;
+
+/* views the elements of a payload, as passed to write_payload(); false if it holds no numbers */
+bool NumericView_of(enum TAGType, const void* value, NumericView*);
+
+/*
+ * For integral elements the integer fields are set, the sum wrapping around on
+ * overflow; for Float and Double the real_ fields, with NaNs left out of the
+ * minimum and maximum. Minimum and maximum are 0 for an empty view.
+ */
+typedef struct NumericSummary {
+    size_t count;
+    Long sum;
+    Long min;
+    Long max;
+    Double real_sum;
+    Double real_min;
+    Double real_max;
+} NumericSummary;
+
+NumericSummary numeric_summary(const NumericView*);
+
+/* the following take integral views only, and return 0 for others */
+
+size_t numeric_count_equal(const NumericView*, Long value);
+/*
+ * Adds one to counts[v - lowest] for every element v with lowest <= v <
+ * lowest + bins; returns how many elements fell in that range.
+ */
+size_t numeric_histogram(const NumericView*, Long lowest, uint64_t* counts, size_t bins);
+/* number of different values; SIZE_MAX when out of memory */
+size_t numeric_distinct(const NumericView*);
+
+#endif // NBT_AGGREGATE_H
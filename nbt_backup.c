@@ -0,0 +1,496 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_backup.h"
+#include "nbt_region.h"
+#include "nbt_load.h"
+#include "nbt_replace.h"
+#include "nbt_hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MANIFEST_HEADER "nbt-backup 1"
+#define KEY_SIZE 48
+
+typedef struct {
+    int index;
+    uint32_t timestamp;
+    char key[KEY_SIZE];
+} _ManifestChunk;
+
+typedef struct {
+    char* path; // relative to the world
+    _ManifestChunk* chunks; // by index
+    size_t count;
+} _ManifestRegion;
+
+typedef struct {
+    _ManifestRegion* regions; // by path
+    size_t count;
+} _Manifest;
+
+static char* _format(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+static char* _format(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    char* text = needed >= 0 ? (char*) malloc(needed + 1) : NULL;
+    if (text) {
+        va_start(args, format);
+        vsnprintf(text, needed + 1, format, args);
+        va_end(args);
+    }
+    return text;
+}
+
+/* creates the directories leading up to path */
+static bool _make_parents(const char* path) {
+    char* copy = strdup(path);
+    if (!copy) {
+        return false;
+    }
+    bool ok = true;
+    for (char* slash = strchr(copy + 1, '/'); ok && slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        ok = mkdir(copy, 0755) == 0 || errno == EEXIST;
+        *slash = '/';
+    }
+    if (!ok) {
+        perror(copy);
+    }
+    free(copy);
+    return ok;
+}
+
+static void _manifest_destroy(_Manifest* manifest) {
+    for (size_t i = 0; i < manifest->count; i++) {
+        free(manifest->regions[i].path);
+        free(manifest->regions[i].chunks);
+    }
+    free(manifest->regions);
+    *manifest = (_Manifest){0};
+}
+
+static bool _manifest_load(const char* path, _Manifest* manifest) {
+    *manifest = (_Manifest){0};
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    size_t region_capacity = 0;
+    size_t chunk_capacity = 0;
+    bool ok = getline(&line, &line_capacity, file) > 0 && strcmp(line, MANIFEST_HEADER "\n") == 0;
+    while (ok && (length = getline(&line, &line_capacity, file)) > 0) {
+        if (line[length - 1] == '\n') {
+            line[--length] = '\0';
+        }
+        if (strncmp(line, "region ", 7) == 0) {
+            if (manifest->count == region_capacity) {
+                region_capacity = region_capacity ? region_capacity * 2 : 16;
+                _ManifestRegion* temp = (_ManifestRegion*) realloc(manifest->regions,
+                        region_capacity * sizeof(_ManifestRegion));
+                if (!temp) {
+                    ok = false;
+                    break;
+                }
+                manifest->regions = temp;
+            }
+            _ManifestRegion* region = &manifest->regions[manifest->count++];
+            *region = (_ManifestRegion){ .path = strdup(line + 7) };
+            chunk_capacity = 0;
+            ok = region->path != NULL;
+            continue;
+        }
+        _ManifestChunk chunk;
+        if (manifest->count == 0
+                || sscanf(line, "%d %u %47s", &chunk.index, &chunk.timestamp, chunk.key) != 3
+                || chunk.index < 0 || chunk.index >= REGION_CHUNKS) {
+            ok = false;
+            break;
+        }
+        _ManifestRegion* region = &manifest->regions[manifest->count - 1];
+        if (region->count == chunk_capacity) {
+            chunk_capacity = chunk_capacity ? chunk_capacity * 2 : 64;
+            _ManifestChunk* temp = (_ManifestChunk*) realloc(region->chunks, chunk_capacity * sizeof(_ManifestChunk));
+            if (!temp) {
+                ok = false;
+                break;
+            }
+            region->chunks = temp;
+        }
+        region->chunks[region->count++] = chunk;
+    }
+    free(line);
+    if (ferror(file)) {
+        ok = false;
+    }
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "%s is not a backup manifest\n", path);
+        _manifest_destroy(manifest);
+    }
+    return ok;
+}
+
+static const _ManifestRegion* _manifest_region(const _Manifest* manifest, const char* path) {
+    size_t low = 0;
+    size_t high = manifest->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int cmp = strcmp(manifest->regions[middle].path, path);
+        if (cmp == 0) {
+            return &manifest->regions[middle];
+        }
+        if (cmp < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+static const _ManifestChunk* _manifest_chunk(const _ManifestRegion* region, int index) {
+    size_t low = 0;
+    size_t high = region ? region->count : 0;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (region->chunks[middle].index == index) {
+            return &region->chunks[middle];
+        }
+        if (region->chunks[middle].index < index) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+/* store */
+
+static char* _payload_path(const char* store, const char* key) {
+    return _format("%s/chunks/%.2s/%s", store, key, key);
+}
+
+static bool _write_file(const char* path, const unsigned char* header, size_t header_length,
+                        const unsigned char* data, size_t length) {
+    char* temp;
+    FILE* file = replace_open(path, &temp);
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    bool ok = fwrite(header, 1, header_length, file) == header_length && fwrite(data, 1, length, file) == length;
+    if (!replace_close(file, temp, path, ok)) {
+        perror(path);
+        return false;
+    }
+    return true;
+}
+
+/* finds or adds the payload in the store; key receives its name */
+static bool _put(const char* store, enum RegionCompression compression, const unsigned char* data, size_t length,
+                 char key[KEY_SIZE], BackupStats* stats) {
+    unsigned char type = (unsigned char) compression;
+    // a collision only costs a comparison, below
+    uint64_t hash = fnv1a_update(fnv1a(&type, 1), data, length);
+    for (int attempt = 0; ; attempt++) {
+        if (attempt == 0) {
+            snprintf(key, KEY_SIZE, "%016llx-%zx", (unsigned long long) hash, length);
+        } else {
+            snprintf(key, KEY_SIZE, "%016llx-%zx.%d", (unsigned long long) hash, length, attempt);
+        }
+        char* path = _payload_path(store, key);
+        if (!path) {
+            return false;
+        }
+        unsigned char* existing = NULL;
+        size_t existing_length;
+        if (access(path, F_OK) == 0) {
+            // same hash and length; the bytes decide
+            bool same = load_file(path, &existing, &existing_length) && existing_length == length + 1
+                    && existing[0] == type && memcmp(existing + 1, data, length) == 0;
+            free(existing);
+            free(path);
+            if (same) {
+                return true;
+            }
+            continue;
+        }
+        bool ok = _make_parents(path) && _write_file(path, &type, 1, data, length);
+        free(path);
+        if (ok) {
+            stats->stored++;
+            stats->bytes_stored += length + 1;
+        }
+        return ok;
+    }
+}
+
+/* backup */
+
+static bool _add_regions(const char* world, const char* directory, char*** paths, size_t* count) {
+    char* full = _format("%s/%s", world, directory);
+    DIR* dir = full ? opendir(full) : NULL;
+    free(full);
+    if (!dir) {
+        return true;
+    }
+    struct dirent* entry;
+    bool ok = true;
+    while (ok && (entry = readdir(dir))) {
+        int x, z;
+        size_t name_length = strlen(entry->d_name);
+        if (sscanf(entry->d_name, "r.%d.%d.", &x, &z) != 2 || name_length < 4
+                || strcmp(entry->d_name + name_length - 4, ".mca") != 0) {
+            continue;
+        }
+        char* path = _format("%s/%s", directory, entry->d_name);
+        char** temp = path ? (char**) realloc(*paths, (*count + 1) * sizeof(char*)) : NULL;
+        if (!temp) {
+            free(path);
+            ok = false;
+            break;
+        }
+        temp[(*count)++] = path;
+        *paths = temp;
+    }
+    closedir(dir);
+    return ok;
+}
+
+static int _compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/*
+ * Many tools leave timestamps at 0, so only a nonzero timestamp equal to the
+ * last snapshot's counts, and then only if the payload is as long as before.
+ */
+static bool _unchanged(RegionFile* region, int x, int z, const _ManifestChunk* before, uint32_t timestamp) {
+    size_t length;
+    size_t previous_length;
+    return before && timestamp != 0 && before->timestamp == timestamp
+        && RegionFile_stored_length(region, x, z, &length)
+        && sscanf(before->key, "%*16[0-9a-f]-%zx", &previous_length) == 1 && length == previous_length;
+}
+
+static bool _backup_region(const char* world, const char* store, const char* path, const _ManifestRegion* previous,
+                           const BackupOptions* options, FILE* manifest, BackupStats* stats) {
+    char* full = _format("%s/%s", world, path);
+    RegionFile* region = full ? RegionFile_open(full, false) : NULL;
+    if (!region) {
+        fprintf(stderr, "Could not open %s\n", full ? full : path);
+        free(full);
+        return false;
+    }
+    bool ok = fprintf(manifest, "region %s\n", path) > 0;
+    for (int i = 0; ok && i < REGION_CHUNKS; i++) {
+        int x = i % 32;
+        int z = i / 32;
+        if (!RegionFile_has_chunk(region, x, z)) {
+            continue;
+        }
+        uint32_t timestamp = RegionFile_timestamp(region, x, z);
+        const _ManifestChunk* before = _manifest_chunk(previous, i);
+        char key[KEY_SIZE];
+        if (!options->rehash && _unchanged(region, x, z, before, timestamp)) {
+            memcpy(key, before->key, KEY_SIZE);
+            stats->unchanged++;
+        } else {
+            unsigned char* data;
+            size_t length;
+            enum RegionCompression compression;
+            if (!RegionFile_read_compressed(region, x, z, &data, &length, &compression)) {
+                fprintf(stderr, "Could not read chunk %d, %d of %s\n", x, z, full);
+                ok = false;
+                break;
+            }
+            ok = _put(store, compression, data, length, key, stats);
+            free(data);
+            stats->hashed++;
+        }
+        stats->chunks++;
+        ok = ok && fprintf(manifest, "%d %u %s\n", i, timestamp, key) > 0;
+    }
+    RegionFile_close(region);
+    free(full);
+    stats->regions++;
+    return ok;
+}
+
+bool backup_world(const char* world, const char* store, const char* snapshot, const BackupOptions* options,
+                  BackupStats* stats) {
+    static const char* const directories[] = {
+        "region", "entities", "poi",
+        "DIM-1/region", "DIM-1/entities", "DIM-1/poi",
+        "DIM1/region", "DIM1/entities", "DIM1/poi",
+    };
+    static const BackupOptions no_options = {0};
+    BackupStats local;
+    if (!options) {
+        options = &no_options;
+    }
+    if (!stats) {
+        stats = &local;
+    }
+    *stats = (BackupStats){0};
+    if (strchr(snapshot, '/')) {
+        fprintf(stderr, "Invalid snapshot name %s\n", snapshot);
+        return false;
+    }
+
+    char** paths = NULL;
+    size_t count = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < sizeof(directories) / sizeof(directories[0]); i++) {
+        ok = _add_regions(world, directories[i], &paths, &count);
+    }
+    if (ok && count == 0) {
+        fprintf(stderr, "No region files in %s\n", world);
+        ok = false;
+    }
+    if (ok) {
+        qsort(paths, count, sizeof(char*), _compare_paths);
+    }
+
+    _Manifest previous = {0};
+    if (ok && options->previous) {
+        char* path = _format("%s/snapshots/%s", store, options->previous);
+        ok = path && _manifest_load(path, &previous);
+        free(path);
+    }
+
+    // the manifest appears under its name only once complete
+    char* path = _format("%s/snapshots/%s", store, snapshot);
+    char* temp = path ? _format("%s.partial", path) : NULL;
+    FILE* manifest = NULL;
+    if (ok && temp && _make_parents(temp)) {
+        manifest = fopen(temp, "w");
+        if (!manifest) {
+            perror(temp);
+        }
+    }
+    ok = ok && manifest && fputs(MANIFEST_HEADER "\n", manifest) >= 0;
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = _backup_region(world, store, paths[i], _manifest_region(&previous, paths[i]), options, manifest, stats);
+    }
+    if (manifest) {
+        ok = fclose(manifest) == 0 && ok;
+        if (ok && rename(temp, path) != 0) {
+            perror(path);
+            ok = false;
+        }
+        if (!ok) {
+            unlink(temp);
+        }
+    }
+
+    free(path);
+    free(temp);
+    _manifest_destroy(&previous);
+    for (size_t i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    return ok;
+}
+
+/* restore */
+
+static bool _restore_region(const char* store, const char* world, const _ManifestRegion* entry, BackupStats* stats) {
+    char* path = _format("%s/%s", world, entry->path);
+    char* temp = path ? _format("%s.restore", path) : NULL;
+    RegionChunk* chunks = (RegionChunk*) calloc(entry->count ? entry->count : 1, sizeof(RegionChunk));
+    bool ok = temp && chunks && _make_parents(temp);
+    size_t loaded = 0;
+    for (; ok && loaded < entry->count; loaded++) {
+        const _ManifestChunk* chunk = &entry->chunks[loaded];
+        char* payload_path = _payload_path(store, chunk->key);
+        unsigned char* data = NULL;
+        size_t length = 0;
+        ok = payload_path && load_file(payload_path, &data, &length) && length > 0;
+        if (!ok) {
+            fprintf(stderr, "Missing chunk %s in %s\n", chunk->key, store);
+        }
+        free(payload_path);
+        chunks[loaded] = (RegionChunk){
+            .x = chunk->index % 32,
+            .z = chunk->index / 32,
+            .raw = data ? data + 1 : NULL,
+            .raw_length = length ? length - 1 : 0,
+            .timestamp = chunk->timestamp,
+            .compression = data ? (enum RegionCompression) data[0] : 0,
+        };
+        if (!ok) {
+            free(data);
+            chunks[loaded].raw = NULL;
+        }
+    }
+
+    // written next to the region and renamed over it, so a failure leaves the old file
+    if (ok) {
+        unlink(temp);
+        RegionFile* region = RegionFile_open(temp, true);
+        ok = region && RegionFile_write_chunks(region, chunks, entry->count, NULL);
+        RegionFile_close(region);
+        if (ok && rename(temp, path) != 0) {
+            perror(path);
+            ok = false;
+        }
+        if (!ok) {
+            unlink(temp);
+        }
+    }
+    if (ok) {
+        stats->regions++;
+        stats->chunks += entry->count;
+    }
+    for (size_t i = 0; chunks && i < loaded; i++) {
+        if (chunks[i].raw) {
+            free((unsigned char*) chunks[i].raw - 1);
+        }
+    }
+    free(chunks);
+    free(temp);
+    free(path);
+    return ok;
+}
+
+bool backup_restore(const char* store, const char* snapshot, const char* world, BackupStats* stats) {
+    BackupStats local;
+    if (!stats) {
+        stats = &local;
+    }
+    *stats = (BackupStats){0};
+    char* path = _format("%s/snapshots/%s", store, snapshot);
+    _Manifest manifest;
+    bool ok = path && _manifest_load(path, &manifest);
+    free(path);
+    if (!ok) {
+        return false;
+    }
+    for (size_t i = 0; ok && i < manifest.count; i++) {
+        if (strstr(manifest.regions[i].path, "..")) {
+            fprintf(stderr, "Refusing to restore %s outside the world\n", manifest.regions[i].path);
+            ok = false;
+            break;
+        }
+        ok = _restore_region(store, world, &manifest.regions[i], stats);
+    }
+    _manifest_destroy(&manifest);
+    return ok;
+}
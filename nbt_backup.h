@@ -0,0 +1,53 @@
+#ifndef NBT_BACKUP_H
+#define NBT_BACKUP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Incremental, deduplicated backups of a world's region files.
+ *
+ * A store directory holds the compressed payloads of chunks, one file per
+ * distinct payload under chunks/, named after its hash and length, and one
+ * manifest per snapshot under snapshots/. A manifest lists, for every region
+ * file, the timestamp and payload of each of its chunks:
+ *   nbt-backup 1
+ *   region <path relative to the world>
+ *   <chunk index> <timestamp> <payload>
+ *
+ * Against a previous snapshot, a chunk whose timestamp is not 0 and has not
+ * changed, and whose stored payload is as long as before, is taken to be the
+ * same and is neither read nor hashed. Other chunks are read as stored,
+ * without being decompressed, hashed, and copied into the store unless an
+ * identical payload is there already.
+ */
+
+typedef struct BackupOptions {
+    const char* previous; // snapshot to compare timestamps against, may be NULL
+    bool rehash;          // hash every chunk even when its timestamp is unchanged
+} BackupOptions;
+
+typedef struct BackupStats {
+    uint64_t regions;
+    uint64_t chunks;
+    uint64_t unchanged; // timestamp and length as in the previous snapshot
+    uint64_t hashed;
+    uint64_t stored;    // new payloads written to the store
+    uint64_t bytes_stored;
+} BackupStats;
+
+/*
+ * Records snapshot of the region, entities and poi files of world and its
+ * DIM-1 and DIM1 dimensions. options and stats may be NULL.
+ */
+bool backup_world(const char* world, const char* store, const char* snapshot, const BackupOptions*, BackupStats*);
+
+/*
+ * Rebuilds every region file of snapshot under world, replacing existing ones,
+ * from the stored payloads as they are. Chunks recorded without a timestamp
+ * get the time of the restore. stats may be NULL.
+ */
+bool backup_restore(const char* store, const char* snapshot, const char* world, BackupStats*);
+
+#endif // NBT_BACKUP_H
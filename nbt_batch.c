@@ -0,0 +1,536 @@
+#define _GNU_SOURCE // statx
+
+#include "nbt_batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#  include <linux/io_uring.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#    define HAVE_IO_URING
+#  endif
+#endif
+
+static const unsigned DEFAULT_QUEUE_DEPTH = 64;
+static const int DEFAULT_THREADS = 4;
+
+/* thread pool fallback */
+
+typedef struct PoolJob {
+    const char* const* paths;
+    const size_t* retry; // loaded before paths[first..count)
+    size_t retry_count;
+    size_t first;
+    size_t count;
+    size_t next;
+    size_t loaded;
+    BatchCallback callback;
+    void* userdata;
+} PoolJob;
+
+static int _pread_file(const char* path, unsigned char** data, size_t* length) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int error = errno;
+        close(fd);
+        return error;
+    }
+    size_t size = st.st_size;
+    unsigned char* buffer = (unsigned char*) malloc(size ? size : 1);
+    if (!buffer) {
+        close(fd);
+        return ENOMEM;
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, buffer + done, size - done, done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            int error = n < 0 ? errno : EIO;
+            free(buffer);
+            close(fd);
+            return error;
+        }
+        done += n;
+    }
+    close(fd);
+    *data = buffer;
+    *length = size;
+    return 0;
+}
+
+static void* _pool_worker(void* arg) {
+    PoolJob* job = (PoolJob*) arg;
+    while (1) {
+        size_t claimed = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (claimed >= job->retry_count + (job->count - job->first)) {
+            return NULL;
+        }
+        size_t i = claimed < job->retry_count ? job->retry[claimed] : job->first + claimed - job->retry_count;
+        unsigned char* data = NULL;
+        size_t length = 0;
+        int error = _pread_file(job->paths[i], &data, &length);
+        if (!error) {
+            __atomic_fetch_add(&job->loaded, 1, __ATOMIC_RELAXED);
+        }
+        job->callback(job->userdata, i, data, length, error);
+    }
+}
+
+/* loads the retry_count files listed in retry, then paths[first..count) */
+static size_t _load_with_pool(const char* const* paths, const size_t* retry, size_t retry_count,
+                              size_t first, size_t count, int thread_count,
+                              BatchCallback callback, void* userdata) {
+    PoolJob job = {
+        .paths = paths,
+        .retry = retry,
+        .retry_count = retry_count,
+        .first = first,
+        .count = count,
+        .callback = callback,
+        .userdata = userdata,
+    };
+    pthread_t* threads = (pthread_t*) calloc(thread_count, sizeof(pthread_t));
+    int started = 0;
+    for (int i = 1; threads && i < thread_count; i++) {
+        if (pthread_create(&threads[started], NULL, _pool_worker, &job) != 0) {
+            break;
+        }
+        started++;
+    }
+    _pool_worker(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return job.loaded;
+}
+
+#ifdef HAVE_IO_URING
+
+/* a minimal io_uring driver on raw syscalls, so liburing is not needed */
+
+typedef struct Ring {
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    unsigned sq_pending; // prepared but not yet submitted
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} Ring;
+
+static int _ring_setup(Ring* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    if (single_mmap) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(ring->fd);
+            return -1;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (!single_mmap) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        return -1;
+    }
+
+    char* sq = (char*) ring->sq_ring;
+    ring->sq_head = (unsigned*) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) (sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    char* cq = (char*) ring->cq_ring;
+    ring->cq_head = (unsigned*) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void _ring_destroy(Ring* ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+/* submits what was prepared and, if wait is set, blocks for one completion */
+static int _ring_enter(Ring* ring, bool wait) {
+    while (1) {
+        long ret = syscall(__NR_io_uring_enter, ring->fd, ring->sq_pending, wait ? 1 : 0,
+                           wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret >= 0) {
+            ring->sq_pending -= (unsigned) ret;
+            return 0;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+static struct io_uring_sqe* _ring_get_sqe(Ring* ring) {
+    unsigned tail = *ring->sq_tail;
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        if (_ring_enter(ring, false) != 0) {
+            return NULL;
+        }
+        if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+    unsigned slot = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[slot] = slot;
+    return sqe;
+}
+
+/* makes the entry from _ring_get_sqe() visible to the kernel */
+static void _ring_push(Ring* ring) {
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+    ring->sq_pending++;
+}
+
+/* per-file state; user_data of every request is (slot << 2) | operation */
+
+enum { OP_OPEN, OP_STATX, OP_READ, OP_CLOSE };
+
+typedef struct FileSlot {
+    size_t index;
+    bool busy;
+    int fd;
+    int pending;
+    int error;
+    struct statx stx;
+    unsigned char* data;
+    size_t size;
+    size_t done;
+} FileSlot;
+
+typedef struct UringJob {
+    Ring ring;
+    const char* const* paths;
+    size_t count;
+    size_t next;
+    size_t loaded;
+    unsigned inflight;  // requests submitted and not completed
+    BatchCallback callback;
+    void* userdata;
+} UringJob;
+
+static bool _submit(UringJob* job, size_t slot, int op, FileSlot* file) {
+    struct io_uring_sqe* sqe = _ring_get_sqe(&job->ring);
+    if (!sqe) {
+        return false;
+    }
+    sqe->user_data = ((uint64_t) slot << 2) | op;
+    switch (op) {
+    case OP_OPEN:
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t) (uintptr_t) job->paths[file->index];
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        break;
+    case OP_STATX:
+        // statx by path runs alongside the open instead of waiting for the fd
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t) (uintptr_t) job->paths[file->index];
+        sqe->len = STATX_SIZE;
+        sqe->off = (uint64_t) (uintptr_t) &file->stx;
+        break;
+    case OP_READ:
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = file->fd;
+        sqe->addr = (uint64_t) (uintptr_t) (file->data + file->done);
+        sqe->len = file->size - file->done;
+        sqe->off = file->done;
+        break;
+    case OP_CLOSE:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = file->fd;
+        break;
+    }
+    _ring_push(&job->ring);
+    job->inflight++;
+    return true;
+}
+
+static void _finish(UringJob* job, size_t slot, FileSlot* file) {
+    if (file->fd >= 0 && !_submit(job, slot, OP_CLOSE, file)) {
+        close(file->fd);
+    }
+    size_t index = file->index;
+    int error = file->error;
+    unsigned char* data = file->data;
+    if (error == EINVAL || error == EOPNOTSUPP) {
+        // an opcode this kernel lacks; read the file the ordinary way
+        free(data);
+        data = NULL;
+        error = _pread_file(job->paths[index], &data, &file->size);
+    } else if (error) {
+        free(data);
+        data = NULL;
+    }
+    size_t size = error ? 0 : file->size;
+    file->busy = false;
+    file->data = NULL;
+    if (!error) {
+        job->loaded++;
+    }
+    job->callback(job->userdata, index, data, size, error);
+}
+
+static void _start(UringJob* job, size_t slot, FileSlot* file) {
+    *file = (FileSlot){
+        .index = job->next++,
+        .busy = true,
+        .fd = -1,
+        .pending = 2,
+    };
+    if (!_submit(job, slot, OP_OPEN, file)) {
+        file->pending = 0;
+        file->error = EAGAIN;
+        _finish(job, slot, file);
+        return;
+    }
+    if (!_submit(job, slot, OP_STATX, file)) {
+        file->pending = 1;
+        file->error = EAGAIN;
+    }
+}
+
+/* open and statx are done: allocate and read, or give up */
+static void _opened(UringJob* job, size_t slot, FileSlot* file) {
+    if (file->error) {
+        _finish(job, slot, file);
+        return;
+    }
+    file->size = file->stx.stx_size;
+    file->data = (unsigned char*) malloc(file->size ? file->size : 1);
+    if (!file->data) {
+        file->error = ENOMEM;
+        _finish(job, slot, file);
+        return;
+    }
+    if (file->size == 0) {
+        _finish(job, slot, file);
+        return;
+    }
+    file->pending = 1;
+    if (!_submit(job, slot, OP_READ, file)) {
+        file->pending = 0;
+        file->error = EAGAIN;
+        _finish(job, slot, file);
+    }
+}
+
+static void _complete(UringJob* job, FileSlot* slots, const struct io_uring_cqe* cqe) {
+    size_t slot = cqe->user_data >> 2;
+    int op = cqe->user_data & 3;
+    int res = cqe->res;
+    job->inflight--;
+    if (op == OP_CLOSE) {
+        return; // the slot may already hold another file
+    }
+    FileSlot* file = &slots[slot];
+    file->pending--;
+    switch (op) {
+    case OP_OPEN:
+        if (res >= 0) {
+            file->fd = res;
+        } else if (!file->error) {
+            file->error = -res;
+        }
+        break;
+    case OP_STATX:
+        if (res < 0 && !file->error) {
+            file->error = -res;
+        }
+        break;
+    case OP_READ:
+        if (res == -EINTR || res == -EAGAIN) {
+            res = 0;
+        } else if (res <= 0) {
+            file->error = res < 0 ? -res : EIO; // error, or the file shrank
+            _finish(job, slot, file);
+            return;
+        }
+        file->done += res;
+        if (file->done == file->size) {
+            _finish(job, slot, file);
+        } else {
+            file->pending = 1;
+            if (!_submit(job, slot, OP_READ, file)) {
+                file->pending = 0;
+                file->error = EAGAIN;
+                _finish(job, slot, file);
+            }
+        }
+        return;
+    }
+    if (file->pending == 0) {
+        _opened(job, slot, file);
+    }
+}
+
+static bool _load_with_uring(const char* const* paths, size_t count, unsigned depth, int threads,
+                             BatchCallback callback, void* userdata, size_t* loaded) {
+    UringJob job = {
+        .paths = paths,
+        .count = count,
+        .callback = callback,
+        .userdata = userdata,
+    };
+    // a slot can have a close, an open and a statx queued at once
+    if (_ring_setup(&job.ring, depth * 4) != 0) {
+        return false;
+    }
+    FileSlot* slots = (FileSlot*) calloc(depth, sizeof(FileSlot));
+    if (!slots) {
+        _ring_destroy(&job.ring);
+        return false;
+    }
+    bool ok = true;
+    while (1) {
+        for (unsigned i = 0; i < depth && job.next < count; i++) {
+            if (!slots[i].busy) {
+                _start(&job, i, &slots[i]);
+            }
+        }
+        if (job.inflight == 0) {
+            break;
+        }
+        if (_ring_enter(&job.ring, true) != 0) {
+            ok = false;
+            break;
+        }
+        unsigned head = *job.ring.cq_head;
+        unsigned tail = __atomic_load_n(job.ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe cqe = job.ring.cqes[head & *job.ring.cq_mask];
+            __atomic_store_n(job.ring.cq_head, ++head, __ATOMIC_RELEASE);
+            _complete(&job, slots, &cqe);
+            tail = __atomic_load_n(job.ring.cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+    _ring_destroy(&job.ring);
+    // if the ring broke down, the files in flight start over in the pool along with the rest
+    size_t* retry = (size_t*) slots;
+    size_t retry_count = 0;
+    for (unsigned i = 0; !ok && i < depth; i++) {
+        if (slots[i].busy) {
+            free(slots[i].data);
+            if (slots[i].fd >= 0) {
+                close(slots[i].fd);
+            }
+            retry[retry_count++] = slots[i].index; // never overtakes slots[i]
+        }
+    }
+    if (retry_count > 0 || job.next < count) {
+        job.loaded += _load_with_pool(paths, retry, retry_count, job.next, count, threads, callback, userdata);
+    }
+    free(slots);
+    *loaded = job.loaded;
+    return true;
+}
+
+bool batch_uring_available(void) {
+    Ring ring;
+    if (_ring_setup(&ring, 4) != 0) {
+        return false;
+    }
+    _ring_destroy(&ring);
+    return true;
+}
+
+#else
+
+bool batch_uring_available(void) {
+    return false;
+}
+
+#endif
+
+size_t load_files_batched(const char* const* paths, size_t count, const BatchOptions* options,
+                          BatchCallback callback, void* userdata) {
+    unsigned depth = options && options->queue_depth ? options->queue_depth : DEFAULT_QUEUE_DEPTH;
+    int threads = options && options->threads > 0 ? options->threads : DEFAULT_THREADS;
+    if (count == 0) {
+        return 0;
+    }
+#ifdef HAVE_IO_URING
+    if (!options || !options->no_uring) {
+        size_t loaded;
+        if (depth > count) {
+            depth = count;
+        }
+        if (_load_with_uring(paths, count, depth, threads, callback, userdata, &loaded)) {
+            return loaded;
+        }
+    }
+#else
+    (void) depth;
+#endif
+    return _load_with_pool(paths, NULL, 0, 0, count, threads, callback, userdata);
+}
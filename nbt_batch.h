@@ -0,0 +1,38 @@
+#ifndef NBT_BATCH_H
+#define NBT_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Loads many small files with as few blocking syscalls as possible.
+ *
+ * On Linux the opens, stats, reads and closes of up to queue_depth files are
+ * submitted together through io_uring, and each file is handed over as soon
+ * as its last read completes. Where io_uring is unavailable (old kernels,
+ * seccomp filters, other systems) a pool of threads reads the files with
+ * pread instead.
+ */
+
+typedef struct BatchOptions {
+    unsigned queue_depth; // files in flight, 0 for 64
+    int threads;          // size of the fallback pool, 0 for 4
+    bool no_uring;        // always use the thread pool
+} BatchOptions;
+
+/*
+ * Called once per file. On success data holds the whole file and belongs to
+ * the callback, which must free() it; on failure data is NULL and error is an
+ * errno value. With io_uring every call comes from the calling thread, with
+ * the thread pool calls come from the workers concurrently. Should the ring
+ * fail partway, the files not yet handed over go to the pool.
+ */
+typedef void (*BatchCallback)(void* userdata, size_t index, unsigned char* data, size_t length, int error);
+
+/* returns the number of files that were read successfully; options may be NULL */
+size_t load_files_batched(const char* const* paths, size_t count, const BatchOptions*,
+                          BatchCallback, void* userdata);
+
+bool batch_uring_available(void);
+
+#endif // NBT_BATCH_H
@@ -0,0 +1,328 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_cache.h"
+#include "nbt_load.h"
+#include "nbt_parse.h"
+#include "nbt.h"
+#include "nbt_hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+struct CachedDocument {
+    char* path;
+    NamedTag* tag;
+    size_t bytes;
+    int refcount;
+    bool cached; // still reachable from the table
+
+    struct timespec mtime;
+    off_t size;
+    uint64_t hash;
+
+    CachedDocument* next_in_bucket;
+    CachedDocument* newer;
+    CachedDocument* older;
+};
+
+struct NBTCache {
+    pthread_mutex_t lock;
+    size_t capacity;
+    bool hash_contents;
+    bool has_options;
+    ParseOptions options;
+
+    CachedDocument** buckets;
+    size_t bucket_count;
+
+    CachedDocument* newest;
+    CachedDocument* oldest;
+
+    NBTCacheStats stats;
+};
+
+static size_t _bucket(const NBTCache* cache, const char* path) {
+    return fnv1a_string(path) & (cache->bucket_count - 1);
+}
+
+NBTCache* NBTCache_new(size_t capacity_bytes, bool hash_contents, const ParseOptions* options) {
+    NBTCache* cache = (NBTCache*) calloc(1, sizeof(NBTCache));
+    if (!cache) {
+        return NULL;
+    }
+    cache->bucket_count = 64;
+    cache->buckets = (CachedDocument**) calloc(cache->bucket_count, sizeof(CachedDocument*));
+    if (!cache->buckets) {
+        free(cache);
+        return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->capacity = capacity_bytes;
+    cache->hash_contents = hash_contents;
+    if (options) {
+        cache->has_options = true;
+        cache->options = *options;
+    }
+    return cache;
+}
+
+static void _document_free(CachedDocument* doc) {
+    NamedTag_free(doc->tag);
+    free(doc->path);
+    free(doc);
+}
+
+/* table and LRU bookkeeping, all called with the lock held */
+
+static void _unlink_lru(NBTCache* cache, CachedDocument* doc) {
+    if (doc->newer) {
+        doc->newer->older = doc->older;
+    } else {
+        cache->newest = doc->older;
+    }
+    if (doc->older) {
+        doc->older->newer = doc->newer;
+    } else {
+        cache->oldest = doc->newer;
+    }
+    doc->newer = doc->older = NULL;
+}
+
+static void _push_lru(NBTCache* cache, CachedDocument* doc) {
+    doc->older = cache->newest;
+    doc->newer = NULL;
+    if (cache->newest) {
+        cache->newest->newer = doc;
+    } else {
+        cache->oldest = doc;
+    }
+    cache->newest = doc;
+}
+
+static CachedDocument* _lookup(NBTCache* cache, const char* path) {
+    for (CachedDocument* doc = cache->buckets[_bucket(cache, path)]; doc; doc = doc->next_in_bucket) {
+        if (strcmp(doc->path, path) == 0) {
+            return doc;
+        }
+    }
+    return NULL;
+}
+
+static void _grow_table(NBTCache* cache) {
+    size_t count = cache->bucket_count * 2;
+    CachedDocument** buckets = (CachedDocument**) calloc(count, sizeof(CachedDocument*));
+    if (!buckets) {
+        return; // longer chains, still correct
+    }
+    for (size_t i = 0; i < cache->bucket_count; i++) {
+        CachedDocument* doc = cache->buckets[i];
+        while (doc) {
+            CachedDocument* next = doc->next_in_bucket;
+            size_t slot = fnv1a_string(doc->path) & (count - 1);
+            doc->next_in_bucket = buckets[slot];
+            buckets[slot] = doc;
+            doc = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = count;
+}
+
+static void _insert(NBTCache* cache, CachedDocument* doc) {
+    if (cache->stats.entries + 1 > cache->bucket_count) {
+        _grow_table(cache);
+    }
+    size_t slot = _bucket(cache, doc->path);
+    doc->next_in_bucket = cache->buckets[slot];
+    cache->buckets[slot] = doc;
+    doc->cached = true;
+    _push_lru(cache, doc);
+    cache->stats.entries++;
+    cache->stats.bytes += doc->bytes;
+}
+
+/* unlinks doc; returns true when the caller should free it */
+static bool _remove(NBTCache* cache, CachedDocument* doc) {
+    CachedDocument** link = &cache->buckets[_bucket(cache, doc->path)];
+    while (*link != doc) {
+        link = &(*link)->next_in_bucket;
+    }
+    *link = doc->next_in_bucket;
+    _unlink_lru(cache, doc);
+    doc->cached = false;
+    cache->stats.entries--;
+    cache->stats.bytes -= doc->bytes;
+    return doc->refcount == 0;
+}
+
+/* evicts least recently used entries until the cache fits; returns them as a list to free */
+static CachedDocument* _evict(NBTCache* cache) {
+    CachedDocument* to_free = NULL;
+    while (cache->stats.bytes > cache->capacity && cache->oldest) {
+        CachedDocument* victim = cache->oldest;
+        cache->stats.evictions++;
+        if (_remove(cache, victim)) {
+            victim->next_in_bucket = to_free;
+            to_free = victim;
+        }
+    }
+    return to_free;
+}
+
+static void _free_list(CachedDocument* list) {
+    while (list) {
+        CachedDocument* next = list->next_in_bucket;
+        _document_free(list);
+        list = next;
+    }
+}
+
+static bool _same_stat(const CachedDocument* doc, const struct stat* st) {
+    return doc->size == st->st_size
+        && doc->mtime.tv_sec == st->st_mtim.tv_sec
+        && doc->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+CachedDocument* NBTCache_get(NBTCache* cache, const char* path) {
+    // the size and mtime kept with the document are those of the file that was read
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    CachedDocument* doc = _lookup(cache, path);
+    if (doc && _same_stat(doc, &st)) {
+        doc->refcount++;
+        _unlink_lru(cache, doc);
+        _push_lru(cache, doc);
+        cache->stats.hits++;
+        pthread_mutex_unlock(&cache->lock);
+        close(fd);
+        return doc;
+    }
+    uint64_t cached_hash = doc ? doc->hash : 0;
+    bool had_entry = doc != NULL;
+    pthread_mutex_unlock(&cache->lock);
+
+    // read and parse without holding the lock
+    unsigned char* data;
+    size_t length;
+    bool loaded = load_fd(fd, st.st_size, &data, &length);
+    close(fd);
+    if (!loaded) {
+        return NULL;
+    }
+    uint64_t hash = cache->hash_contents ? fnv1a(data, length) : 0;
+
+    if (had_entry && cache->hash_contents && hash == cached_hash) {
+        pthread_mutex_lock(&cache->lock);
+        doc = _lookup(cache, path);
+        if (doc && doc->hash == hash) {
+            doc->mtime = st.st_mtim;
+            doc->size = st.st_size;
+            doc->refcount++;
+            _unlink_lru(cache, doc);
+            _push_lru(cache, doc);
+            cache->stats.hits++;
+            cache->stats.revalidations++;
+            pthread_mutex_unlock(&cache->lock);
+            free(data);
+            return doc;
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    ParseResult result;
+    NamedTag* tag = load_named_tag_from_memory(data, length, cache->has_options ? &cache->options : NULL, &result);
+    free(data);
+    if (!tag) {
+        return NULL;
+    }
+    CachedDocument* fresh = (CachedDocument*) calloc(1, sizeof(CachedDocument));
+    if (!fresh || !(fresh->path = strdup(path))) {
+        free(fresh);
+        NamedTag_free(tag);
+        return NULL;
+    }
+    fresh->tag = tag;
+    fresh->bytes = result.bytes_allocated;
+    fresh->refcount = 1;
+    fresh->mtime = st.st_mtim;
+    fresh->size = st.st_size;
+    fresh->hash = hash;
+
+    pthread_mutex_lock(&cache->lock);
+    cache->stats.misses++;
+    CachedDocument* to_free = NULL;
+    doc = _lookup(cache, path);
+    if (doc && _remove(cache, doc)) {
+        // replaced by a newer version of the file
+        to_free = doc;
+        doc->next_in_bucket = NULL;
+    }
+    _insert(cache, fresh);
+    CachedDocument* evicted = _evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+
+    _free_list(to_free);
+    _free_list(evicted);
+    return fresh;
+}
+
+void NBTCache_release(NBTCache* cache, CachedDocument* doc) {
+    pthread_mutex_lock(&cache->lock);
+    bool orphan = --doc->refcount == 0 && !doc->cached;
+    pthread_mutex_unlock(&cache->lock);
+    if (orphan) {
+        _document_free(doc);
+    }
+}
+
+const NamedTag* CachedDocument_tag(const CachedDocument* doc) {
+    return doc->tag;
+}
+
+void NBTCache_invalidate(NBTCache* cache, const char* path) {
+    pthread_mutex_lock(&cache->lock);
+    CachedDocument* doc = _lookup(cache, path);
+    bool orphan = doc && _remove(cache, doc);
+    pthread_mutex_unlock(&cache->lock);
+    if (orphan) {
+        _document_free(doc);
+    }
+}
+
+NBTCacheStats NBTCache_stats(NBTCache* cache) {
+    pthread_mutex_lock(&cache->lock);
+    NBTCacheStats stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+    return stats;
+}
+
+void NBTCache_free(NBTCache* cache) {
+    if (!cache) {
+        return;
+    }
+    // every document must have been released by now
+    while (cache->oldest) {
+        CachedDocument* doc = cache->oldest;
+        if (_remove(cache, doc)) {
+            _document_free(doc);
+        }
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache);
+}
@@ -0,0 +1,46 @@
+#ifndef NBT_CACHE_H
+#define NBT_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nbt.h"
+#include "nbt_parse.h"
+
+/*
+ * Thread-safe LRU cache of parsed documents, keyed by path.
+ *
+ * A cached document is reused while the file's mtime and size are unchanged.
+ * With hash_contents set, a file whose mtime or size changed is re-read and
+ * only re-parsed when the hash of its (compressed) bytes differs as well.
+ * Trees are shared and must be treated as read-only; every successful
+ * NBTCache_get() must be paired with NBTCache_release(). Entries evicted
+ * while in use are freed by their last release, which has to happen before
+ * NBTCache_free().
+ */
+
+typedef struct NBTCache NBTCache;
+typedef struct CachedDocument CachedDocument;
+
+typedef struct NBTCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t revalidations; // changed mtime, identical contents
+    size_t entries;
+    size_t bytes;
+} NBTCacheStats;
+
+/* capacity is the sum of tree sizes as charged by the parser; options may be NULL */
+NBTCache* NBTCache_new(size_t capacity_bytes, bool hash_contents, const ParseOptions* options);
+void NBTCache_free(NBTCache*);
+
+CachedDocument* NBTCache_get(NBTCache*, const char* path);
+void NBTCache_release(NBTCache*, CachedDocument*);
+const NamedTag* CachedDocument_tag(const CachedDocument*);
+
+/* drops path from the cache, e.g. after writing the file */
+void NBTCache_invalidate(NBTCache*, const char* path);
+NBTCacheStats NBTCache_stats(NBTCache*);
+
+#endif // NBT_CACHE_H
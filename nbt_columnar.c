@@ -0,0 +1,442 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_columnar.h"
+#include "nbt.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static bool _same_key(const String* a, const String* b) {
+    return a->length == b->length && memcmp(String_data(a), String_data(b), a->length) == 0;
+}
+
+static size_t _heap_size(const String* str) {
+    return String_is_inline(str) ? 0 : (size_t) str->length + 1;
+}
+
+/* the schema key for name, trying hint first since elements tend to keep the order */
+static Int _find_key(const ColumnarList* columns, Int hint, const String* name) {
+    if (hint < columns->width && _same_key(&columns->keys[hint], name)) {
+        return hint;
+    }
+    for (Int k = 0; k < columns->width; k++) {
+        if (_same_key(&columns->keys[k], name)) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+/* the first element's keys make the schema up to a repeated key, which stays irregular like anything after it */
+static Int _schema_width(const Compound* first) {
+    for (Int k = 0; k < first->size; k++) {
+        if (first->tags[k].type == TAG_End) {
+            return k;
+        }
+        for (Int j = 0; j < k; j++) {
+            if (_same_key(&first->tags[j].name, &first->tags[k].name)) {
+                return k;
+            }
+        }
+    }
+    return first->size;
+}
+
+/* where the tags of an element go */
+typedef struct {
+    Int width;     // of the schema, including the one the first element makes
+    Int* slots;    // per tag, its key or -1 for irregular
+    bool* seen;    // per key
+    Int irregular;
+} _Plan;
+
+static bool _plan(const ColumnarList* columns, Int index, const Compound* element, _Plan* plan) {
+    plan->width = index == 0 ? _schema_width(element) : columns->width;
+    plan->slots = (Int*) malloc(((size_t) element->size + plan->width + 1) * sizeof(Int));
+    if (!plan->slots) {
+        return false;
+    }
+    plan->seen = (bool*) (plan->slots + element->size);
+    memset(plan->seen, 0, (size_t) plan->width + 1);
+    plan->irregular = 0;
+    if (index == 0) {
+        for (Int t = 0; t < element->size; t++) {
+            plan->slots[t] = t < plan->width ? t : -1;
+            plan->seen[t < plan->width ? t : plan->width] = true;
+        }
+        plan->irregular = element->size - plan->width;
+        return true;
+    }
+
+    Int last = -1;
+    for (Int t = 0; t < element->size; t++) {
+        const NamedTag* tag = &element->tags[t];
+        Int k = _find_key(columns, t, &tag->name);
+        if (k >= 0 && columns->types[k] != tag->type) {
+            k = -1;
+        }
+        if (k >= 0 && (k <= last || plan->irregular > 0)) {
+            // elements are rebuilt as columns in schema order, then the irregular
+            // tags; to keep its key order, one that is not is kept whole
+            memset(plan->seen, 0, (size_t) plan->width);
+            for (Int u = 0; u < element->size; u++) {
+                plan->slots[u] = -1;
+            }
+            plan->irregular = element->size;
+            break;
+        }
+        if (k >= 0) {
+            plan->seen[k] = true;
+            last = k;
+        } else {
+            plan->irregular++;
+        }
+        plan->slots[t] = k;
+    }
+    return true;
+}
+
+bool ColumnarList_add_cost(const ColumnarList* columns, Int length, Int index, const Compound* element,
+        size_t* allocated, size_t* released) {
+    _Plan plan;
+    if (!_plan(columns, index, element, &plan)) {
+        return false;
+    }
+    size_t bytes = 0;
+    size_t freed = (size_t) element->size * sizeof(NamedTag);
+    if (index == 0 && plan.width > 0) {
+        bytes += (size_t) plan.width * (sizeof(String) + sizeof(enum TAGType) + sizeof(void*) + sizeof(uint8_t*));
+        for (Int k = 0; k < plan.width; k++) {
+            bytes += (size_t) length * sizeof_type[element->tags[k].type] + _heap_size(&element->tags[k].name);
+        }
+    }
+    for (Int k = 0; k < plan.width; k++) {
+        if (!plan.seen[k] && (index == 0 || !columns->present[k])) {
+            bytes += ((size_t) length + 7) / 8;
+        }
+    }
+    if (plan.irregular > 0) {
+        bytes += columns->irregular ? 0 : (size_t) length * sizeof(Compound);
+        bytes += (size_t) plan.irregular * sizeof(NamedTag);
+    }
+    for (Int t = 0; t < element->size; t++) {
+        if (plan.slots[t] >= 0) {
+            freed += _heap_size(&element->tags[t].name);
+        }
+    }
+    free(plan.slots);
+    *allocated = bytes;
+    *released = freed;
+    return true;
+}
+
+/* undoes _schema_init() */
+static void _schema_drop(ColumnarList* columns) {
+    for (Int k = 0; k < columns->width; k++) {
+        String_destroy(&columns->keys[k]);
+        free(columns->columns[k]);
+        free(columns->present[k]);
+    }
+    free(columns->keys);
+    free(columns->types);
+    free(columns->columns);
+    free(columns->present);
+    free(columns->irregular);
+    *columns = (ColumnarList){0};
+}
+
+static bool _schema_init(ColumnarList* columns, Int length, const Compound* first, Int width) {
+    if (width == 0) {
+        return true;
+    }
+    columns->keys = (String*) calloc(width, sizeof(String));
+    columns->types = (enum TAGType*) calloc(width, sizeof(enum TAGType));
+    columns->columns = (void**) calloc(width, sizeof(void*));
+    columns->present = (uint8_t**) calloc(width, sizeof(uint8_t*));
+    if (!columns->keys || !columns->types || !columns->columns || !columns->present) {
+        goto fail;
+    }
+    for (Int k = 0; k < width; k++) {
+        const NamedTag* tag = &first->tags[k];
+        // the keys are copies, so the first element can be moved like any other
+        if (!(columns->columns[k] = calloc(length, sizeof_type[tag->type]))
+                || !String_set(&columns->keys[k], String_data(&tag->name), tag->name.length)) {
+            free(columns->columns[k]);
+            goto fail;
+        }
+        columns->types[k] = tag->type;
+        columns->width++;
+    }
+    return true;
+
+fail:
+    _schema_drop(columns);
+    return false;
+}
+
+bool ColumnarList_add(ColumnarList* columns, Int length, Int index, Compound* element) {
+    // find where each tag goes and allocate for it before anything is moved
+    _Plan plan;
+    if (!_plan(columns, index, element, &plan)) {
+        return false;
+    }
+    bool ok = index > 0 || _schema_init(columns, length, element, plan.width);
+    for (Int k = 0; ok && k < columns->width; k++) {
+        if (!plan.seen[k] && !columns->present[k]) {
+            size_t bytes = ((size_t) length + 7) / 8;
+            if (!(columns->present[k] = (uint8_t*) calloc(bytes, 1))) {
+                ok = false;
+                break;
+            }
+            // every element before this one had the key
+            memset(columns->present[k], 0xff, (size_t) index / 8);
+            columns->present[k][index / 8] = (uint8_t) ((1u << (index % 8)) - 1);
+        }
+    }
+    if (ok && plan.irregular > 0 && !columns->irregular) {
+        ok = (columns->irregular = (Compound*) calloc(length, sizeof(Compound))) != NULL;
+    }
+    NamedTag* extra = NULL;
+    if (ok && plan.irregular > 0) {
+        ok = (extra = (NamedTag*) malloc((size_t) plan.irregular * sizeof(NamedTag))) != NULL;
+    }
+    if (!ok) {
+        // bitmaps already made stay, with index's bit clear, which is right once it is added
+        free(plan.slots);
+        if (index == 0) {
+            _schema_drop(columns);
+        }
+        return false;
+    }
+
+    // from here nothing fails
+    Int extra_size = 0;
+    for (Int t = 0; t < element->size; t++) {
+        NamedTag* tag = &element->tags[t];
+        Int k = plan.slots[t];
+        if (k < 0) {
+            extra[extra_size++] = *tag;
+        } else {
+            memcpy((char*) columns->columns[k] + (size_t) index * sizeof_type[tag->type],
+                &tag->byte_value, sizeof_type[tag->type]);
+            String_destroy(&tag->name);
+        }
+    }
+    for (Int k = 0; k < columns->width; k++) {
+        if (plan.seen[k] && columns->present[k]) {
+            columns->present[k][index / 8] |= (uint8_t) (1u << (index % 8));
+        }
+    }
+    if (extra_size > 0) {
+        columns->irregular[index] = (Compound){ .size = extra_size, .tags = extra };
+    }
+    free(plan.slots);
+    free(element->tags); // every tag has been moved
+    *element = (Compound){0};
+    return true;
+}
+
+size_t ColumnarList_size(const ColumnarList* columns, Int length) {
+    size_t size = sizeof(ColumnarList);
+    size_t bitmap = ((size_t) length + 7) / 8;
+    for (Int k = 0; k < columns->width; k++) {
+        size += sizeof(String) + sizeof(enum TAGType) + 2 * sizeof(void*) + _heap_size(&columns->keys[k]);
+        size += (size_t) length * sizeof_type[columns->types[k]];
+        size += columns->present[k] ? bitmap : 0;
+    }
+    if (columns->irregular) {
+        size += (size_t) length * sizeof(Compound);
+    }
+    return size;
+}
+
+/* element count, names and all, of element i, without copying payloads */
+static Int _element_size(const ColumnarList* columns, Int i) {
+    Int size = 0;
+    for (Int k = 0; k < columns->width; k++) {
+        size += Column_has(columns->present[k], i);
+    }
+    if (columns->irregular) {
+        size += columns->irregular[i].size;
+    }
+    return size;
+}
+
+bool List_element_view(const List* list, Int i, Compound* view) {
+    *view = (Compound){0};
+    if (list->type != TAG_Compound || i < 0 || i >= list->length) {
+        return false;
+    }
+    if (!list->columnar) {
+        const Compound* element = &((const Compound*) list->tags)[i];
+        if (element->size == 0) {
+            return true;
+        }
+        if (!(view->tags = (NamedTag*) malloc((size_t) element->size * sizeof(NamedTag)))) {
+            return false;
+        }
+        memcpy(view->tags, element->tags, (size_t) element->size * sizeof(NamedTag));
+        view->size = element->size;
+        return true;
+    }
+
+    const ColumnarList* columns = (const ColumnarList*) list->tags;
+    Int size = _element_size(columns, i);
+    if (size == 0) {
+        return true;
+    }
+    if (!(view->tags = (NamedTag*) malloc((size_t) size * sizeof(NamedTag)))) {
+        return false;
+    }
+    for (Int k = 0; k < columns->width; k++) {
+        if (!Column_has(columns->present[k], i)) {
+            continue;
+        }
+        NamedTag* tag = &view->tags[view->size++];
+        *tag = (NamedTag){ .type = columns->types[k], .name = columns->keys[k] };
+        memcpy(&tag->byte_value, (const char*) columns->columns[k] + (size_t) i * sizeof_type[tag->type],
+            sizeof_type[tag->type]);
+    }
+    if (columns->irregular && columns->irregular[i].size > 0) {
+        memcpy(view->tags + view->size, columns->irregular[i].tags,
+            (size_t) columns->irregular[i].size * sizeof(NamedTag));
+        view->size += columns->irregular[i].size;
+    }
+    return true;
+}
+
+const void* List_column(const List* list, const char* key, enum TAGType* type, const uint8_t** present) {
+    if (!list->columnar || !list->tags) {
+        return NULL;
+    }
+    const ColumnarList* columns = (const ColumnarList*) list->tags;
+    size_t length = strlen(key);
+    for (Int k = 0; k < columns->width; k++) {
+        const String* name = &columns->keys[k];
+        if (name->length == length && memcmp(String_data(name), key, length) == 0) {
+            if (type) {
+                *type = columns->types[k];
+            }
+            if (present) {
+                *present = columns->present[k];
+            }
+            return columns->columns[k];
+        }
+    }
+    return NULL;
+}
+
+bool List_materialize(List* list) {
+    if (!list->columnar) {
+        return true;
+    }
+    ColumnarList* columns = (ColumnarList*) list->tags;
+    Int length = list->length;
+    Compound* elements = (Compound*) calloc(length > 0 ? length : 1, sizeof(Compound));
+    if (!elements) {
+        return false;
+    }
+    // names are copied first, so that running out of memory leaves the list as it was
+    for (Int i = 0; i < length; i++) {
+        Compound* element = &elements[i];
+        Int size = _element_size(columns, i);
+        if (size == 0) {
+            continue;
+        }
+        if (!(element->tags = (NamedTag*) calloc(size, sizeof(NamedTag)))) {
+            goto fail;
+        }
+        for (Int k = 0; k < columns->width; k++) {
+            if (!Column_has(columns->present[k], i)) {
+                continue;
+            }
+            NamedTag* tag = &element->tags[element->size++];
+            if (!String_set(&tag->name, String_data(&columns->keys[k]), columns->keys[k].length)) {
+                goto fail;
+            }
+        }
+    }
+
+    for (Int i = 0; i < length; i++) {
+        Compound* element = &elements[i];
+        Int t = 0;
+        for (Int k = 0; k < columns->width; k++) {
+            if (!Column_has(columns->present[k], i)) {
+                continue;
+            }
+            NamedTag* tag = &element->tags[t++];
+            tag->type = columns->types[k];
+            memcpy(&tag->byte_value, (const char*) columns->columns[k] + (size_t) i * sizeof_type[tag->type],
+                sizeof_type[tag->type]);
+        }
+        if (columns->irregular && columns->irregular[i].size > 0) {
+            memcpy(element->tags + t, columns->irregular[i].tags,
+                (size_t) columns->irregular[i].size * sizeof(NamedTag));
+            element->size += columns->irregular[i].size;
+            free(columns->irregular[i].tags);
+        }
+    }
+    for (Int k = 0; k < columns->width; k++) {
+        String_destroy(&columns->keys[k]);
+        free(columns->columns[k]);
+        free(columns->present[k]);
+    }
+    free(columns->keys);
+    free(columns->types);
+    free(columns->columns);
+    free(columns->present);
+    free(columns->irregular);
+    free(columns);
+    list->tags = elements;
+    list->columnar = false;
+    return true;
+
+fail:
+    for (Int i = 0; i < length; i++) {
+        // only names are set so far
+        for (Int t = 0; t < elements[i].size; t++) {
+            String_destroy(&elements[i].tags[t].name);
+        }
+        free(elements[i].tags);
+    }
+    free(elements);
+    return false;
+}
+
+bool List_to_columnar(List* list) {
+    if (list->columnar || list->type != TAG_Compound || list->length == 0) {
+        return true;
+    }
+    ColumnarList* columns = (ColumnarList*) calloc(1, sizeof(ColumnarList));
+    if (!columns) {
+        return false;
+    }
+    Compound* elements = (Compound*) list->tags;
+    Int length = list->length;
+    for (Int i = 0; i < length; i++) {
+        if (ColumnarList_add(columns, length, i, &elements[i])) {
+            continue;
+        }
+        // put back the elements already moved; the rest are untouched
+        List done = { .type = TAG_Compound, .columnar = true, .length = i, .tags = columns };
+        if (i == 0 || !List_materialize(&done)) {
+            List_destroy(&done);
+            if (i > 0) {
+                // out of memory twice over: drop the list rather than leave it half moved
+                for (Int j = i; j < length; j++) {
+                    Compound_destroy(&elements[j]);
+                }
+                free(elements);
+                *list = (List){ .type = TAG_Compound };
+            }
+            return false;
+        }
+        memcpy(elements, done.tags, (size_t) i * sizeof(Compound));
+        free(done.tags);
+        return false;
+    }
+    free(elements);
+    list->tags = columns;
+    list->columnar = true;
+    return true;
+}
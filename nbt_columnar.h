@@ -0,0 +1,61 @@
+#ifndef NBT_COLUMNAR_H
+#define NBT_COLUMNAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nbt.h"
+
+/*
+ * Struct-of-arrays storage for lists of compounds whose elements share most
+ * of their keys, such as sections, palettes, entities and items.
+ *
+ * Parsing with ParseOptions.columnar_lists, or List_to_columnar(), stores
+ * such a list as a ColumnarList (see nbt.h) and sets List.columnar. Reading
+ * one key of every element is then a scan over a single array:
+ *   const uint8_t* present;
+ *   const Byte* y = List_column(sections, "Y", &type, &present);
+ *
+ * List_destroy(), the binary and SNBT writers, NamedTag_copy() and the merge
+ * functions handle columnar lists. Other code that walks the elements as
+ * Compound needs List_materialize() first.
+ */
+
+/*
+ * Moves the keys of element, the index-th of length, into columns; elements
+ * must come in order. element is left empty, except when this fails for
+ * lack of memory, which leaves it as it was.
+ */
+bool ColumnarList_add(ColumnarList*, Int length, Int index, Compound* element);
+
+/*
+ * What ColumnarList_add() would allocate and free for the same arguments,
+ * so that a caller with a budget can charge it first. false when out of memory.
+ */
+bool ColumnarList_add_cost(const ColumnarList*, Int length, Int index, const Compound* element,
+    size_t* allocated, size_t* released);
+
+/* heap bytes of the schema, columns and bitmaps, not counting irregular tags or what payloads point to */
+size_t ColumnarList_size(const ColumnarList*, Int length);
+
+/* a list of compounds to columns and back; other lists are left alone; false when out of memory */
+bool List_to_columnar(List*);
+bool List_materialize(List*);
+
+/*
+ * The dense column for key, or NULL if the list is not columnar or key is not
+ * in its schema. *present is NULL when every element has the key.
+ */
+const void* List_column(const List*, const char* key, enum TAGType* type, const uint8_t** present);
+
+static inline bool Column_has(const uint8_t* present, Int i) {
+    return !present || (present[i / 8] >> (i % 8)) & 1;
+}
+
+/*
+ * Element i of a list of compounds, columnar or not, as a compound whose tags
+ * share names and payloads with the list. Release with free(view->tags).
+ */
+bool List_element_view(const List*, Int i, Compound* view);
+
+#endif // NBT_COLUMNAR_H
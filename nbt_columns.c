@@ -0,0 +1,232 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_columns.h"
+#include "nbt_path.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+ColumnSet* ColumnSet_new(const char* const* exprs, size_t count) {
+    ColumnSet* set = (ColumnSet*) calloc(1, sizeof(ColumnSet));
+    if (!set) {
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!path_parse(exprs[i], &set->paths, &set->count)) {
+            ColumnSet_free(set);
+            return NULL;
+        }
+    }
+    set->columns = (Column*) calloc(set->count ? set->count : 1, sizeof(Column));
+    if (!set->columns) {
+        ColumnSet_free(set);
+        return NULL;
+    }
+    return set;
+}
+
+void ColumnSet_free(ColumnSet* set) {
+    if (!set) {
+        return;
+    }
+    for (size_t i = 0; i < set->count; i++) {
+        NBTPath_destroy(&set->paths[i]);
+        if (set->columns) {
+            Column* column = &set->columns[i];
+            free(column->ints);
+            free(column->offsets);
+            free(column->bytes);
+            free(column->validity);
+        }
+    }
+    free(set->paths);
+    free(set->columns);
+    free(set);
+}
+
+static bool _grow(void** array, size_t old_count, size_t new_count, size_t element_size) {
+    void* temp = realloc(*array, new_count * element_size);
+    if (!temp) {
+        return false;
+    }
+    memset((char*) temp + old_count * element_size, 0, (new_count - old_count) * element_size);
+    *array = temp;
+    return true;
+}
+
+// makes room for one more row in every column
+static bool _reserve_row(ColumnSet* set) {
+    if (set->rows < set->capacity) {
+        return true;
+    }
+    size_t capacity = set->capacity ? set->capacity * 2 : 64;
+    for (size_t i = 0; i < set->count; i++) {
+        Column* column = &set->columns[i];
+        if (!_grow((void**) &column->validity, (set->capacity + 7) / 8, (capacity + 7) / 8, 1)) {
+            return false;
+        }
+        switch (column->type) {
+        case COLUMN_Unknown:
+            break;
+        case COLUMN_Int:
+        case COLUMN_Double:
+            if (!_grow((void**) &column->ints, set->capacity, capacity, sizeof(Long))) {
+                return false;
+            }
+            break;
+        case COLUMN_String:
+            if (!_grow((void**) &column->offsets, set->capacity + 1, capacity + 1, sizeof(uint32_t))) {
+                return false;
+            }
+            break;
+        }
+    }
+    set->capacity = capacity;
+    return true;
+}
+
+// fixes the column type on its first value; earlier rows become nulls
+static bool _resolve_type(ColumnSet* set, Column* column, enum ColumnType type) {
+    if (type == COLUMN_String) {
+        column->offsets = (uint32_t*) calloc(set->capacity + 1, sizeof(uint32_t));
+        if (!column->offsets) {
+            return false;
+        }
+    } else {
+        column->ints = (Long*) calloc(set->capacity, sizeof(Long));
+        if (!column->ints) {
+            return false;
+        }
+    }
+    column->type = type;
+    return true;
+}
+
+static bool _append_bytes(Column* column, const char* data, size_t length) {
+    if (column->bytes_length + length > UINT32_MAX) {
+        return false;
+    }
+    if (column->bytes_length + length > column->bytes_capacity) {
+        size_t capacity = column->bytes_capacity ? column->bytes_capacity : 256;
+        while (capacity < column->bytes_length + length) {
+            capacity *= 2;
+        }
+        char* temp = (char*) realloc(column->bytes, capacity);
+        if (!temp) {
+            return false;
+        }
+        column->bytes = temp;
+        column->bytes_capacity = capacity;
+    }
+    memcpy(column->bytes + column->bytes_length, data, length);
+    column->bytes_length += length;
+    return true;
+}
+
+typedef struct {
+    ColumnSet* set;
+    bool failed;
+} _RowState;
+
+static int _on_value(void* userdata, size_t index, const PathValue* value) {
+    _RowState* state = (_RowState*) userdata;
+    ColumnSet* set = state->set;
+    Column* column = &set->columns[index];
+    size_t row = set->rows;
+
+    enum ColumnType type;
+    switch (value->type) {
+    case TAG_Byte:
+    case TAG_Short:
+    case TAG_Int:
+    case TAG_Long:
+        type = COLUMN_Int;
+        break;
+    case TAG_Float:
+    case TAG_Double:
+        type = COLUMN_Double;
+        break;
+    case TAG_String:
+        type = COLUMN_String;
+        break;
+    default:
+        return 0; // containers never fill a column
+    }
+    if (column->type == COLUMN_Unknown && !_resolve_type(set, column, type)) {
+        state->failed = true;
+        return 1;
+    }
+
+    if (column->type == COLUMN_Int && type == COLUMN_Int) {
+        column->ints[row] = value->integer;
+    } else if (column->type == COLUMN_Double && type == COLUMN_Double) {
+        column->doubles[row] = value->real;
+    } else if (column->type == COLUMN_Double && type == COLUMN_Int) {
+        column->doubles[row] = (Double) value->integer;
+    } else if (column->type == COLUMN_String && type == COLUMN_String) {
+        // a repeated match replaces the earlier value of this row
+        column->bytes_length = column->offsets[row];
+        if (!_append_bytes(column, value->string.data, value->string.length)) {
+            state->failed = true;
+            return 1;
+        }
+        column->offsets[row + 1] = column->bytes_length;
+    } else {
+        return 0;
+    }
+    column->validity[row / 8] |= 1 << (row % 8);
+    return 0;
+}
+
+bool ColumnSet_append(ColumnSet* set, FILE* file) {
+    if (!_reserve_row(set)) {
+        return false;
+    }
+    size_t row = set->rows;
+    for (size_t i = 0; i < set->count; i++) {
+        Column* column = &set->columns[i];
+        column->validity[row / 8] &= ~(1 << (row % 8));
+        if (column->type == COLUMN_String) {
+            column->offsets[row + 1] = column->offsets[row];
+        }
+    }
+
+    _RowState state = { .set = set };
+    int ret = path_match_stream(file, set->paths, set->count, _on_value, &state);
+    if (ret != 0 || state.failed) {
+        // roll back whatever the partial row wrote
+        for (size_t i = 0; i < set->count; i++) {
+            Column* column = &set->columns[i];
+            column->validity[row / 8] &= ~(1 << (row % 8));
+            if (column->type == COLUMN_String) {
+                column->bytes_length = column->offsets[row];
+                column->offsets[row + 1] = column->offsets[row];
+            }
+        }
+        return false;
+    }
+    set->rows++;
+    return true;
+}
+
+bool ColumnSet_append_all(ColumnSet* set, FILE* file) {
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+        ungetc(c, file);
+        if (!ColumnSet_append(set, file)) {
+            return false;
+        }
+    }
+    return !ferror(file);
+}
+
+bool ColumnSet_append_buffer(ColumnSet* set, char* buffer, size_t length) {
+    FILE* stream = fmemopen((void*) buffer, length, "r");
+    if (!stream) {
+        return false;
+    }
+    bool ok = ColumnSet_append(set, stream);
+    fclose(stream);
+    return ok;
+}
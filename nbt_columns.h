@@ -0,0 +1,60 @@
+#ifndef NBT_COLUMNS_H
+#define NBT_COLUMNS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "nbt.h"
+#include "nbt_path.h"
+
+/*
+ * Columnar extraction: every document appended to a ColumnSet becomes one row,
+ * and every path one column. A column takes its type from the first value it
+ * sees: integral tags land in COLUMN_Int, Float/Double in COLUMN_Double and
+ * strings in COLUMN_String (offsets + bytes). Missing or mistyped values leave
+ * the row's validity bit cleared.
+ */
+
+enum ColumnType {
+    COLUMN_Unknown,
+    COLUMN_Int,
+    COLUMN_Double,
+    COLUMN_String
+};
+
+typedef struct Column {
+    enum ColumnType type;
+    union {
+        Long* ints;
+        Double* doubles;
+    };
+    uint32_t* offsets; // strings: row i spans bytes[offsets[i]..offsets[i + 1])
+    char* bytes;
+    size_t bytes_length;
+    size_t bytes_capacity;
+    uint8_t* validity; // bit i set when row i has a value
+} Column;
+
+typedef struct ColumnSet {
+    size_t count;
+    NBTPath* paths;
+    Column* columns;
+    size_t rows;
+    size_t capacity;
+} ColumnSet;
+
+/* each expression may expand into several columns, e.g. Pos[0..2] */
+ColumnSet* ColumnSet_new(const char* const* exprs, size_t count);
+void ColumnSet_free(ColumnSet*);
+
+/* reads one document and appends it as a row; on failure no row is added */
+bool ColumnSet_append(ColumnSet*, FILE*);
+/* appends documents until end of stream */
+bool ColumnSet_append_all(ColumnSet*, FILE*);
+bool ColumnSet_append_buffer(ColumnSet*, char*, size_t);
+
+static inline bool Column_is_valid(const Column* column, size_t row) {
+    return column->validity && (column->validity[row / 8] >> (row % 8)) & 1;
+}
+
+#endif // NBT_COLUMNS_H
@@ -0,0 +1,45 @@
+#ifndef NBT_ENDIAN_H
+#define NBT_ENDIAN_H
+
+#ifdef __APPLE__ 
+
+// assuming macOS
+#  include <machine/endian.h>
+#  include <libkern/OSByteOrder.h>
+
+#  define be16toh(x) ntohs(x)
+#  define be32toh(x) ntohl(x)
+#  define be64toh(x) ntohll(x)
+
+#  define htobe16(x) htons(x)
+#  define htobe32(x) htonl(x)
+#  define htobe64(x) htonll(x)
+
+#  define le16toh(x) OSSwapLittleToHostInt16(x)
+#  define le32toh(x) OSSwapLittleToHostInt32(x)
+#  define le64toh(x) OSSwapLittleToHostInt64(x)
+
+#elif defined(_WIN32)
+// Windows
+
+#include <winsock2.h>
+
+#  define be16toh(x) ntohs(x)
+#  define be32toh(x) ntohl(x)
+#  define be64toh(x) ntohll(x)
+
+#  define htobe16(x) htons(x)
+#  define htobe32(x) htonl(x)
+#  define htobe64(x) htonll(x)
+
+// every Windows target is little endian
+#  define le16toh(x) (x)
+#  define le32toh(x) (x)
+#  define le64toh(x) (x)
+
+#else
+// Assuming Linux or UNIX-like that has endian.h
+#  include <endian.h>
+#endif
+
+#endif // NBT_ENDIAN_H
@@ -0,0 +1,37 @@
+#ifndef NBT_HASH_H
+#define NBT_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 64-bit FNV-1a, for the hash tables and content keys used across the
+ * library. Fast on short keys, but not meant to stand up to chosen input.
+ */
+
+#define FNV1A_SEED 14695981039346656037ull
+#define FNV1A_PRIME 1099511628211ull
+
+/* continues hash over data, so that several pieces hash as one */
+static inline uint64_t fnv1a_update(uint64_t hash, const void* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * FNV1A_PRIME;
+    }
+    return hash;
+}
+
+static inline uint64_t fnv1a(const void* data, size_t length) {
+    return fnv1a_update(FNV1A_SEED, data, length);
+}
+
+/* of a NUL-terminated string, without the terminator */
+static inline uint64_t fnv1a_string(const char* text) {
+    uint64_t hash = FNV1A_SEED;
+    for (; *text; text++) {
+        hash = (hash ^ (unsigned char) *text) * FNV1A_PRIME;
+    }
+    return hash;
+}
+
+#endif // NBT_HASH_H
@@ -0,0 +1,421 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_image.h"
+#include "nbt_path.h"
+#include "nbt_columnar.h"
+#include "nbt_replace.h"
+#include "nbt.h"
+#include "nbt_hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+_Static_assert(sizeof(ImageNode) == 24, "ImageNode layout is part of the file format");
+
+/* writer */
+
+typedef struct {
+    uint64_t offset;
+    uint32_t hash;
+} _Name;
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+
+    // distinct names, open addressing
+    _Name* names;
+    size_t name_count;
+    size_t name_capacity;
+} _Writer;
+
+/* appends length bytes (zeroes when src is NULL) at the next 8-byte boundary */
+static uint64_t _append(_Writer* w, const void* src, size_t length) {
+    size_t offset = (w->size + 7) & ~(size_t) 7;
+    if (offset + length > w->capacity) {
+        size_t capacity = w->capacity ? w->capacity : 4096;
+        while (capacity < offset + length) {
+            capacity *= 2;
+        }
+        unsigned char* temp = (unsigned char*) realloc(w->data, capacity);
+        if (!temp) {
+            return 0;
+        }
+        w->data = temp;
+        w->capacity = capacity;
+    }
+    memset(w->data + w->size, 0, offset - w->size);
+    if (src) {
+        memcpy(w->data + offset, src, length);
+    } else {
+        memset(w->data + offset, 0, length);
+    }
+    w->size = offset + length;
+    return offset;
+}
+
+static bool _grow_names(_Writer* w) {
+    size_t capacity = w->name_capacity ? w->name_capacity * 2 : 256;
+    _Name* names = (_Name*) calloc(capacity, sizeof(_Name));
+    if (!names) {
+        return false;
+    }
+    for (size_t i = 0; i < w->name_capacity; i++) {
+        if (w->names[i].offset) {
+            size_t slot = w->names[i].hash & (capacity - 1);
+            while (names[slot].offset) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            names[slot] = w->names[i];
+        }
+    }
+    free(w->names);
+    w->names = names;
+    w->name_capacity = capacity;
+    return true;
+}
+
+/* stores each distinct name once; returns its offset, 0 when out of memory */
+static uint64_t _intern(_Writer* w, const char* name, size_t length) {
+    if ((w->name_count + 1) * 2 > w->name_capacity && !_grow_names(w)) {
+        return 0;
+    }
+    uint32_t hash = (uint32_t) fnv1a(name, length);
+    size_t slot = hash & (w->name_capacity - 1);
+    while (w->names[slot].offset) {
+        const char* existing = (const char*) w->data + w->names[slot].offset;
+        if (w->names[slot].hash == hash && strncmp(existing, name, length) == 0 && existing[length] == '\0') {
+            return w->names[slot].offset;
+        }
+        slot = (slot + 1) & (w->name_capacity - 1);
+    }
+    uint64_t offset = _append(w, NULL, length + 1);
+    if (!offset) {
+        return 0;
+    }
+    memcpy(w->data + offset, name, length);
+    w->names[slot] = (_Name){ offset, hash };
+    w->name_count++;
+    return offset;
+}
+
+static int _compare_names(const void* a, const void* b) {
+    const NamedTag* x = *(const NamedTag* const*) a;
+    const NamedTag* y = *(const NamedTag* const*) b;
+    return strcmp(String_data(&x->name), String_data(&y->name));
+}
+
+static bool _write_value(_Writer* w, uint64_t node_offset, uint64_t name, enum TAGType type, const void* value);
+
+static bool _write_compound(_Writer* w, ImageNode* node, const Compound* compound) {
+    node->count = compound->size;
+    if (compound->size == 0) {
+        return true;
+    }
+    const NamedTag** sorted = (const NamedTag**) malloc(compound->size * sizeof(NamedTag*));
+    if (!sorted) {
+        return false;
+    }
+    for (Int i = 0; i < compound->size; i++) {
+        sorted[i] = &compound->tags[i];
+    }
+    qsort(sorted, compound->size, sizeof(NamedTag*), _compare_names);
+
+    bool ok = (node->offset = _append(w, NULL, compound->size * sizeof(ImageNode))) != 0;
+    for (Int i = 0; ok && i < compound->size; i++) {
+        uint64_t name = _intern(w, String_data(&sorted[i]->name), sorted[i]->name.length);
+        ok = name && _write_value(w, node->offset + i * sizeof(ImageNode), name, sorted[i]->type, &sorted[i]->byte_value);
+    }
+    free(sorted);
+    return ok;
+}
+
+static bool _write_value(_Writer* w, uint64_t node_offset, uint64_t name, enum TAGType type, const void* value) {
+    ImageNode node = {
+        .name = name,
+        .type = type,
+    };
+    switch (type) {
+    case TAG_End:
+        break;
+    case TAG_Byte:
+    case TAG_Short:
+    case TAG_Int:
+    case TAG_Long:
+    case TAG_Float:
+    case TAG_Double:
+        memcpy(&node.long_value, value, sizeof_type[type]);
+        break;
+    case TAG_String:
+    {
+        const String* str = (const String*) value;
+        node.count = str->length;
+        if (!(node.offset = _append(w, String_data(str), str->length + 1))) {
+            return false;
+        }
+        break;
+    }
+    case TAG_Byte_Array:
+    case TAG_Int_Array:
+    case TAG_Long_Array:
+    {
+        // all three share the Byte_Array layout
+        const Byte_Array* array = (const Byte_Array*) value;
+        size_t element_size = type == TAG_Byte_Array ? sizeof(Byte) : type == TAG_Int_Array ? sizeof(Int) : sizeof(Long);
+        node.count = array->length;
+        if (array->length && !(node.offset = _append(w, array->data, array->length * element_size))) {
+            return false;
+        }
+        break;
+    }
+    case TAG_List:
+    {
+        const List* list = (const List*) value;
+        node.element_type = list->type;
+        node.count = list->length;
+        if (list->length == 0) {
+            break;
+        }
+        if (list->type >= TAG_Byte && list->type <= TAG_Double) {
+            if (!(node.offset = _append(w, list->tags, list->length * sizeof_type[list->type]))) {
+                return false;
+            }
+            break;
+        }
+        if (!(node.offset = _append(w, NULL, list->length * sizeof(ImageNode)))) {
+            return false;
+        }
+        for (Int i = 0; i < list->length; i++) {
+            const void* element = (const char*) list->tags + i * sizeof_type[list->type];
+            Compound view = {0};
+            if (list->columnar) {
+                if (!List_element_view(list, i, &view)) {
+                    return false;
+                }
+                element = &view;
+            }
+            bool ok = _write_value(w, node.offset + i * sizeof(ImageNode), 0, list->type, element);
+            free(view.tags);
+            if (!ok) {
+                return false;
+            }
+        }
+        break;
+    }
+    case TAG_Compound:
+        if (!_write_compound(w, &node, (const Compound*) value)) {
+            return false;
+        }
+        break;
+    }
+    // children may have moved w->data, so the node is stored last
+    memcpy(w->data + node_offset, &node, sizeof(node));
+    return true;
+}
+
+bool image_write(const NamedTag* root, FILE* out) {
+    _Writer w = {0};
+    bool ok = _append(&w, NULL, sizeof(ImageHeader)) == 0 && w.data;
+    uint64_t name = ok ? _intern(&w, String_data(&root->name), root->name.length) : 0;
+    ok = name && _write_value(&w, offsetof(ImageHeader, root), name, root->type, &root->byte_value);
+    if (ok) {
+        ImageHeader* header = (ImageHeader*) w.data;
+        memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+        header->size = w.size;
+        ok = fwrite(w.data, 1, w.size, out) == w.size;
+    }
+    free(w.data);
+    free(w.names);
+    return ok;
+}
+
+bool image_write_file(const NamedTag* root, const char* path) {
+    // written beside path and renamed over it, so readers mapping the old image never see a partial one
+    char* temp;
+    FILE* out = replace_open(path, &temp);
+    if (!out) {
+        perror(path);
+        return false;
+    }
+    bool ok = replace_close(out, temp, path, image_write(root, out));
+    if (!ok) {
+        perror(path);
+    }
+    return ok;
+}
+
+/* reader */
+
+static NBTImage* _validate(NBTImage* image) {
+    const ImageHeader* header = (const ImageHeader*) image->base;
+    if (image->size < sizeof(ImageHeader) || memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0
+            || header->size != image->size) {
+        fprintf(stderr, "Not an NBT image or truncated\n");
+        NBTImage_close(image);
+        return NULL;
+    }
+    return image;
+}
+
+NBTImage* NBTImage_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(ImageHeader)) {
+        fprintf(stderr, "%s is not an NBT image\n", path);
+        close(fd);
+        return NULL;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    NBTImage* image = (NBTImage*) malloc(sizeof(NBTImage));
+    if (!image) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    *image = (NBTImage){ (const unsigned char*) map, st.st_size, true };
+    return _validate(image);
+}
+
+NBTImage* NBTImage_from_buffer(const void* buffer, size_t size) {
+    NBTImage* image = (NBTImage*) malloc(sizeof(NBTImage));
+    if (!image) {
+        return NULL;
+    }
+    *image = (NBTImage){ (const unsigned char*) buffer, size, false };
+    return _validate(image);
+}
+
+void NBTImage_close(NBTImage* image) {
+    if (!image) {
+        return;
+    }
+    if (image->mapped) {
+        munmap((void*) image->base, image->size);
+    }
+    free(image);
+}
+
+const ImageNode* NBTImage_root(const NBTImage* image) {
+    return &((const ImageHeader*) image->base)->root;
+}
+
+static bool _in_bounds(const NBTImage* image, uint64_t offset, uint64_t length) {
+    return offset <= image->size && length <= image->size - offset;
+}
+
+const char* ImageNode_name(const NBTImage* image, const ImageNode* node) {
+    if (!node->name || !_in_bounds(image, node->name, 1)
+            || !memchr(image->base + node->name, '\0', image->size - node->name)) {
+        return "";
+    }
+    return (const char*) image->base + node->name;
+}
+
+static bool _has_nodes(const ImageNode* node) {
+    return node->type == TAG_Compound || (node->type == TAG_List && node->element_type > TAG_Double);
+}
+
+const ImageNode* ImageNode_at(const NBTImage* image, const ImageNode* node, uint32_t i) {
+    if (!_has_nodes(node) || i >= node->count
+            || !_in_bounds(image, node->offset, (uint64_t) node->count * sizeof(ImageNode))) {
+        return NULL;
+    }
+    return (const ImageNode*) (image->base + node->offset) + i;
+}
+
+const ImageNode* ImageNode_find(const NBTImage* image, const ImageNode* compound, const char* key) {
+    if (compound->type != TAG_Compound) {
+        return NULL;
+    }
+    uint32_t low = 0;
+    uint32_t high = compound->count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        const ImageNode* child = ImageNode_at(image, compound, middle);
+        if (!child) {
+            return NULL;
+        }
+        int cmp = strcmp(ImageNode_name(image, child), key);
+        if (cmp == 0) {
+            return child;
+        }
+        if (cmp < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+const void* ImageNode_data(const NBTImage* image, const ImageNode* node) {
+    size_t element_size;
+    switch (node->type) {
+    case TAG_String:
+        element_size = 1;
+        break;
+    case TAG_Byte_Array:
+        element_size = sizeof(Byte);
+        break;
+    case TAG_Int_Array:
+        element_size = sizeof(Int);
+        break;
+    case TAG_Long_Array:
+        element_size = sizeof(Long);
+        break;
+    case TAG_List:
+        if (node->element_type < TAG_Byte || node->element_type > TAG_Double) {
+            return NULL;
+        }
+        element_size = sizeof_type[node->element_type];
+        break;
+    default:
+        return NULL;
+    }
+    if (node->count == 0 && node->type != TAG_String) {
+        return NULL;
+    }
+    if (!_in_bounds(image, node->offset, (uint64_t) node->count * element_size)) {
+        return NULL;
+    }
+    return image->base + node->offset;
+}
+
+const ImageNode* NBTImage_lookup(const NBTImage* image, const char* expr) {
+    NBTPath* paths = NULL;
+    size_t count = 0;
+    const ImageNode* node = NULL;
+    if (path_parse(expr, &paths, &count) == 1) {
+        node = NBTImage_root(image);
+        for (size_t i = 0; node && i < paths[0].length; i++) {
+            const PathSegment* segment = &paths[0].segments[i];
+            if (segment->kind == PATH_KEY) {
+                node = ImageNode_find(image, node, segment->key);
+            } else if (segment->kind == PATH_INDEX) {
+                node = node->type == TAG_List ? ImageNode_at(image, node, segment->index) : NULL;
+            } else {
+                node = NULL; // a lookup names a single node
+            }
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        NBTPath_destroy(&paths[i]);
+    }
+    free(paths);
+    return node;
+}
@@ -0,0 +1,76 @@
+#ifndef NBT_IMAGE_H
+#define NBT_IMAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "nbt.h"
+
+/*
+ * Position-independent image of a parsed tree.
+ *
+ * Every reference inside an image is a byte offset from its start, so an
+ * image file can be mapped read-only at any address by any number of
+ * processes and queried in place without parsing. Images are host-endian
+ * and not meant to be exchanged between machines; the NBT file remains the
+ * interchange format.
+ *
+ * Layout: ImageHeader, then data blocks aligned to 8 bytes. Compound children
+ * are ImageNode arrays sorted by name, other lists are ImageNode arrays too,
+ * while arrays, strings and lists of primitives point at their raw elements.
+ * Names are NUL-terminated and stored once per distinct name.
+ */
+
+#define IMAGE_MAGIC "NBTIMG1"
+
+typedef struct ImageNode {
+    uint64_t name;       // offset of the name, 0 for list elements
+    uint8_t type;
+    uint8_t element_type; // lists only
+    uint16_t reserved;
+    uint32_t count;      // string length or number of elements/children
+    union {
+        Byte byte_value;
+        Short short_value;
+        Int int_value;
+        Long long_value;
+        Float float_value;
+        Double double_value;
+        uint64_t offset; // everything else: where the data starts
+    };
+} ImageNode;
+
+typedef struct ImageHeader {
+    char magic[8];
+    uint64_t size;
+    ImageNode root;
+} ImageHeader;
+
+typedef struct NBTImage {
+    const unsigned char* base;
+    size_t size;
+    bool mapped;
+} NBTImage;
+
+bool image_write(const NamedTag*, FILE*);
+bool image_write_file(const NamedTag*, const char* path);
+
+/* maps path read-only; pages are shared with every other process mapping it */
+NBTImage* NBTImage_open(const char* path);
+/* wraps an image already in memory, e.g. one read from a socket */
+NBTImage* NBTImage_from_buffer(const void*, size_t);
+void NBTImage_close(NBTImage*);
+
+const ImageNode* NBTImage_root(const NBTImage*);
+/* resolves a path as understood by path_parse(), NULL if it does not name a node */
+const ImageNode* NBTImage_lookup(const NBTImage*, const char* path);
+
+const char* ImageNode_name(const NBTImage*, const ImageNode*);
+/* binary search among the children of a compound */
+const ImageNode* ImageNode_find(const NBTImage*, const ImageNode* compound, const char* key);
+/* i-th child of a compound or element of a list of non-primitives */
+const ImageNode* ImageNode_at(const NBTImage*, const ImageNode*, uint32_t i);
+/* characters of a string, elements of an array or of a list of primitives */
+const void* ImageNode_data(const NBTImage*, const ImageNode*);
+
+#endif // NBT_IMAGE_H
@@ -0,0 +1,535 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_index.h"
+#include "nbt_load.h"
+#include "nbt_parse.h"
+#include "nbt_path.h"
+#include "nbt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nbt_endian.h"
+#include "zpipe.h"
+
+typedef struct {
+    FILE* file;
+    uint64_t position;
+    int max_depth;
+
+    IndexEntry* entries;
+    size_t count;
+    size_t capacity;
+
+    char* strings;
+    size_t strings_length;
+    size_t strings_capacity;
+
+    char* path;
+    size_t path_length;
+    size_t path_capacity;
+
+    char name[UINT16_MAX + 1];
+} _Builder;
+
+static bool _reserve(void** array, size_t* capacity, size_t needed, size_t element_size) {
+    if (needed <= *capacity) {
+        return true;
+    }
+    size_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void* temp = realloc(*array, new_capacity * element_size);
+    if (!temp) {
+        return false;
+    }
+    *array = temp;
+    *capacity = new_capacity;
+    return true;
+}
+
+static bool _read(_Builder* b, void* buffer, size_t size) {
+    if (fread(buffer, 1, size, b->file) != size) {
+        return false;
+    }
+    b->position += size;
+    return true;
+}
+
+static bool _skip(_Builder* b, enum TAGType type, Int count) {
+    if (!skip_elements(b->file, type, count)) {
+        return false;
+    }
+    b->position += (uint64_t) count * sizeof_type[type];
+    return true;
+}
+
+static bool _read_length(_Builder* b, Int* length) {
+    if (!_read(b, length, sizeof(Int))) {
+        return false;
+    }
+    *length = be32toh(*length);
+    return *length >= 0;
+}
+
+static bool _push_path(_Builder* b, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static bool _push_path(_Builder* b, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (needed < 0 || !_reserve((void**) &b->path, &b->path_capacity, b->path_length + needed + 1, 1)) {
+        return false;
+    }
+    va_start(args, format);
+    vsnprintf(b->path + b->path_length, needed + 1, format, args);
+    va_end(args);
+    b->path_length += needed;
+    return true;
+}
+
+static bool _push_key(_Builder* b, const char* separator, const char* key) {
+    size_t needed = strlen(separator) + 2 * strlen(key) + 3;
+    if (!_reserve((void**) &b->path, &b->path_capacity, b->path_length + needed, 1)) {
+        return false;
+    }
+    b->path_length += sprintf(b->path + b->path_length, "%s", separator);
+    b->path_length += path_format_key(b->path + b->path_length, key);
+    return true;
+}
+
+static bool _visit(_Builder* b, enum TAGType type, int depth) {
+    uint64_t start = b->position;
+    size_t entry = SIZE_MAX;
+    if (depth > NBT_MAX_DEPTH) {
+        return false;
+    }
+    if (depth > 0 && (b->max_depth < 0 || depth <= b->max_depth)) {
+        if (!_reserve((void**) &b->entries, &b->capacity, b->count + 1, sizeof(IndexEntry))
+                || !_reserve((void**) &b->strings, &b->strings_capacity, b->strings_length + b->path_length + 1, 1)) {
+            return false;
+        }
+        entry = b->count++;
+        b->entries[entry] = (IndexEntry){
+            .offset = start,
+            .path = b->strings_length,
+            .depth = depth,
+            .type = type,
+        };
+        memcpy(b->strings + b->strings_length, b->path, b->path_length + 1);
+        b->strings_length += b->path_length + 1;
+    }
+
+    switch (type) {
+    case TAG_End:
+        return false;
+    case TAG_Byte:
+    case TAG_Short:
+    case TAG_Int:
+    case TAG_Long:
+    case TAG_Float:
+    case TAG_Double:
+        if (!_skip(b, type, 1)) {
+            return false;
+        }
+        break;
+    case TAG_Byte_Array:
+    case TAG_Int_Array:
+    case TAG_Long_Array:
+    {
+        Int length;
+        enum TAGType element_type = type == TAG_Byte_Array ? TAG_Byte : type == TAG_Int_Array ? TAG_Int : TAG_Long;
+        if (!_read_length(b, &length) || !_skip(b, element_type, length)) {
+            return false;
+        }
+        break;
+    }
+    case TAG_String:
+    {
+        uint16_t length;
+        if (!_read(b, &length, sizeof(length)) || !_skip(b, TAG_Byte, be16toh(length))) {
+            return false;
+        }
+        break;
+    }
+    case TAG_List:
+    {
+        Byte element_type;
+        Int length;
+        if (!_read(b, &element_type, sizeof(Byte)) || !_read_length(b, &length)) {
+            return false;
+        }
+        if (element_type < TAG_End || element_type > TAG_Long_Array) {
+            return false;
+        }
+        if (element_type <= TAG_Double) {
+            if (!_skip(b, (enum TAGType) element_type, length)) {
+                return false;
+            }
+            break;
+        }
+        size_t path_length = b->path_length;
+        for (Int i = 0; i < length; i++) {
+            if (!_push_path(b, "[%d]", i) || !_visit(b, (enum TAGType) element_type, depth + 1)) {
+                return false;
+            }
+            b->path_length = path_length;
+            b->path[path_length] = '\0';
+        }
+        break;
+    }
+    case TAG_Compound:
+    {
+        size_t path_length = b->path_length;
+        while (1) {
+            Byte child_type;
+            uint16_t name_length;
+            if (!_read(b, &child_type, sizeof(Byte))) {
+                return false;
+            }
+            if (child_type == TAG_End) {
+                break;
+            }
+            if (child_type < TAG_End || child_type > TAG_Long_Array) {
+                return false;
+            }
+            if (!_read(b, &name_length, sizeof(name_length))) {
+                return false;
+            }
+            name_length = be16toh(name_length);
+            if (!_read(b, b->name, name_length)) {
+                return false;
+            }
+            b->name[name_length] = '\0';
+            if (!_push_key(b, path_length ? "." : "", b->name)
+                    || !_visit(b, (enum TAGType) child_type, depth + 1)) {
+                return false;
+            }
+            b->path_length = path_length;
+            b->path[path_length] = '\0';
+        }
+        break;
+    }
+    default:
+        return false;
+    }
+
+    if (entry != SIZE_MAX) {
+        b->entries[entry].length = b->position - start;
+    }
+    return true;
+}
+
+typedef struct {
+    const char* path;
+    IndexEntry entry;
+} _SortItem;
+
+static int _compare_items(const void* a, const void* b) {
+    return strcmp(((const _SortItem*) a)->path, ((const _SortItem*) b)->path);
+}
+
+static bool _build(FILE* source, FILE* out, int max_depth, uint64_t source_size, int64_t source_mtime,
+        const struct inf_point* points, size_t point_count) {
+    _Builder* b = (_Builder*) calloc(1, sizeof(_Builder));
+    if (!b) {
+        return false;
+    }
+    b->file = source;
+    b->max_depth = max_depth;
+
+    bool ok = false;
+    _SortItem* items = NULL;
+    Byte type;
+    uint16_t name_length;
+    if (!_read(b, &type, sizeof(Byte)) || type <= TAG_End || type > TAG_Long_Array
+            || !_read(b, &name_length, sizeof(name_length))
+            || !_read(b, b->name, be16toh(name_length))
+            || !_push_path(b, "%s", "")
+            || !_visit(b, (enum TAGType) type, 0)) {
+        fprintf(stderr, "Failed to index NBT data at offset %llu\n", (unsigned long long) b->position);
+        goto done;
+    }
+
+    items = (_SortItem*) calloc(b->count ? b->count : 1, sizeof(_SortItem));
+    if (!items) {
+        goto done;
+    }
+    for (size_t i = 0; i < b->count; i++) {
+        items[i] = (_SortItem){ b->strings + b->entries[i].path, b->entries[i] };
+    }
+    qsort(items, b->count, sizeof(_SortItem), _compare_items);
+
+    IndexHeader header = {
+        .magic = INDEX_MAGIC,
+        .entry_count = b->count,
+        .max_depth = max_depth,
+        .source_size = source_size ? source_size : b->position,
+        .source_mtime = source_mtime,
+        .data_size = b->position,
+        .point_count = point_count,
+    };
+    if (fwrite(&header, sizeof(header), 1, out) != 1) {
+        goto done;
+    }
+    for (size_t i = 0; i < b->count; i++) {
+        if (fwrite(&items[i].entry, sizeof(IndexEntry), 1, out) != 1) {
+            goto done;
+        }
+    }
+    if (point_count > 0 && fwrite(points, sizeof(struct inf_point), point_count, out) != point_count) {
+        goto done;
+    }
+    ok = fwrite(b->strings, 1, b->strings_length, out) == b->strings_length;
+
+    done:
+    free(items);
+    free(b->entries);
+    free(b->strings);
+    free(b->path);
+    free(b);
+    return ok;
+}
+
+bool index_build(FILE* source, FILE* out, int max_depth) {
+    return _build(source, out, max_depth, 0, 0, NULL, 0);
+}
+
+// inflates source into a temporary file to index, collecting access points on the way
+static bool _build_compressed(FILE* source, FILE* out, int max_depth, const struct stat* st) {
+    FILE* data = tmpfile();
+    if (!data) {
+        perror("tmpfile");
+        return false;
+    }
+    struct inf_point* points = NULL;
+    size_t count = 0;
+    int ret = inf_index(source, data, INDEX_SPAN, &points, &count);
+    if (ret != 0) {
+        zerr(ret);
+        fclose(data);
+        return false;
+    }
+    rewind(data);
+    bool ok = _build(data, out, max_depth, st->st_size, st->st_mtime, points, count);
+    free(points);
+    fclose(data);
+    return ok;
+}
+
+bool index_build_file(const char* nbt_path, const char* index_path, int max_depth) {
+    FILE* source = fopen(nbt_path, "rb");
+    if (!source) {
+        perror(nbt_path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fileno(source), &st) != 0) {
+        fclose(source);
+        return false;
+    }
+    FILE* out = fopen(index_path, "wb");
+    if (!out) {
+        perror(index_path);
+        fclose(source);
+        return false;
+    }
+    unsigned char magic[2];
+    bool compressed = is_compressed(magic, fread(magic, 1, sizeof(magic), source));
+    rewind(source);
+    bool ok = compressed ? _build_compressed(source, out, max_depth, &st)
+            : _build(source, out, max_depth, st.st_size, st.st_mtime, NULL, 0);
+    fclose(source);
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        unlink(index_path);
+    }
+    return ok;
+}
+
+static const void* _map(const char* path, size_t* size, struct stat* st) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror(path);
+        return NULL;
+    }
+    void* map = NULL;
+    if (fstat(fd, st) == 0 && st->st_size > 0) {
+        map = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            map = NULL;
+        }
+    }
+    close(fd);
+    *size = st->st_size;
+    return map;
+}
+
+// every path must start inside the string table, which must end in NUL
+static bool _valid(const NBTIndex* index, size_t strings_size) {
+    const IndexHeader* header = index->header;
+    if (header->entry_count > 0 && (strings_size == 0 || index->strings[strings_size - 1] != '\0')) {
+        return false;
+    }
+    for (uint32_t i = 0; i < header->entry_count; i++) {
+        if (index->entries[i].path >= strings_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+NBTIndex* NBTIndex_open(const char* nbt_path, const char* index_path) {
+    NBTIndex* index = (NBTIndex*) calloc(1, sizeof(NBTIndex));
+    if (!index) {
+        return NULL;
+    }
+    struct stat source_stat, index_stat;
+    index->source = (const char*) _map(nbt_path, &index->source_size, &source_stat);
+    index->header = (const IndexHeader*) _map(index_path, &index->index_size, &index_stat);
+    if (!index->source || !index->header) {
+        goto error;
+    }
+
+    const IndexHeader* header = index->header;
+    if (index->index_size < sizeof(IndexHeader) || memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "%s is not an NBT index\n", index_path);
+        goto error;
+    }
+    if (header->source_size != index->source_size
+            || (header->source_mtime && header->source_mtime != (int64_t) source_stat.st_mtime)) {
+        fprintf(stderr, "%s is out of date for %s\n", index_path, nbt_path);
+        goto error;
+    }
+    size_t points_offset = sizeof(IndexHeader) + (size_t) header->entry_count * sizeof(IndexEntry);
+    size_t strings_offset = points_offset + (size_t) header->point_count * sizeof(struct inf_point);
+    if (strings_offset > index->index_size) {
+        fprintf(stderr, "%s is truncated\n", index_path);
+        goto error;
+    }
+    index->entries = (const IndexEntry*) (header + 1);
+    index->points = (const struct inf_point*) ((const char*) header + points_offset);
+    index->strings = (const char*) header + strings_offset;
+    if (!_valid(index, index->index_size - strings_offset)) {
+        fprintf(stderr, "%s is corrupt\n", index_path);
+        goto error;
+    }
+    return index;
+
+    error:
+    NBTIndex_close(index);
+    return NULL;
+}
+
+void NBTIndex_close(NBTIndex* index) {
+    if (!index) {
+        return;
+    }
+    if (index->source) {
+        munmap((void*) index->source, index->source_size);
+    }
+    if (index->header) {
+        munmap((void*) index->header, index->index_size);
+    }
+    free(index);
+}
+
+static const IndexEntry* _find(const NBTIndex* index, const char* text) {
+    size_t low = 0;
+    size_t high = index->header->entry_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int cmp = strcmp(IndexEntry_path(index, &index->entries[middle]), text);
+        if (cmp == 0) {
+            return &index->entries[middle];
+        }
+        if (cmp < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+// looks expr up in its canonical spelling; *path receives the parsed form
+static const IndexEntry* _lookup(const NBTIndex* index, const char* expr, NBTPath* path) {
+    NBTPath* paths = NULL;
+    size_t count = 0;
+    if (path_parse(expr, &paths, &count) != 1) {
+        while (count > 0) {
+            NBTPath_destroy(&paths[--count]);
+        }
+        free(paths);
+        return NULL;
+    }
+    *path = paths[0];
+    free(paths);
+    return _find(index, path->text);
+}
+
+const IndexEntry* NBTIndex_find(const NBTIndex* index, const char* expr) {
+    NBTPath path = {0};
+    const IndexEntry* entry = _lookup(index, expr, &path);
+    NBTPath_destroy(&path);
+    return entry;
+}
+
+NamedTag* NBTIndex_load(const NBTIndex* index, const char* expr) {
+    NBTPath path = {0};
+    const IndexEntry* entry = _lookup(index, expr, &path);
+    if (!entry) {
+        NBTPath_destroy(&path);
+        return NULL;
+    }
+    const IndexHeader* header = index->header;
+    if (entry->offset + entry->length > (header->point_count ? header->data_size : index->source_size)) {
+        NBTPath_destroy(&path);
+        return NULL;
+    }
+    const char* payload = index->source + entry->offset;
+    char* inflated = NULL;
+    if (header->point_count) {
+        inflated = (char*) malloc(entry->length ? entry->length : 1);
+        if (!inflated) {
+            NBTPath_destroy(&path);
+            return NULL;
+        }
+        int ret = inf_extract((const unsigned char*) index->source, index->source_size, index->points,
+                header->point_count, entry->offset, (unsigned char*) inflated, entry->length);
+        if (ret != 0) {
+            zerr(ret);
+            free(inflated);
+            NBTPath_destroy(&path);
+            return NULL;
+        }
+        payload = inflated;
+    }
+    FILE* stream = fmemopen((void*) payload, entry->length, "r");
+    NamedTag* tag = stream ? parse_payload(stream, (enum TAGType) entry->type) : NULL;
+    if (stream) {
+        fclose(stream);
+    }
+    free(inflated);
+
+    const PathSegment* last = &path.segments[path.length - 1];
+    if (tag && last->kind == PATH_KEY) {
+        if (!String_set(&tag->name, last->key, strlen(last->key))) {
+            NamedTag_free(tag);
+            tag = NULL;
+        }
+    }
+    NBTPath_destroy(&path);
+    return tag;
+}
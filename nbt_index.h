@@ -0,0 +1,82 @@
+#ifndef NBT_INDEX_H
+#define NBT_INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "nbt.h"
+
+/*
+ * Sidecar offset index for NBT files.
+ *
+ * index_build() makes one pass over a document and records, for every value
+ * up to max_depth levels below the root, its path (as written by nbt_path),
+ * type and the byte range of its payload. Later lookups map both files and
+ * parse only the requested subtree.
+ *
+ * For gzip or zlib files the offsets are into the uncompressed document, and
+ * the index also holds zran-style access points: a snapshot of the inflate
+ * window every INDEX_SPAN bytes of output. A lookup then inflates from the
+ * nearest point before the subtree rather than from the start of the file.
+ *
+ * The sidecar layout is host-endian:
+ *   IndexHeader
+ *   IndexEntry[entry_count], sorted by path
+ *   struct inf_point[point_count], by offset
+ *   NUL-terminated paths
+ */
+
+#define INDEX_MAGIC "NBTIDX2"
+#define INDEX_SPAN (1 << 20)
+
+struct inf_point;
+
+typedef struct IndexHeader {
+    char magic[8];
+    uint32_t entry_count;
+    uint32_t max_depth;
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t data_size;   // of the document, once uncompressed
+    uint32_t point_count; // 0 for uncompressed files
+    uint32_t reserved;
+} IndexHeader;
+
+typedef struct IndexEntry {
+    uint64_t offset; // start of the payload in the source file
+    uint64_t length; // payload size in bytes
+    uint32_t path;   // offset of the path in the string table
+    uint16_t depth;
+    uint8_t type;
+    uint8_t reserved;
+} IndexEntry;
+
+typedef struct NBTIndex {
+    const char* source;
+    size_t source_size;
+    const IndexHeader* header;
+    size_t index_size;
+    const IndexEntry* entries;
+    const struct inf_point* points;
+    const char* strings;
+} NBTIndex;
+
+/* writes the index of the uncompressed document in source to out; source may be a pipe */
+bool index_build(FILE* source, FILE* out, int max_depth);
+/* same, with the size and mtime of nbt_path recorded so stale indexes are rejected;
+   nbt_path may be compressed */
+bool index_build_file(const char* nbt_path, const char* index_path, int max_depth);
+
+NBTIndex* NBTIndex_open(const char* nbt_path, const char* index_path);
+void NBTIndex_close(NBTIndex*);
+
+/* path is any expression accepted by path_parse() that names a single value */
+const IndexEntry* NBTIndex_find(const NBTIndex*, const char* path);
+static inline const char* IndexEntry_path(const NBTIndex* index, const IndexEntry* entry) {
+    return index->strings + entry->path;
+}
+/* parses the subtree at path straight out of the mapping, or out of what is inflated
+   from the nearest access point; named after its last key */
+NamedTag* NBTIndex_load(const NBTIndex*, const char* path);
+
+#endif // NBT_INDEX_H
@@ -0,0 +1,106 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_load.h"
+#include "nbt_parse.h"
+#include "nbt.h"
+#include "zpipe.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+bool load_fd(int fd, size_t size, unsigned char** data, size_t* length) {
+    unsigned char* buffer = (unsigned char*) malloc(size ? size : 1);
+    if (!buffer) {
+        return false;
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, buffer + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            free(buffer);
+            return false;
+        }
+        done += n;
+    }
+    *data = buffer;
+    *length = size;
+    return true;
+}
+
+bool load_file(const char* path, unsigned char** data, size_t* length) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && load_fd(fd, st.st_size, data, length);
+    close(fd);
+    return ok;
+}
+
+bool is_compressed(const unsigned char* data, size_t length) {
+    if (length < 2) {
+        return false;
+    }
+    // gzip magic, or a zlib header (deflate method, valid check bits)
+    return (data[0] == 0x1f && data[1] == 0x8b)
+        || ((data[0] & 0x0f) == 8 && ((data[0] << 8) | data[1]) % 31 == 0);
+}
+
+bool decompress_buffer(const unsigned char* data, size_t length, unsigned char** out, size_t* out_length) {
+    if (is_compressed(data, length)) {
+        int ret = inf_buffer(data, length, out, out_length);
+        if (ret != 0) {
+            zerr(ret);
+            return false;
+        }
+        return true;
+    }
+    *out = (unsigned char*) malloc(length ? length : 1);
+    if (!*out) {
+        return false;
+    }
+    memcpy(*out, data, length);
+    *out_length = length;
+    return true;
+}
+
+NamedTag* load_named_tag_from_memory(const unsigned char* data, size_t length, const ParseOptions* options,
+                                     ParseResult* result) {
+    if (!is_compressed(data, length)) {
+        return parse_named_tag_from_buffer_with_options((char*) data, length, options, result);
+    }
+    unsigned char* raw;
+    size_t raw_length;
+    if (!decompress_buffer(data, length, &raw, &raw_length)) {
+        if (result) {
+            *result = (ParseResult){ .error = PARSE_ERROR_FORMAT };
+        }
+        return NULL;
+    }
+    NamedTag* tag = parse_named_tag_from_buffer_with_options((char*) raw, raw_length, options, result);
+    free(raw);
+    return tag;
+}
+
+NamedTag* load_named_tag(const char* path, const ParseOptions* options, ParseResult* result) {
+    unsigned char* data;
+    size_t length;
+    if (!load_file(path, &data, &length)) {
+        if (result) {
+            *result = (ParseResult){ .error = PARSE_ERROR_IO };
+        }
+        return NULL;
+    }
+    NamedTag* tag = load_named_tag_from_memory(data, length, options, result);
+    free(data);
+    return tag;
+}
@@ -0,0 +1,27 @@
+#ifndef NBT_LOAD_H
+#define NBT_LOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "nbt.h"
+#include "nbt_parse.h"
+
+/*
+ * In-process replacement for the open -> zpipe -> parse_named_tag pipeline:
+ * gzip and zlib input is inflated in memory, anything else is parsed as is.
+ */
+
+/* reads a whole file into a malloc'ed buffer */
+bool load_file(const char* path, unsigned char** data, size_t* length);
+/* the same from an open file, whose size the caller already has from fstat() */
+bool load_fd(int fd, size_t size, unsigned char** data, size_t* length);
+/* true when the buffer starts with a gzip or zlib header */
+bool is_compressed(const unsigned char*, size_t);
+/* inflates data if it is compressed; otherwise *out is a copy */
+bool decompress_buffer(const unsigned char* data, size_t length, unsigned char** out, size_t* out_length);
+
+/* options and result may be NULL */
+NamedTag* load_named_tag_from_memory(const unsigned char*, size_t, const ParseOptions*, ParseResult*);
+NamedTag* load_named_tag(const char* path, const ParseOptions*, ParseResult*);
+
+#endif // NBT_LOAD_H
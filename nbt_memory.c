@@ -0,0 +1,351 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_memory.h"
+#include "nbt_path.h"
+#include "nbt_columnar.h"
+#include "nbt.h"
+#include "nbt_hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __GLIBC__
+#  include <malloc.h>
+#endif
+
+static void _block(MemoryUsage* usage, size_t* category, const void* ptr, size_t bytes) {
+    *category += bytes;
+    usage->total += bytes;
+    usage->allocations++;
+#ifdef __GLIBC__
+    size_t usable = malloc_usable_size((void*) ptr);
+    if (usable > bytes) {
+        usage->slack += usable - bytes;
+    }
+#else
+    (void) ptr;
+#endif
+}
+
+static void _add(MemoryUsage* usage, const MemoryUsage* other) {
+    usage->total += other->total;
+    usage->headers += other->headers;
+    usage->names += other->names;
+    usage->strings += other->strings;
+    usage->arrays += other->arrays;
+    usage->allocations += other->allocations;
+    usage->slack += other->slack;
+}
+
+static void _string(MemoryUsage* usage, size_t* category, const String* str) {
+    if (!String_is_inline(str)) {
+        _block(usage, category, str->heap, (size_t) str->length + 1);
+    }
+}
+
+/*
+ * Optional path tracking for memory_heaviest_paths(): a growing path buffer
+ * and a hash table from folded path to totals.
+ */
+
+typedef struct {
+    char* path;
+    size_t length;
+    size_t capacity;
+
+    MemoryPath* entries;
+    size_t entry_count;
+    size_t bucket_count; // power of two, entries are open addressed
+    bool failed;
+} _PathTable;
+
+static bool _grow_table(_PathTable* table) {
+    size_t count = table->bucket_count ? table->bucket_count * 2 : 64;
+    MemoryPath* entries = (MemoryPath*) calloc(count, sizeof(MemoryPath));
+    if (!entries) {
+        return false;
+    }
+    for (size_t i = 0; i < table->bucket_count; i++) {
+        if (!table->entries[i].path) {
+            continue;
+        }
+        size_t slot = fnv1a_string(table->entries[i].path) & (count - 1);
+        while (entries[slot].path) {
+            slot = (slot + 1) & (count - 1);
+        }
+        entries[slot] = table->entries[i];
+    }
+    free(table->entries);
+    table->entries = entries;
+    table->bucket_count = count;
+    return true;
+}
+
+static void _record(_PathTable* table, size_t bytes) {
+    if (table->failed) {
+        return;
+    }
+    if ((table->entry_count + 1) * 2 > table->bucket_count && !_grow_table(table)) {
+        table->failed = true;
+        return;
+    }
+    size_t slot = fnv1a_string(table->path) & (table->bucket_count - 1);
+    while (table->entries[slot].path && strcmp(table->entries[slot].path, table->path) != 0) {
+        slot = (slot + 1) & (table->bucket_count - 1);
+    }
+    MemoryPath* entry = &table->entries[slot];
+    if (!entry->path) {
+        if (!(entry->path = strdup(table->path))) {
+            table->failed = true;
+            return;
+        }
+        table->entry_count++;
+    }
+    entry->bytes += bytes;
+    entry->occurrences++;
+}
+
+/* appends a segment to the current path; returns the old length to restore */
+static size_t _push(_PathTable* table, const char* key) {
+    size_t old = table->length;
+    if (table->failed) {
+        return old;
+    }
+    size_t extra = key ? 2 * strlen(key) + 4 : 3;
+    if (table->length + extra + 1 > table->capacity) {
+        size_t capacity = table->capacity ? table->capacity : 128;
+        while (capacity < table->length + extra + 1) {
+            capacity *= 2;
+        }
+        char* temp = (char*) realloc(table->path, capacity);
+        if (!temp) {
+            table->failed = true;
+            return old;
+        }
+        table->path = temp;
+        table->capacity = capacity;
+    }
+    const char* separator = key && old > 0 ? "." : "";
+    if (key) {
+        table->length += sprintf(table->path + old, "%s", separator);
+        table->length += path_format_key(table->path + table->length, key);
+    } else {
+        table->length += sprintf(table->path + old, "[*]");
+    }
+    return old;
+}
+
+static void _pop(_PathTable* table, size_t length) {
+    if (!table->failed) {
+        table->length = length;
+        table->path[length] = '\0';
+    }
+}
+
+static MemoryUsage _value_usage(enum TAGType type, const void* value, _PathTable* table);
+
+/* one compound child: its name and value, the node itself belongs to the parent's block */
+static MemoryUsage _child_usage(const NamedTag* tag, _PathTable* table) {
+    MemoryUsage usage = {0};
+    _string(&usage, &usage.names, &tag->name);
+    size_t restore = table ? _push(table, String_data(&tag->name)) : 0;
+    MemoryUsage value = _value_usage(tag->type, &tag->byte_value, table);
+    _add(&usage, &value);
+    if (table) {
+        _record(table, usage.total + sizeof(NamedTag));
+        _pop(table, restore);
+    }
+    return usage;
+}
+
+/* the shared schema and columns once, then each element's values as if it were a compound */
+static MemoryUsage _columnar_usage(const List* list, _PathTable* table) {
+    const ColumnarList* columns = (const ColumnarList*) list->tags;
+    MemoryUsage usage = {0};
+    size_t width = columns->width;
+    _block(&usage, &usage.headers, columns, sizeof(ColumnarList));
+    if (width > 0) {
+        _block(&usage, &usage.headers, columns->keys, width * sizeof(String));
+        _block(&usage, &usage.headers, columns->types, width * sizeof(enum TAGType));
+        _block(&usage, &usage.headers, columns->columns, width * sizeof(void*));
+        _block(&usage, &usage.headers, columns->present, width * sizeof(uint8_t*));
+    }
+    for (size_t k = 0; k < width; k++) {
+        enum TAGType type = columns->types[k];
+        bool primitive = type >= TAG_Byte && type <= TAG_Double;
+        _string(&usage, &usage.names, &columns->keys[k]);
+        _block(&usage, primitive ? &usage.arrays : &usage.headers, columns->columns[k],
+            (size_t) list->length * sizeof_type[type]);
+        if (columns->present[k]) {
+            _block(&usage, &usage.headers, columns->present[k], ((size_t) list->length + 7) / 8);
+        }
+    }
+    if (columns->irregular) {
+        _block(&usage, &usage.headers, columns->irregular, (size_t) list->length * sizeof(Compound));
+    }
+
+    size_t restore = table ? _push(table, NULL) : 0;
+    for (Int i = 0; i < list->length; i++) {
+        MemoryUsage element = {0};
+        for (size_t k = 0; k < width; k++) {
+            if (!Column_has(columns->present[k], i)) {
+                continue;
+            }
+            enum TAGType type = columns->types[k];
+            size_t key = table ? _push(table, String_data(&columns->keys[k])) : 0;
+            MemoryUsage value = _value_usage(type, (const char*) columns->columns[k] + (size_t) i * sizeof_type[type], table);
+            if (table) {
+                _record(table, value.total + sizeof_type[type]);
+                _pop(table, key);
+            }
+            _add(&element, &value);
+        }
+        const Compound* extra = columns->irregular ? &columns->irregular[i] : NULL;
+        if (extra && extra->size > 0) {
+            _block(&element, &element.headers, extra->tags, (size_t) extra->size * sizeof(NamedTag));
+            for (Int t = 0; t < extra->size; t++) {
+                MemoryUsage child = _child_usage(&extra->tags[t], table);
+                _add(&element, &child);
+            }
+        }
+        if (table) {
+            _record(table, element.total);
+        }
+        _add(&usage, &element);
+    }
+    if (table) {
+        _pop(table, restore);
+    }
+    return usage;
+}
+
+static MemoryUsage _value_usage(enum TAGType type, const void* value, _PathTable* table) {
+    MemoryUsage usage = {0};
+    switch (type) {
+    case TAG_Byte_Array:
+    case TAG_Int_Array:
+    case TAG_Long_Array:
+    {
+        const Byte_Array* arr = (const Byte_Array*) value; // all three share a layout
+        size_t element = type == TAG_Byte_Array ? sizeof(Byte) : type == TAG_Int_Array ? sizeof(Int) : sizeof(Long);
+        if (arr->data) {
+            _block(&usage, &usage.arrays, arr->data, (size_t) arr->length * element);
+        }
+        break;
+    }
+    case TAG_String:
+        _string(&usage, &usage.strings, (const String*) value);
+        break;
+    case TAG_List:
+    {
+        const List* list = (const List*) value;
+        if (!list->tags || list->length <= 0) {
+            break;
+        }
+        if (list->columnar) {
+            usage = _columnar_usage(list, table);
+            break;
+        }
+        size_t bytes = (size_t) list->length * sizeof_type[list->type];
+        bool primitive = list->type >= TAG_Byte && list->type <= TAG_Double;
+        _block(&usage, primitive ? &usage.arrays : &usage.headers, list->tags, bytes);
+        if (primitive) {
+            break;
+        }
+        size_t restore = table ? _push(table, NULL) : 0;
+        for (Int i = 0; i < list->length; i++) {
+            const void* slot = (const char*) list->tags + i * sizeof_type[list->type];
+            MemoryUsage element = _value_usage(list->type, slot, table);
+            if (table) {
+                _record(table, element.total + sizeof_type[list->type]);
+            }
+            _add(&usage, &element);
+        }
+        if (table) {
+            _pop(table, restore);
+        }
+        break;
+    }
+    case TAG_Compound:
+    {
+        const Compound* compound = (const Compound*) value;
+        if (!compound->tags || compound->size <= 0) {
+            break;
+        }
+        _block(&usage, &usage.headers, compound->tags, (size_t) compound->size * sizeof(NamedTag));
+        for (Int i = 0; i < compound->size; i++) {
+            MemoryUsage child = _child_usage(&compound->tags[i], table);
+            _add(&usage, &child);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return usage;
+}
+
+MemoryUsage NamedTag_memory_usage(const NamedTag* tag) {
+    MemoryUsage usage = {
+        .headers = sizeof(NamedTag),
+        .total = sizeof(NamedTag),
+    };
+    _string(&usage, &usage.names, &tag->name);
+    MemoryUsage value = _value_usage(tag->type, &tag->byte_value, NULL);
+    _add(&usage, &value);
+    return usage;
+}
+
+static int _heavier(const void* a, const void* b) {
+    const MemoryPath* x = (const MemoryPath*) a;
+    const MemoryPath* y = (const MemoryPath*) b;
+    if (x->bytes != y->bytes) {
+        return x->bytes < y->bytes ? 1 : -1;
+    }
+    return strcmp(x->path, y->path);
+}
+
+MemoryPath* memory_heaviest_paths(const NamedTag* root, size_t n, size_t* count) {
+    _PathTable table = {0};
+    table.capacity = 128;
+    if (!(table.path = (char*) malloc(table.capacity))) {
+        return NULL;
+    }
+    table.path[0] = '\0';
+    _value_usage(root->type, &root->byte_value, &table);
+    free(table.path);
+    if (table.failed) {
+        MemoryPath_free_all(table.entries, table.bucket_count);
+        return NULL;
+    }
+
+    // compact, sort, keep the first n
+    size_t used = 0;
+    for (size_t i = 0; i < table.bucket_count; i++) {
+        if (table.entries[i].path) {
+            table.entries[used++] = table.entries[i];
+        }
+    }
+    qsort(table.entries, used, sizeof(MemoryPath), _heavier);
+    for (size_t i = n; i < used; i++) {
+        free(table.entries[i].path);
+    }
+    *count = used < n ? used : n;
+    if (*count == 0) {
+        free(table.entries);
+        return NULL;
+    }
+    return table.entries;
+}
+
+void MemoryPath_free_all(MemoryPath* paths, size_t count) {
+    if (!paths) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        free(paths[i].path);
+    }
+    free(paths);
+}
@@ -0,0 +1,39 @@
+#ifndef NBT_MEMORY_H
+#define NBT_MEMORY_H
+
+#include <stddef.h>
+#include "nbt.h"
+
+/*
+ * Where the memory of a tree goes. Sizes are what was requested from the
+ * allocator, the same figures the parser charges to its budget; slack is what
+ * the allocator added on top where it can tell (glibc).
+ */
+
+typedef struct MemoryUsage {
+    size_t total;
+    size_t headers;     // NamedTags and list slots of non-primitives, including the node measured
+    size_t names;       // names too long to live inside their String
+    size_t strings;     // string values too long to live inside their String
+    size_t arrays;      // array elements and lists of primitives
+    size_t allocations; // heap blocks, not counting the node measured
+    size_t slack;
+} MemoryUsage;
+
+MemoryUsage NamedTag_memory_usage(const NamedTag*);
+
+/*
+ * Memory per path, with list indices folded into [*] so that, e.g., all of
+ * Entities[*].Inventory adds up to one entry.
+ */
+typedef struct MemoryPath {
+    char* path;
+    size_t bytes;       // everything below and including the nodes on this path
+    size_t occurrences; // how many nodes share it
+} MemoryPath;
+
+/* the n heaviest paths below root, heaviest first; free the result with MemoryPath_free_all() */
+MemoryPath* memory_heaviest_paths(const NamedTag* root, size_t n, size_t* count);
+void MemoryPath_free_all(MemoryPath*, size_t count);
+
+#endif // NBT_MEMORY_H
@@ -0,0 +1,402 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_merge.h"
+#include "nbt_columnar.h"
+#include "nbt.h"
+#include "nbt_hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// below this many keys a linear scan beats building a table
+#define HASH_MIN_KEYS 8
+
+/* copying */
+
+static void _destroy_payload(enum TAGType type, void* payload) {
+    NamedTag temp = { .type = type };
+    memcpy(&temp.byte_value, payload, sizeof_type[type]);
+    NamedTag_destroy(&temp);
+}
+
+bool copy_payload(enum TAGType type, const void* src, void* dest) {
+    switch (type) {
+    case TAG_Byte:
+    case TAG_Short:
+    case TAG_Int:
+    case TAG_Long:
+    case TAG_Float:
+    case TAG_Double:
+        memcpy(dest, src, sizeof_type[type]);
+        return true;
+    case TAG_Byte_Array:
+    case TAG_Int_Array:
+    case TAG_Long_Array:
+    {
+        const Byte_Array* from = (const Byte_Array*) src; // all three share a layout
+        Byte_Array* to = (Byte_Array*) dest;
+        size_t size = (size_t) from->length * sizeof_type[type == TAG_Byte_Array ? TAG_Byte
+                : type == TAG_Int_Array ? TAG_Int : TAG_Long];
+        to->length = from->length;
+        to->data = NULL;
+        if (size > 0) {
+            if (!(to->data = (Byte*) malloc(size))) {
+                return false;
+            }
+            memcpy(to->data, from->data, size);
+        }
+        return true;
+    }
+    case TAG_String:
+    {
+        const String* from = (const String*) src;
+        return String_set((String*) dest, String_data(from), from->length);
+    }
+    case TAG_List:
+    {
+        const List* from = (const List*) src;
+        List* to = (List*) dest;
+        size_t size = sizeof_type[from->type];
+        *to = (List){ .type = from->type };
+        if (from->length == 0 || size == 0) {
+            to->length = from->length;
+            return true;
+        }
+        if (!(to->tags = malloc((size_t) from->length * size))) {
+            return false;
+        }
+        for (Int i = 0; i < from->length; i++) {
+            Compound element;
+            const void* item = (const char*) from->tags + i * size;
+            if (from->columnar) {
+                // the copy is a plain list
+                if (!List_element_view(from, i, &element)) {
+                    to->length = i;
+                    List_destroy(to);
+                    return false;
+                }
+                item = &element;
+            }
+            bool ok = copy_payload(from->type, item, (char*) to->tags + i * size);
+            if (from->columnar) {
+                free(element.tags);
+            }
+            if (!ok) {
+                to->length = i;
+                List_destroy(to);
+                return false;
+            }
+        }
+        to->length = from->length;
+        return true;
+    }
+    case TAG_Compound:
+    {
+        const Compound* from = (const Compound*) src;
+        Compound* to = (Compound*) dest;
+        *to = (Compound){0};
+        if (from->size == 0) {
+            return true;
+        }
+        if (!(to->tags = (NamedTag*) malloc((size_t) from->size * sizeof(NamedTag)))) {
+            return false;
+        }
+        for (Int i = 0; i < from->size; i++) {
+            const NamedTag* child = &from->tags[i];
+            NamedTag* copy = &to->tags[i];
+            *copy = (NamedTag){ .type = child->type };
+            if (!String_set(&copy->name, String_data(&child->name), child->name.length)) {
+                Compound_destroy(to);
+                return false;
+            }
+            if (!copy_payload(child->type, &child->byte_value, &copy->byte_value)) {
+                String_destroy(&copy->name);
+                Compound_destroy(to);
+                return false;
+            }
+            to->size = i + 1;
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+NamedTag* NamedTag_copy(const NamedTag* tag) {
+    NamedTag* copy = (NamedTag*) calloc(1, sizeof(NamedTag));
+    if (!copy) {
+        return NULL;
+    }
+    copy->type = tag->type;
+    if (!String_set(&copy->name, String_data(&tag->name), tag->name.length)) {
+        free(copy);
+        return NULL;
+    }
+    if (!copy_payload(tag->type, &tag->byte_value, &copy->byte_value)) {
+        String_destroy(&copy->name);
+        free(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+/* key lookup */
+
+typedef struct {
+    const Compound* compound;
+    Int* slots; // index + 1, 0 for empty; NULL for small compounds
+    size_t mask;
+} _Keys;
+
+static bool _same_name(const NamedTag* tag, const String* name) {
+    return tag->type != TAG_End && tag->name.length == name->length
+        && memcmp(String_data(&tag->name), String_data(name), name->length) == 0;
+}
+
+static void _keys_insert(_Keys* keys, Int index) {
+    const String* name = &keys->compound->tags[index].name;
+    size_t slot = fnv1a(String_data(name), name->length) & keys->mask;
+    while (keys->slots[slot]) {
+        slot = (slot + 1) & keys->mask;
+    }
+    keys->slots[slot] = index + 1;
+}
+
+/* room for the compound's keys and up to extra more */
+static bool _keys_init(_Keys* keys, const Compound* compound, Int extra) {
+    *keys = (_Keys){ .compound = compound };
+    if (compound->size + extra < HASH_MIN_KEYS) {
+        return true;
+    }
+    size_t capacity = 16;
+    while (capacity < 2 * (size_t) (compound->size + extra)) {
+        capacity *= 2;
+    }
+    if (!(keys->slots = (Int*) calloc(capacity, sizeof(Int)))) {
+        return false;
+    }
+    keys->mask = capacity - 1;
+    for (Int i = 0; i < compound->size; i++) {
+        _keys_insert(keys, i);
+    }
+    return true;
+}
+
+static Int _keys_find(const _Keys* keys, const String* name) {
+    const Compound* compound = keys->compound;
+    if (!keys->slots) {
+        for (Int i = 0; i < compound->size; i++) {
+            if (_same_name(&compound->tags[i], name)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    size_t slot = fnv1a(String_data(name), name->length) & keys->mask;
+    for (; keys->slots[slot]; slot = (slot + 1) & keys->mask) {
+        Int i = keys->slots[slot] - 1;
+        if (_same_name(&compound->tags[i], name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* merging */
+
+typedef struct {
+    enum MergeMode mode;
+    enum MergeListMode lists;
+    bool move;
+} _Merge;
+
+/* takes over or copies a payload of patch */
+static bool _take(const _Merge* m, enum TAGType type, void* from, void* to) {
+    if (!m->move) {
+        return copy_payload(type, from, to);
+    }
+    memcpy(to, from, sizeof_type[type]);
+    memset(from, 0, sizeof_type[type]);
+    return true;
+}
+
+static bool _append(const _Merge* m, List* target, List* patch) {
+    if (patch->length == 0) {
+        return true;
+    }
+    if (!List_materialize(target)) {
+        return false;
+    }
+    if (patch->columnar) {
+        if (m->move) {
+            return List_materialize(patch) && _append(m, target, patch);
+        }
+        List copy;
+        if (!copy_payload(TAG_List, patch, &copy)) {
+            return false;
+        }
+        _Merge moving = *m;
+        moving.move = true;
+        bool ok = _append(&moving, target, &copy);
+        List_destroy(&copy);
+        return ok;
+    }
+    if (target->length == 0) {
+        List_destroy(target);
+        target->type = patch->type;
+        target->tags = NULL;
+    }
+    size_t size = sizeof_type[patch->type];
+    if (size == 0) {
+        target->length += patch->length;
+        return true;
+    }
+    void* temp = realloc(target->tags, (size_t) (target->length + patch->length) * size);
+    if (!temp) {
+        return false;
+    }
+    target->tags = temp;
+    char* dest = (char*) target->tags + (size_t) target->length * size;
+    if (m->move) {
+        memcpy(dest, patch->tags, (size_t) patch->length * size);
+        target->length += patch->length;
+        free(patch->tags);
+        patch->tags = NULL;
+        patch->length = 0;
+        return true;
+    }
+    for (Int i = 0; i < patch->length; i++) {
+        if (!copy_payload(patch->type, (const char*) patch->tags + i * size, dest + i * size)) {
+            return false;
+        }
+        target->length++;
+    }
+    return true;
+}
+
+static bool _merge_compound(const _Merge* m, Compound* target, Compound* patch) {
+    if (patch->size == 0) {
+        return true;
+    }
+    if (m->mode != MERGE_REMOVE) {
+        NamedTag* temp = (NamedTag*) realloc(target->tags, (size_t) (target->size + patch->size) * sizeof(NamedTag));
+        if (!temp) {
+            return false;
+        }
+        target->tags = temp;
+    }
+    _Keys keys;
+    if (!_keys_init(&keys, target, m->mode == MERGE_REMOVE ? 0 : patch->size)) {
+        return false;
+    }
+
+    bool ok = true;
+    Int removed = 0;
+    for (Int p = 0; ok && p < patch->size; p++) {
+        NamedTag* from = &patch->tags[p];
+        Int i = _keys_find(&keys, &from->name);
+        if (i < 0) {
+            if (m->mode == MERGE_REMOVE) {
+                continue;
+            }
+            NamedTag* to = &target->tags[target->size];
+            *to = (NamedTag){ .type = from->type };
+            if (m->move) {
+                to->name = from->name;
+                from->name = (String){0};
+            } else if (!String_set(&to->name, String_data(&from->name), from->name.length)) {
+                ok = false;
+                break;
+            }
+            if (!_take(m, from->type, &from->byte_value, &to->byte_value)) {
+                String_destroy(&to->name);
+                ok = false;
+                break;
+            }
+            if (keys.slots) {
+                _keys_insert(&keys, target->size);
+            }
+            target->size++;
+            continue;
+        }
+
+        NamedTag* to = &target->tags[i];
+        if (to->type == TAG_Compound && from->type == TAG_Compound
+                && (m->mode != MERGE_REMOVE || from->compound_value.size > 0)) {
+            ok = _merge_compound(m, &to->compound_value, &from->compound_value);
+            continue;
+        }
+        switch (m->mode) {
+        case MERGE_REMOVE:
+            NamedTag_destroy(to);
+            to->type = TAG_End; // compacted below
+            removed++;
+            break;
+        case MERGE_ADD:
+            break;
+        case MERGE_REPLACE:
+            if (m->lists == MERGE_LIST_APPEND && to->type == TAG_List && from->type == TAG_List
+                    && (to->list_value.type == from->list_value.type
+                        || to->list_value.length == 0 || from->list_value.length == 0)) {
+                ok = _append(m, &to->list_value, &from->list_value);
+                break;
+            }
+            {
+                // the new payload is complete before the old one goes
+                NamedTag value = { .type = from->type };
+                if (!_take(m, from->type, &from->byte_value, &value.byte_value)) {
+                    ok = false;
+                    break;
+                }
+                _destroy_payload(to->type, &to->byte_value);
+                to->type = value.type;
+                memcpy(&to->byte_value, &value.byte_value, sizeof_type[value.type]);
+            }
+            break;
+        }
+    }
+    free(keys.slots);
+
+    if (removed > 0) {
+        Int kept = 0;
+        for (Int i = 0; i < target->size; i++) {
+            if (target->tags[i].type != TAG_End) {
+                target->tags[kept++] = target->tags[i];
+            }
+        }
+        target->size = kept;
+    }
+    if (target->size == 0) {
+        free(target->tags);
+        target->tags = NULL;
+    }
+    return ok;
+}
+
+static bool _merge(NamedTag* target, NamedTag* patch, const MergeOptions* options, bool move) {
+    if (target->type != TAG_Compound || patch->type != TAG_Compound) {
+        return false;
+    }
+    _Merge m = {
+        .mode = options ? options->mode : MERGE_REPLACE,
+        .lists = options ? options->lists : MERGE_LIST_REPLACE,
+        .move = move,
+    };
+    return _merge_compound(&m, &target->compound_value, &patch->compound_value);
+}
+
+bool NamedTag_merge(NamedTag* target, NamedTag* patch, const MergeOptions* options) {
+    bool ok = _merge(target, patch, options, true);
+    if (patch->type == TAG_Compound) {
+        // whatever was not moved, or only emptied, goes now
+        Compound_destroy(&patch->compound_value);
+        patch->compound_value = (Compound){0};
+    }
+    return ok;
+}
+
+bool NamedTag_merge_copy(NamedTag* target, const NamedTag* patch, const MergeOptions* options) {
+    // nothing is written through patch when copying
+    return _merge(target, (NamedTag*) patch, options, false);
+}
@@ -0,0 +1,43 @@
+#ifndef NBT_MERGE_H
+#define NBT_MERGE_H
+
+#include <stdbool.h>
+#include "nbt.h"
+
+/*
+ * Deep merges of a patch compound into a target compound, as /data merge and
+ * structure tooling combine NBT. Compounds present on both sides are merged
+ * key by key; anything else in the patch is added to the target or takes the
+ * place of what the target holds under that key, whatever its type.
+ *
+ * Keys of larger target compounds are found through a hash table built for
+ * the merge rather than by repeated Compound_find() scans. If memory runs
+ * out, the target is left valid but only partly merged.
+ */
+
+enum MergeMode {
+    MERGE_REPLACE, // add missing keys, replace existing ones
+    MERGE_ADD,     // only add missing keys
+    MERGE_REMOVE   // remove the patch's keys; a non-empty compound names keys inside it
+};
+
+enum MergeListMode {
+    MERGE_LIST_REPLACE,
+    MERGE_LIST_APPEND // lists of the same element type, or empty ones, are concatenated
+};
+
+typedef struct MergeOptions {
+    enum MergeMode mode;
+    enum MergeListMode lists;
+} MergeOptions;
+
+/* both must be compounds; patch is consumed, its subtrees moved into target, and left empty */
+bool NamedTag_merge(NamedTag* target, NamedTag* patch, const MergeOptions*);
+/* same, copying what it needs from patch, which can then be applied again */
+bool NamedTag_merge_copy(NamedTag* target, const NamedTag* patch, const MergeOptions*);
+
+/* a deep copy of a payload as passed to write_payload() into dest, which is overwritten */
+bool copy_payload(enum TAGType, const void* src, void* dest);
+NamedTag* NamedTag_copy(const NamedTag*);
+
+#endif // NBT_MERGE_H
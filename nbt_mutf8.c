@@ -0,0 +1,245 @@
+#include "nbt_mutf8.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+/* length of the leading run of bytes 0x01 to 0x7F, the ones both encodings share */
+static size_t _ascii_run(const unsigned char* s, size_t length) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (s + i));
+        // high bit set, or a zero byte
+        int mask = _mm_movemask_epi8(block) | _mm_movemask_epi8(_mm_cmpeq_epi8(block, zero));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#else
+    static const uint64_t ones = 0x0101010101010101ull;
+    static const uint64_t highs = 0x8080808080808080ull;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, s + i, sizeof(word));
+        if ((word | ((word - ones) & ~word)) & highs) {
+            break; // the byte loop below finds out which one
+        }
+    }
+#endif
+    while (i < length && (unsigned) (s[i] - 1) < 0x7F) {
+        i++;
+    }
+    return i;
+}
+
+/* one Modified UTF-8 sequence: its length, or 0 if malformed */
+static size_t _decode_mutf8(const unsigned char* s, size_t left, uint32_t* unit) {
+    unsigned char c = s[0];
+    if (c > 0 && c < 0x80) {
+        *unit = c;
+        return 1;
+    }
+    if ((c & 0xE0) == 0xC0) {
+        if (left < 2 || (s[1] & 0xC0) != 0x80) {
+            return 0;
+        }
+        uint32_t u = (uint32_t) (c & 0x1F) << 6 | (s[1] & 0x3F);
+        if (u != 0 && u < 0x80) {
+            return 0; // overlong; only NUL is written that way
+        }
+        *unit = u;
+        return 2;
+    }
+    if ((c & 0xF0) == 0xE0) {
+        if (left < 3 || (s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80) {
+            return 0;
+        }
+        uint32_t u = (uint32_t) (c & 0x0F) << 12 | (uint32_t) (s[1] & 0x3F) << 6 | (s[2] & 0x3F);
+        if (u < 0x800) {
+            return 0;
+        }
+        *unit = u;
+        return 3;
+    }
+    return 0;
+}
+
+/* one standard UTF-8 sequence: its length, or 0 if malformed */
+static size_t _decode_utf8(const unsigned char* s, size_t left, uint32_t* code_point) {
+    unsigned char c = s[0];
+    if (c < 0x80) {
+        *code_point = c;
+        return 1;
+    }
+    size_t length;
+    uint32_t cp;
+    uint32_t min;
+    if (c >= 0xC2 && c <= 0xDF) {
+        length = 2;
+        cp = c & 0x1F;
+        min = 0x80;
+    } else if ((c & 0xF0) == 0xE0) {
+        length = 3;
+        cp = c & 0x0F;
+        min = 0x800;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        length = 4;
+        cp = c & 0x07;
+        min = 0x10000;
+    } else {
+        return 0;
+    }
+    if (left < length) {
+        return 0;
+    }
+    for (size_t i = 1; i < length; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        cp = cp << 6 | (s[i] & 0x3F);
+    }
+    if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+        return 0;
+    }
+    *code_point = cp;
+    return length;
+}
+
+static size_t _encode_utf8(uint32_t cp, unsigned char* out) {
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = 0xC0 | cp >> 6;
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = 0xE0 | cp >> 12;
+        out[1] = 0x80 | (cp >> 6 & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | cp >> 18;
+    out[1] = 0x80 | (cp >> 12 & 0x3F);
+    out[2] = 0x80 | (cp >> 6 & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+bool mutf8_validate(const char* str, size_t length) {
+    const unsigned char* s = (const unsigned char*) str;
+    size_t i = 0;
+    while (1) {
+        i += _ascii_run(s + i, length - i);
+        if (i == length) {
+            return true;
+        }
+        uint32_t unit;
+        size_t n = _decode_mutf8(s + i, length - i, &unit);
+        if (n == 0) {
+            return false;
+        }
+        i += n;
+    }
+}
+
+size_t mutf8_to_utf8(const char* in, size_t length, char* out) {
+    const unsigned char* s = (const unsigned char*) in;
+    unsigned char* d = (unsigned char*) out;
+    size_t i = 0;
+    size_t o = 0;
+    while (1) {
+        size_t run = _ascii_run(s + i, length - i);
+        if (d + o != s + i) {
+            memmove(d + o, s + i, run);
+        }
+        i += run;
+        o += run;
+        if (i == length) {
+            return o;
+        }
+        uint32_t unit;
+        size_t n = _decode_mutf8(s + i, length - i, &unit);
+        if (n == 0) {
+            return MUTF8_INVALID;
+        }
+        i += n;
+        if (unit >= 0xD800 && unit <= 0xDBFF) {
+            uint32_t low;
+            if (i < length && _decode_mutf8(s + i, length - i, &low) == 3 && low >= 0xDC00 && low <= 0xDFFF) {
+                i += 3;
+                unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+            } else {
+                unit = 0xFFFD;
+            }
+        } else if (unit >= 0xDC00 && unit <= 0xDFFF) {
+            unit = 0xFFFD;
+        }
+        // never longer than what was consumed, so writing in place is safe
+        unsigned char encoded[4];
+        size_t m = _encode_utf8(unit, encoded);
+        memcpy(d + o, encoded, m);
+        o += m;
+    }
+}
+
+size_t utf8_to_mutf8_length(const char* in, size_t length) {
+    const unsigned char* s = (const unsigned char*) in;
+    size_t i = 0;
+    size_t total = 0;
+    while (1) {
+        size_t run = _ascii_run(s + i, length - i);
+        i += run;
+        total += run;
+        if (i == length) {
+            return total;
+        }
+        uint32_t cp;
+        size_t n = _decode_utf8(s + i, length - i, &cp);
+        if (n == 0) {
+            return MUTF8_INVALID;
+        }
+        i += n;
+        // NUL takes two bytes, supplementary characters two surrogates of three
+        total += cp == 0 ? 2 : cp >= 0x10000 ? 6 : n;
+    }
+}
+
+size_t utf8_to_mutf8(const char* in, size_t length, char* out) {
+    const unsigned char* s = (const unsigned char*) in;
+    unsigned char* d = (unsigned char*) out;
+    size_t i = 0;
+    size_t o = 0;
+    while (1) {
+        size_t run = _ascii_run(s + i, length - i);
+        memcpy(d + o, s + i, run);
+        i += run;
+        o += run;
+        if (i == length) {
+            return o;
+        }
+        uint32_t cp;
+        size_t n = _decode_utf8(s + i, length - i, &cp);
+        if (n == 0) {
+            return MUTF8_INVALID;
+        }
+        i += n;
+        if (cp == 0) {
+            d[o++] = 0xC0;
+            d[o++] = 0x80;
+        } else if (cp >= 0x10000) {
+            cp -= 0x10000;
+            o += _encode_utf8(0xD800 + (cp >> 10), d + o);
+            o += _encode_utf8(0xDC00 + (cp & 0x3FF), d + o);
+        } else {
+            o += _encode_utf8(cp, d + o);
+        }
+    }
+}
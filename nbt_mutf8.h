@@ -0,0 +1,32 @@
+#ifndef NBT_MUTF8_H
+#define NBT_MUTF8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Java's Modified UTF-8, the string encoding of Java NBT: U+0000 is written
+ * as C0 80 and characters beyond the BMP as two 3-byte surrogates, so no
+ * sequence is longer than three bytes and no byte is zero.
+ *
+ * Runs of ASCII are skipped 16 bytes at a time, so strings that are mostly
+ * ASCII, like nearly every key, cost little more than a length check.
+ */
+
+#define MUTF8_INVALID ((size_t) -1)
+
+bool mutf8_validate(const char*, size_t length);
+
+/*
+ * Converts to standard UTF-8 and returns the new length, which is never
+ * larger, so out may be the input itself. Unpaired surrogates, which UTF-8
+ * cannot express, become U+FFFD. Returns MUTF8_INVALID on malformed input.
+ */
+size_t mutf8_to_utf8(const char* in, size_t length, char* out);
+
+/* how long the Modified UTF-8 form of a UTF-8 string is, MUTF8_INVALID if it is malformed */
+size_t utf8_to_mutf8_length(const char*, size_t length);
+/* out must have room for utf8_to_mutf8_length() bytes; returns the same length */
+size_t utf8_to_mutf8(const char* in, size_t length, char* out);
+
+#endif // NBT_MUTF8_H
@@ -1,44 +1,21 @@
 #define _DEFAULT_SOURCE
 
 #include "nbt_parse.h"
+#include "nbt_mutf8.h"
+#include "nbt_columnar.h"
 #include "nbt.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
-#ifdef __APPLE__ 
-
-// assuming macOS
-#  include <machine/endian.h>
-
-#  define be16toh(x) ntohs(x)
-#  define be32toh(x) ntohl(x)
-#  define be64toh(x) ntohll(x)
-
-#  define htobe16(x) htons(x)
-#  define htobe32(x) htonl(x)
-#  define htobe64(x) htonll(x)
-
-#elif defined(_WIN32)
-// Windows
-
-#include <winsock2.h>
-
-#  define be16toh(x) ntohs(x)
-#  define be32toh(x) ntohl(x)
-#  define be64toh(x) ntohll(x)
-
-#  define htobe16(x) htons(x)
-#  define htobe32(x) htonl(x)
-#  define htobe64(x) htonll(x)
-
-#else
-// Assuming Linux or UNIX-like that has endian.h
-#  include <endian.h>
-#endif
+#include "nbt_endian.h"
 
 
 #ifndef NDEBUG
@@ -47,467 +24,670 @@
 #  define DEBUG_PRINT(...)
 #endif
 
-NamedTag* _parse_named_tag(FILE* file) {
-    NamedTag* ret = (NamedTag*) calloc(1, sizeof(NamedTag));
-    Byte type;
-    if (!fread(&type, sizeof(Byte), 1, file)) {
-        goto error;
-    }
-    if (type == TAG_End) {
-        *ret = (NamedTag){
-            .type = TAG_End,
-            .name = (String){
-                .length = 0,
-                .data = NULL,
-            },
-        };
-        return ret;
-    }
-    {
-        String* name = _parse_string(file);
-        if (!name) {
-            goto error;
-        }
-        *ret = (NamedTag){
-            .type = (enum TAGType) type,
-            .name = *name,
-        };
-        free(name);
-    }
+const char* parse_error_message[] = {
+    [PARSE_OK] = "Success",
+    [PARSE_ERROR_IO] = "Unexpected end of input or read error",
+    [PARSE_ERROR_MEMORY] = "Out of memory",
+    [PARSE_ERROR_FORMAT] = "Malformed NBT data",
+    [PARSE_ERROR_BUDGET] = "Memory budget exceeded",
+    [PARSE_ERROR_ARRAY_LENGTH] = "Array longer than allowed",
+    [PARSE_ERROR_LIST_LENGTH] = "List longer than allowed",
+    [PARSE_ERROR_STRING_LENGTH] = "String longer than allowed",
+    [PARSE_ERROR_DEPTH] = "Nesting deeper than allowed",
+    [PARSE_ERROR_ENCODING] = "Malformed Modified UTF-8 string",
+    [PARSE_ERROR_ABORTED] = "Stopped by the array callback",
+};
+
+const ParseLimits parse_limits_default = {
+    .max_depth = NBT_MAX_DEPTH,
+};
+
+const ParseLimits parse_limits_untrusted = {
+    .max_total_bytes = 64 * 1024 * 1024,
+    .max_array_length = 1024 * 1024,
+    .max_list_length = 1024 * 1024,
+    .max_string_length = 32 * 1024,
+    .max_depth = NBT_MAX_DEPTH,
+};
+
+struct ParseContext {
+    FILE* file;
+    ParseLimits limits;
+    size_t allocated;
+    int depth;
+    long input_size; // -1 when the size of the input is not known
+    enum NBTDialect dialect;
+    enum StringMode strings;
+    const char* buffer; // the whole input when parsing from memory
+    int threads;
+    const ParseOptions* arrays; // set when arrays go to a callback
+    const char* name;           // of the tag whose payload is being parsed
+    size_t* shared;             // set in the workers of a parallel list, which charge it together
+    bool columnar;              // lists of compounds go to ColumnarList
+    enum ParseError error;
+};
+
+static bool _fail(ParseContext* ctx, enum ParseError error) {
+    // keep the first, most specific error
+    if (ctx->error == PARSE_OK) {
+        ctx->error = error;
+    }
+    return false;
+}
 
-    // TODO: highly repetitive and duplicates _parse_list
-    switch (type) {
-    case TAG_End:
-        #ifdef __GNUC__
-        __builtin_unreachable();
-        #endif
-        break;
-    case TAG_Byte:
-    {
-        Byte value;
-        if (!fread(&value, sizeof(Byte), 1, file)) {
-            goto error;
-        }
-        ret->byte_value = value;
-        break;
-    }
-    case TAG_Short:
-    {
-        Short value;
-        if (!fread(&value, sizeof(Short), 1, file)) {
-            goto error;
-        }
-        ret->short_value = be16toh(value);
-        break;
-    }
-    case TAG_Int:
-    case TAG_Float:
-    {
-        Int value;
-        if (!fread(&value, sizeof(Int), 1, file)) {
-            goto error;
-        }
-        ret->int_value = be32toh(value);
-        break;
+static bool _read(ParseContext* ctx, void* dest, size_t size, size_t count) {
+    if (fread(dest, size, count, ctx->file) != count) {
+        return _fail(ctx, PARSE_ERROR_IO);
     }
-    case TAG_Long:
-    case TAG_Double:
-    {
-        Long value;
-        if (!fread(&value, sizeof(Long), 1, file)) {
-            goto error;
-        }
-        ret->long_value = be64toh(value);
-        break;
+    return true;
+}
+
+/* accounts for an allocation of bytes before it is made */
+static bool _charge(ParseContext* ctx, size_t bytes) {
+    size_t limit = ctx->limits.max_total_bytes;
+    if (ctx->shared) {
+        size_t total = __atomic_load_n(ctx->shared, __ATOMIC_RELAXED);
+        do {
+            if (limit && (bytes > limit || total > limit - bytes)) {
+                return _fail(ctx, PARSE_ERROR_BUDGET);
+            }
+        } while (!__atomic_compare_exchange_n(ctx->shared, &total, total + bytes, true,
+                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        ctx->allocated += bytes;
+        return true;
     }
-    case TAG_Byte_Array:
-        ret->byte_array_value = _parse_byte_array(file);
-        if (!ret->byte_array_value) {
-            goto error;
-        }
-        break;
-    case TAG_String:
-        ret->string_value = _parse_string(file);
-        if (!ret->string_value) {
-            goto error;
-        }
-        break;
-    case TAG_List:
-        ret->list_value = _parse_list(file);
-        if (!ret->list_value) {
-            goto error;
-        }
-        break;
-    case TAG_Compound:
-        ret->compound_value = _parse_compound(file);
-        if (!ret->compound_value) {
-            goto error;
-        }
-        break;
-    case TAG_Int_Array:
-        ret->int_array_value = _parse_int_array(file);
-        if (!ret->int_array_value) {
-            goto error;
-        }
-        break;
-    case TAG_Long_Array:
-        ret->long_array_value = _parse_long_array(file);
-        if (!ret->long_array_value) {
-            goto error;
-        }
-        break;
-    default:
-        fprintf(stderr, "Unknown tag type %d\n", type);
-        goto error;
-        break;
+    if (limit && (bytes > limit || ctx->allocated > limit - bytes)) {
+        return _fail(ctx, PARSE_ERROR_BUDGET);
     }
-
-    return ret;
-    error:
-    free(ret);
-    return NULL;
+    ctx->allocated += bytes;
+    return true;
 }
 
-NamedTag* parse_named_tag(FILE* file) {
-    NamedTag* tag = _parse_named_tag(file);
-    if (!tag) {
-        if (feof(file)) {
-            fprintf(stderr, "Unexpected end of file\n");
-        }
-        fprintf(stderr, "Failed to parse NBT data\n"
-                            "Errno may provide more information:\n"
-                            "Errno %d: %s\n", errno, strerror(errno));
+/* gives back what _charge() took, for memory freed or never allocated */
+static void _refund(ParseContext* ctx, size_t bytes) {
+    ctx->allocated -= bytes;
+    if (ctx->shared) {
+        __atomic_fetch_sub(ctx->shared, bytes, __ATOMIC_RELAXED);
     }
-    return tag;
 }
 
-NamedTag* parse_named_tag_from_buffer(char* buffer, size_t length) {
-    FILE* stream = fmemopen((void*)buffer, length, "r");
-    if (!stream) {
+static void* _alloc(ParseContext* ctx, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) {
+        _fail(ctx, PARSE_ERROR_BUDGET);
         return NULL;
     }
-    NamedTag* tag = parse_named_tag(stream);
-    if (!tag) {
-        fprintf(stderr, "An error occurred. ftell(stream) = %ld\n", ftell(stream));
+    if (!_charge(ctx, count * size)) {
+        return NULL;
     }
-    if (ferror(stream)) {
-        fprintf(stderr, "ferror returned true, errno may be set:\n"
-                        "Errno %d: %s\n", errno, strerror(errno));
+    void* ret = malloc(count * size);
+    if (!ret) {
+        _refund(ctx, count * size);
+        _fail(ctx, PARSE_ERROR_MEMORY);
     }
-    fclose(stream);
-    return tag;
+    return ret;
 }
 
-Byte_Array* _parse_byte_array(FILE* file) {
-    Int length;
-    if (!fread(&length, sizeof(Int), 1, file)) {
+static void* _realloc(ParseContext* ctx, void* ptr, size_t old_count, size_t new_count, size_t size) {
+    if (new_count > old_count && !_charge(ctx, (new_count - old_count) * size)) {
         return NULL;
     }
-    length = be32toh(length);
-    Byte_Array* ret = (Byte_Array*) calloc(1, sizeof(Byte_Array));
+    void* ret = realloc(ptr, new_count * size);
     if (!ret) {
+        if (new_count > old_count) {
+            _refund(ctx, (new_count - old_count) * size);
+        }
+        _fail(ctx, PARSE_ERROR_MEMORY);
         return NULL;
     }
-    ret->length = length;
-    ret->data = (Byte*) calloc(length, sizeof(Byte));
-    if (!ret->data) {
-        free(ret);
-        return NULL;
-    }
-    if (!fread(ret->data, sizeof(Byte), length, file)) {
-        free (ret->data);
-        free (ret);
-        return NULL;
+    if (new_count < old_count) {
+        _refund(ctx, (old_count - new_count) * size);
     }
     return ret;
 }
 
-String* _parse_string(FILE* file) {
-    Short length;
-    if (!fread(&length, sizeof(Short), 1, file)) {
-        return NULL;
+/*
+ * Rejects a declared length that the rest of the input cannot possibly hold,
+ * so a forged length fails before anything is allocated for it.
+ */
+static bool _check_available(ParseContext* ctx, Int count, size_t min_element_size) {
+    if (ctx->input_size < 0) {
+        return true;
     }
-    fprintf(stderr, "Length before conversion: %04x\n", length);
-    length = be16toh(length);
-    char* str;
-    if (length == 0) {
-        str = "";
-    } else {
-        str = (char*) calloc(length + 1, sizeof(char));
-        if (!str) {
-            return NULL;
+    long position = ftell(ctx->file);
+    if (position < 0) {
+        return true;
+    }
+    if ((uint64_t) count * min_element_size > (uint64_t) (ctx->input_size - position)) {
+        return _fail(ctx, PARSE_ERROR_IO);
+    }
+    return true;
+}
+
+// smallest possible encoding of one payload, used to sanity check list lengths
+static const size_t min_payload_size[] = {
+    [TAG_End] = 0,
+    [TAG_Byte] = 1,
+    [TAG_Short] = 2,
+    [TAG_Int] = 4,
+    [TAG_Long] = 8,
+    [TAG_Float] = 4,
+    [TAG_Double] = 8,
+    [TAG_Byte_Array] = 4,
+    [TAG_String] = 2,
+    [TAG_List] = 5,
+    [TAG_Compound] = 1,
+    [TAG_Int_Array] = 4,
+    [TAG_Long_Array] = 4
+};
+
+
+// the same for dialects where Int and Long values and all lengths are varints
+static const size_t min_payload_size_varint[] = {
+    [TAG_End] = 0,
+    [TAG_Byte] = 1,
+    [TAG_Short] = 2,
+    [TAG_Int] = 1,
+    [TAG_Long] = 1,
+    [TAG_Float] = 4,
+    [TAG_Double] = 8,
+    [TAG_Byte_Array] = 1,
+    [TAG_String] = 1,
+    [TAG_List] = 2,
+    [TAG_Compound] = 1,
+    [TAG_Int_Array] = 1,
+    [TAG_Long_Array] = 1
+};
+
+/* LEB128 varints as used by Bedrock network NBT; signed values are zigzag encoded */
+static bool _read_varint32(ParseContext* ctx, Int* dest, bool zigzag) {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int c = getc(ctx->file);
+        if (c == EOF) {
+            return _fail(ctx, PARSE_ERROR_IO);
         }
-        if (!fread(str, sizeof(char), length, file)) {
-            free(str);
-            return NULL;
+        value |= (uint32_t) (c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *dest = zigzag ? (Int) ((value >> 1) ^ -(value & 1)) : (Int) value;
+            return true;
+        }
+    }
+    return _fail(ctx, PARSE_ERROR_FORMAT);
+}
+
+static bool _read_varint64(ParseContext* ctx, Long* dest) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 70; shift += 7) {
+        int c = getc(ctx->file);
+        if (c == EOF) {
+            return _fail(ctx, PARSE_ERROR_IO);
+        }
+        value |= (uint64_t) (c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *dest = (Long) ((value >> 1) ^ -(value & 1));
+            return true;
         }
     }
+    return _fail(ctx, PARSE_ERROR_FORMAT);
+}
 
-    String* ret = (String*) calloc(1, sizeof(String));
-    if (!ret) {
-        free(str);
-        return NULL;
+/* lists at least this long are split across threads when ParseOptions.threads allows */
+#define PARALLEL_MIN_ELEMENTS 256
+
+static bool _parse_list_parallel(ParseContext*, List*, Int length);
+static bool _skip_elements(FILE*, enum TAGType, Int, int);
+
+/* one specialised decoder per dialect, see nbt_parse_impl.h */
+
+#define NBT_TO_HOST16 be16toh
+#define NBT_TO_HOST32 be32toh
+#define NBT_TO_HOST64 be64toh
+
+#define NBT_MUTF8
+#define NBT_PARALLEL
+#define DIALECT java
+#include "nbt_parse_impl.h"
+#undef DIALECT
+#undef NBT_PARALLEL
+
+#define NBT_NAMELESS_ROOT
+#define DIALECT java_network
+#include "nbt_parse_impl.h"
+#undef DIALECT
+#undef NBT_NAMELESS_ROOT
+#undef NBT_MUTF8
+
+#undef NBT_TO_HOST16
+#undef NBT_TO_HOST32
+#undef NBT_TO_HOST64
+#define NBT_TO_HOST16 le16toh
+#define NBT_TO_HOST32 le32toh
+#define NBT_TO_HOST64 le64toh
+
+#define DIALECT bedrock
+#include "nbt_parse_impl.h"
+#undef DIALECT
+
+// Bedrock network NBT keeps the root name but uses varints
+#define NBT_VARINT
+#define DIALECT bedrock_network
+#include "nbt_parse_impl.h"
+#undef DIALECT
+#undef NBT_VARINT
+
+#undef NBT_TO_HOST16
+#undef NBT_TO_HOST32
+#undef NBT_TO_HOST64
+
+/*
+ * Parallel parsing of a long list from a memory buffer. A skip pass finds
+ * where each range of elements starts, then workers parse the ranges from
+ * their own streams straight into the slots of the list.
+ */
+
+typedef struct ListRange {
+    long start;
+    long end;
+    Int first;
+    Int count;
+    Int parsed;
+    enum ParseError error;
+} ListRange;
+
+typedef struct ListJob {
+    const ParseContext* parent;
+    List* list;
+    ListRange* ranges;
+    size_t range_count;
+    size_t next;  // next range to take, shared by the workers
+    size_t allocated; // the parent's charge plus everything the workers charge
+    int failed;
+} ListJob;
+
+/* destroys count slots of a list without freeing the list's storage */
+static void _destroy_slots(enum TAGType type, void* slots, Int count) {
+    for (Int i = 0; i < count; i++) {
+        NamedTag tmp = { .type = type };
+        memcpy(&tmp.byte_value, (char*) slots + i * sizeof_type[type], sizeof_type[type]);
+        NamedTag_destroy(&tmp);
     }
-    *ret = (String){
-        .length = length,
-        .data = str
+}
+
+static void _parse_range(ListJob* job, ListRange* range) {
+    const ParseContext* parent = job->parent;
+    size_t length = range->end - range->start;
+    FILE* stream = fmemopen((void*) (parent->buffer + range->start), length, "r");
+    if (!stream) {
+        range->error = PARSE_ERROR_MEMORY;
+        return;
+    }
+    ParseContext ctx = {
+        .file = stream,
+        .limits = parent->limits,
+        .depth = parent->depth,
+        .input_size = length,
+        .dialect = NBT_JAVA,
+        .strings = parent->strings,
+        .columnar = parent->columnar,
+        .shared = &job->allocated,
     };
-    return ret;
+    enum TAGType type = job->list->type;
+    char* slots = (char*) job->list->tags + range->first * sizeof_type[type];
+    for (Int i = 0; i < range->count; i++) {
+        if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED)) {
+            break;
+        }
+        if (!_parse_value_java(&ctx, type, slots + i * sizeof_type[type])) {
+            _destroy_slots(type, slots, i);
+            range->error = ctx.error != PARSE_OK ? ctx.error : PARSE_ERROR_FORMAT;
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+            fclose(stream);
+            return;
+        }
+        range->parsed = i + 1;
+    }
+    fclose(stream);
 }
 
-List* _parse_list(FILE* file) {
-    Byte type;
-    if (!fread(&type, sizeof(Byte), 1, file)) {
-        return NULL;
+static void* _list_worker(void* arg) {
+    ListJob* job = (ListJob*) arg;
+    while (1) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->range_count) {
+            return NULL;
+        }
+        _parse_range(job, &job->ranges[i]);
     }
-    Int length;
-    if (!fread(&length, sizeof(Int), 1, file)) {
-        return NULL;
+}
+
+static bool _parse_list_parallel(ParseContext* ctx, List* list, Int length) {
+    // a few ranges per thread keeps the threads busy when elements differ in size
+    size_t range_count = (size_t) ctx->threads * 4;
+    if (range_count > (size_t) length) {
+        range_count = length;
+    }
+    ListRange* ranges = (ListRange*) calloc(range_count, sizeof(ListRange));
+    pthread_t* threads = (pthread_t*) calloc(ctx->threads, sizeof(pthread_t));
+    if (!ranges || !threads) {
+        free(ranges);
+        free(threads);
+        return _fail(ctx, PARSE_ERROR_MEMORY);
+    }
+
+    // skip pass; leaves the stream after the list as a sequential parse would
+    for (size_t i = 0; i < range_count; i++) {
+        ListRange* range = &ranges[i];
+        range->first = (Int) ((uint64_t) length * i / range_count);
+        range->count = (Int) ((uint64_t) length * (i + 1) / range_count) - range->first;
+        range->start = ftell(ctx->file);
+        if (!_skip_elements(ctx->file, list->type, range->count, ctx->depth)) {
+            free(ranges);
+            free(threads);
+            return _fail(ctx, feof(ctx->file) ? PARSE_ERROR_IO : PARSE_ERROR_FORMAT);
+        }
+        range->end = ftell(ctx->file);
     }
-    length = be32toh(length);
-    List* ret = (List*) calloc(1, sizeof(List));
-    void* data = calloc(sizeof_type[type], length + 1);
-    (void)data;
-    for (Int i = 0; i < length; i++) {
-        // TODO: highly repetitive and duplicates _parse_named_tag
-        // I hope GCC hoists this switch
-        switch (type) {
-            case TAG_End:
-                fprintf(stderr, "%s cannot be the type of a list\n", tag_name[type]);
-                goto error;
-            case TAG_Byte:
-                if (!fread(&((Byte*)data)[i], sizeof(Byte), 1, file)) {
-                    goto error;
-                }
-                break;
-            case TAG_Short:
-            {
-                Short value;
-                if (!fread(&value, sizeof(Short), 1, file)) {
-                    goto error;
-                }
-                ((Short*)data)[i] = be16toh(value);
-                break;
-            }
-            case TAG_Int:
-            {
-                Int value;
-                if (!fread(&value, sizeof(Int), 1, file)) {
-                    goto error;
-                }
-                ((Int*)data)[i] = be32toh(value);
-                break;
-            }
-            case TAG_Long:
-            {
-                Long value;
-                if (!fread(&value, sizeof(Long), 1, file)) {
-                    goto error;
-                }
-                ((Long*)data)[i] = be64toh(value);
-                break;
-            }
-            case TAG_Float:
-            {
-                Float value;
-                if (!fread(&value, sizeof(Float), 1, file)) {
-                    goto error;
-                }
-                ((Float*)data)[i] = be32toh(value);
-                break;
-            }
-            case TAG_Double:
-            {
-                Double value;
-                if (!fread(&value, sizeof(Double), 1, file)) {
-                    goto error;
-                }
-                ((Double*)data)[i] = be64toh(value);
-                break;
-            }
 
-            case TAG_Byte_Array:
-            {
-                Byte_Array* res = _parse_byte_array(file);
-                if (!res) {
-                    goto error;
-                }
-                ((Byte_Array*)data)[i] = *res;
-                free(res);
-                break;
-            }
-            case TAG_String:
-            {
-                String* res = _parse_string(file);
-                if (!res) {
-                    goto error;
-                }
-                ((String*)data)[i] = *res;
-                free(res);
-                break;
-            }
-            case TAG_List:
-            {
-                List* res = _parse_list(file);
-                if (!res) {
-                    goto error;
-                }
-                ((List*)data)[i] = *res;
-                free(res);
-                break;
-            }
-            case TAG_Compound:
-            {
-                Compound* res = _parse_compound(file);
-                if (!res) {
-                    goto error;
-                }
-                ((Compound*)data)[i] = *res;
-                free(res);
-                break;
-            }
-            case TAG_Int_Array:
-            {
-                Int_Array* res = _parse_int_array(file);
-                if (!res) {
-                    goto error;
-                }
-                ((Int_Array*)data)[i] = *res;
-                free(res);
-                break;
-            }
-            case TAG_Long_Array:
-            {
-                Long_Array* res = _parse_long_array(file);
-                if (!res) {
-                    goto error;
-                }
-                ((Long_Array*)data)[i] = *res;
-                free(res);
-                break;
+    ListJob job = {
+        .parent = ctx,
+        .list = list,
+        .ranges = ranges,
+        .range_count = range_count,
+        .allocated = ctx->allocated,
+    };
+    int started = 0;
+    for (int i = 1; i < ctx->threads; i++) {
+        if (pthread_create(&threads[started], NULL, _list_worker, &job) != 0) {
+            break; // carry on with the threads we have
+        }
+        started++;
+    }
+    _list_worker(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    // the workers charged the budget as they went
+    ctx->allocated = job.allocated;
+    enum ParseError error = PARSE_OK;
+    for (size_t i = 0; i < range_count; i++) {
+        if (ranges[i].error != PARSE_OK && error == PARSE_OK) {
+            error = ranges[i].error;
+        }
+    }
+    if (error != PARSE_OK || job.failed) {
+        // failed ranges cleaned up after themselves
+        for (size_t i = 0; i < range_count; i++) {
+            if (ranges[i].error == PARSE_OK) {
+                _destroy_slots(list->type, (char*) list->tags + ranges[i].first * sizeof_type[list->type],
+                               ranges[i].parsed);
             }
-            default:
-                fprintf(stderr, "Unknown list type %d\n", type);
-                goto error;
-                break;
         }
+        free(ranges);
+        return _fail(ctx, error != PARSE_OK ? error : PARSE_ERROR_FORMAT);
     }
+    free(ranges);
+    list->length = length;
+    return true;
+}
 
-    *ret = (List){
-        .type = type,
-        .length = length,
-        .tags = data 
-    };
+/* picks the decoder once per document */
+static bool _parse_root(ParseContext* ctx, NamedTag* ret) {
+    switch (ctx->dialect) {
+    case NBT_JAVA:
+        return _parse_root_java(ctx, ret);
+    case NBT_JAVA_NETWORK:
+        return _parse_root_java_network(ctx, ret);
+    case NBT_BEDROCK:
+        return _parse_root_bedrock(ctx, ret);
+    case NBT_BEDROCK_NETWORK:
+        return _parse_root_bedrock_network(ctx, ret);
+    }
+    return _fail(ctx, PARSE_ERROR_FORMAT);
+}
 
-    return ret;
 
-    error:
-    free(ret);
-    return NULL;
+static void _context_init(ParseContext* ctx, FILE* file, const ParseOptions* options) {
+    *ctx = (ParseContext){
+        .file = file,
+        .limits = options ? options->limits : parse_limits_default,
+        .input_size = -1,
+        .dialect = options ? options->dialect : NBT_JAVA,
+        .threads = options ? options->threads : 0,
+        .strings = options ? options->strings : STRINGS_RAW,
+        .columnar = options && options->columnar_lists,
+    };
+    if (options && options->array_callback) {
+        ctx->arrays = options;
+        ctx->threads = 1; // chunks are delivered in document order
+    }
+    if (ctx->limits.max_depth <= 0 || ctx->limits.max_depth > NBT_MAX_DEPTH) {
+        ctx->limits.max_depth = NBT_MAX_DEPTH;
+    }
+    // a regular file or memory buffer has a known size to check lengths against
+    struct stat st;
+    int fd = fileno(file);
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        ctx->input_size = st.st_size;
+    }
 }
 
-Compound* _parse_compound(FILE* file) {
-    static const size_t INITIAL_CAPACITY = 64;
+static void _report(ParseContext* ctx, ParseResult* result) {
+    if (ctx->error == PARSE_OK && feof(ctx->file)) {
+        ctx->error = PARSE_ERROR_IO;
+    }
+    if (result) {
+        result->error = ctx->error;
+        result->bytes_allocated = ctx->allocated;
+        result->offset = ftell(ctx->file);
+    }
+}
 
-    // dynamic array init
-    size_t array_size = 0;
-    size_t array_capacity = INITIAL_CAPACITY;
-    NamedTag* array = (NamedTag*) calloc(array_capacity, sizeof(NamedTag));
-    if (!array) {
+static NamedTag* _parse_named_tag(ParseContext* ctx) {
+    NamedTag* ret = (NamedTag*) _alloc(ctx, 1, sizeof(NamedTag));
+    if (!ret) {
+        return NULL;
+    }
+    if (!_parse_root(ctx, ret)) {
+        free(ret);
         return NULL;
     }
+    return ret;
+}
 
-    while (1) {
-        NamedTag* tag = _parse_named_tag(file);
-        if (!tag) {
-            free(array);
-            return NULL;
-        }
-        if (array_size >= array_capacity) {
-            array_capacity *= 2;
-            NamedTag* temp = (NamedTag*) realloc(array, array_capacity * sizeof(NamedTag));
-            if (!temp) {
-                free(array);
-                return NULL;
-            }
-            array = temp;
-        }
-        array[array_size] = *tag;
-        free(tag);
-        
-        if (array[array_size].type == TAG_End) break;
-        array_size++;
+NamedTag* parse_named_tag_with_options(FILE* file, const ParseOptions* options, ParseResult* result) {
+    ParseContext ctx;
+    _context_init(&ctx, file, options);
+    NamedTag* tag = _parse_named_tag(&ctx);
+    if (tag) {
+        ctx.error = PARSE_OK;
     }
+    _report(&ctx, result);
+    return tag;
+}
 
-    {
-        NamedTag* temp = (NamedTag*) realloc(array, (array_size + 1) * sizeof(NamedTag));
-        if (!temp) {
-            free(array);
-            return NULL;
+NamedTag* parse_named_tag(FILE* file) {
+    ParseResult result;
+    NamedTag* tag = parse_named_tag_with_options(file, NULL, &result);
+    if (!tag) {
+        fprintf(stderr, "Failed to parse NBT data at offset %ld: %s\n",
+                result.offset, parse_error_message[result.error]);
+        if (result.error == PARSE_ERROR_IO && ferror(file)) {
+            fprintf(stderr, "Errno %d: %s\n", errno, strerror(errno));
         }
-        array = temp;
     }
+    return tag;
+}
 
-    Compound* ret = (Compound*) calloc(1, sizeof(Compound));
-    if (!ret) {
-        free(array);
+NamedTag* parse_named_tag_from_buffer_with_options(char* buffer, size_t length, const ParseOptions* options,
+                                                   ParseResult* result) {
+    FILE* stream = fmemopen((void*)buffer, length, "r");
+    if (!stream) {
+        if (result) {
+            *result = (ParseResult){ .error = PARSE_ERROR_MEMORY };
+        }
         return NULL;
     }
-    ret->size = array_size;
-    ret->tags = array;
-    return ret;
+    ParseContext ctx;
+    _context_init(&ctx, stream, options);
+    ctx.input_size = length;
+    ctx.buffer = buffer;
+    NamedTag* tag = _parse_named_tag(&ctx);
+    if (tag) {
+        ctx.error = PARSE_OK;
+    }
+    _report(&ctx, result);
+    fclose(stream);
+    return tag;
 }
 
-Int_Array* _parse_int_array(FILE* file) {
-    Int length;
-    if (!fread(&length, sizeof(Int), 1, file)) {
-        return NULL;
+NamedTag* parse_named_tag_from_buffer(char* buffer, size_t length) {
+    ParseResult result;
+    NamedTag* tag = parse_named_tag_from_buffer_with_options(buffer, length, NULL, &result);
+    if (!tag) {
+        fprintf(stderr, "Failed to parse NBT data at offset %ld: %s\n",
+                result.offset, parse_error_message[result.error]);
     }
-    length = be32toh(length);
-    Int_Array* ret = (Int_Array*) calloc(1, sizeof(Int_Array));
-    if (!ret) {
+    return tag;
+}
+
+NamedTag* parse_payload(FILE* file, enum TAGType type) {
+    if (type <= TAG_End || type > TAG_Long_Array) {
+        fprintf(stderr, "Unknown tag type %d\n", type);
         return NULL;
     }
-    ret->length = length;
-    ret->data = (Int*) calloc(length, sizeof(Int));
-    if (!ret->data) {
-        free(ret);
+    ParseContext ctx;
+    _context_init(&ctx, file, NULL);
+    NamedTag* tag = (NamedTag*) calloc(1, sizeof(NamedTag));
+    if (!tag) {
         return NULL;
     }
-    if (!fread(ret->data, sizeof(Int), length, file)) {
-        free(ret->data);
-        free(ret);
+    tag->type = type;
+    if (!_parse_value_java(&ctx, type, &tag->byte_value)) {
+        fprintf(stderr, "Failed to parse %s payload: %s\n", tag_name[type], parse_error_message[ctx.error]);
+        free(tag);
         return NULL;
     }
-    for (Int i = 0; i < length; i++) {
-        ret->data[i] = be32toh(ret->data[i]);
+    return tag;
+}
+
+
+static bool _skip_bytes(FILE* file, size_t count) {
+    if (count == 0) {
+        return true;
     }
-    return ret;
+    // seeking is far cheaper, but pipes do not support it
+    if (count <= LONG_MAX && fseek(file, (long) count, SEEK_CUR) == 0) {
+        return true;
+    }
+    char scratch[4096];
+    while (count > 0) {
+        size_t step = count < sizeof(scratch) ? count : sizeof(scratch);
+        if (fread(scratch, 1, step, file) != step) {
+            return false;
+        }
+        count -= step;
+    }
+    return true;
 }
 
-Long_Array* _parse_long_array(FILE* file) {
+static bool _skip_array(FILE* file, size_t element_size) {
     Int length;
     if (!fread(&length, sizeof(Int), 1, file)) {
-        return NULL;
+        return false;
     }
     length = be32toh(length);
-    Long_Array* ret = (Long_Array*) calloc(1, sizeof(Long_Array));
-    if (!ret) {
-        return NULL;
+    if (length < 0) {
+        return false;
     }
-    ret->length = length;
-    ret->data = (Long*) calloc(length, sizeof(Long));
-    if (!ret->data) {
-        free(ret);
-        return NULL;
+    return _skip_bytes(file, (size_t) length * element_size);
+}
+
+static bool _skip_payload(FILE* file, enum TAGType type, int depth) {
+    switch (type) {
+    case TAG_End:
+        return true;
+    case TAG_Byte:
+    case TAG_Short:
+    case TAG_Int:
+    case TAG_Long:
+    case TAG_Float:
+    case TAG_Double:
+        return _skip_bytes(file, sizeof_type[type]);
+    case TAG_Byte_Array:
+        return _skip_array(file, sizeof(Byte));
+    case TAG_Int_Array:
+        return _skip_array(file, sizeof(Int));
+    case TAG_Long_Array:
+        return _skip_array(file, sizeof(Long));
+    case TAG_String:
+    {
+        uint16_t length;
+        if (!fread(&length, sizeof(length), 1, file)) {
+            return false;
+        }
+        return _skip_bytes(file, be16toh(length));
     }
-    if (!fread(ret->data, sizeof(Long), length, file)) {
-        free(ret->data);
-        free(ret);
-        return NULL;
+    case TAG_List:
+    {
+        Byte element_type;
+        Int length;
+        if (!fread(&element_type, sizeof(Byte), 1, file)
+                || !fread(&length, sizeof(Int), 1, file)) {
+            return false;
+        }
+        length = be32toh(length);
+        if (length < 0 || element_type < TAG_End || element_type > TAG_Long_Array) {
+            return false;
+        }
+        if (element_type > TAG_Double && depth >= NBT_MAX_DEPTH) {
+            return false;
+        }
+        return _skip_elements(file, (enum TAGType) element_type, length, depth + 1);
+    }
+    case TAG_Compound:
+        if (depth >= NBT_MAX_DEPTH) {
+            return false;
+        }
+        while (1) {
+            Byte child_type;
+            if (!fread(&child_type, sizeof(Byte), 1, file)) {
+                return false;
+            }
+            if (child_type == TAG_End) {
+                return true;
+            }
+            if (child_type < TAG_End || child_type > TAG_Long_Array) {
+                return false;
+            }
+            if (!_skip_payload(file, TAG_String, depth) || !_skip_payload(file, (enum TAGType) child_type, depth + 1)) {
+                return false;
+            }
+        }
     }
-    for (Int i = 0; i < length; i++) {
-        ret->data[i] = be64toh(ret->data[i]);
+    return false;
+}
+
+static bool _skip_elements(FILE* file, enum TAGType type, Int count, int depth) {
+    if (count <= 0) {
+        return count == 0;
     }
-    return ret;
+    if (type >= TAG_Byte && type <= TAG_Double) {
+        return _skip_bytes(file, (size_t) count * sizeof_type[type]);
+    }
+    for (Int i = 0; i < count; i++) {
+        if (!_skip_payload(file, type, depth)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool skip_payload(FILE* file, enum TAGType type) {
+    return _skip_payload(file, type, 0);
+}
+
+bool skip_elements(FILE* file, enum TAGType type, Int count) {
+    return _skip_elements(file, type, count, 0);
 }
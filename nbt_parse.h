@@ -1,12 +1,125 @@
+#ifndef NBT_PARSE_H
+#define NBT_PARSE_H
+
 #include <stdio.h>
+#include <stdbool.h>
 #include "nbt.h"
 
+/* nesting limit for compounds and lists, the same one Minecraft enforces */
+#define NBT_MAX_DEPTH 512
+
+/* a zero field means no limit; max_depth is always capped at NBT_MAX_DEPTH */
+typedef struct ParseLimits {
+    size_t max_total_bytes;
+    Int max_array_length;
+    Int max_list_length;
+    uint16_t max_string_length;
+    int max_depth;
+} ParseLimits;
+
+/* what parse_named_tag() uses */
+extern const ParseLimits parse_limits_default;
+/* a conservative starting point for data from the network or from users */
+extern const ParseLimits parse_limits_untrusted;
+
+enum ParseError {
+    PARSE_OK = 0,
+    PARSE_ERROR_IO,
+    PARSE_ERROR_MEMORY,
+    PARSE_ERROR_FORMAT,
+    PARSE_ERROR_BUDGET,
+    PARSE_ERROR_ARRAY_LENGTH,
+    PARSE_ERROR_LIST_LENGTH,
+    PARSE_ERROR_STRING_LENGTH,
+    PARSE_ERROR_DEPTH,
+    PARSE_ERROR_ENCODING,
+    PARSE_ERROR_ABORTED
+};
+
+extern const char* parse_error_message[];
+
+/*
+ * Encodings of NBT. Java and Bedrock files differ only in byte order; network
+ * NBT as sent by Java servers drops the name of the root tag, while Bedrock's
+ * keeps it but writes Int and Long values and all lengths as varints.
+ */
+enum NBTDialect {
+    NBT_JAVA = 0,
+    NBT_JAVA_NETWORK,
+    NBT_BEDROCK,
+    NBT_BEDROCK_NETWORK
+};
+
+/* what to do with the Modified UTF-8 strings of Java NBT; Bedrock's are UTF-8 already */
+enum StringMode {
+    STRINGS_RAW = 0,  // keep the bytes as they are
+    STRINGS_VALIDATE, // fail on malformed strings
+    STRINGS_UTF8      // validate and convert to standard UTF-8
+};
+
+/* a piece of an array handed to ParseOptions.array_callback */
+typedef struct ArrayChunk {
+    enum TAGType type; // TAG_Byte_Array, TAG_Int_Array or TAG_Long_Array
+    const char* name;  // of the tag holding the array; for list elements, of the list
+    Int length;        // of the whole array
+    Int offset;        // index of data[0] within it
+    Int count;
+    const void* data;  // host byte order, valid during the call only
+} ArrayChunk;
+
+/* return false to stop parsing with PARSE_ERROR_ABORTED */
+typedef bool (*ArrayCallback)(void* userdata, const ArrayChunk*);
+
+typedef struct ParseOptions {
+    ParseLimits limits;
+    enum NBTDialect dialect;
+    enum StringMode strings;
+    /*
+     * With more than one thread, long lists of non-primitives in Java NBT
+     * parsed from a buffer are split into ranges by a skip pass and parsed
+     * concurrently. Other inputs are parsed sequentially.
+     */
+    int threads;
+    /*
+     * With array_callback set, arrays of at least array_min_length elements
+     * are not stored, and appear empty in the tree. Their elements go to the
+     * callback in order, array_chunk at a time (0 for 65536), so memory use
+     * is bounded by the chunk size. Lists are then parsed on one thread.
+     */
+    ArrayCallback array_callback;
+    void* array_userdata;
+    Int array_chunk;
+    Int array_min_length;
+    /*
+     * Lists of compounds are stored column by column, see nbt_columnar.h.
+     * Such lists are parsed sequentially.
+     */
+    bool columnar_lists;
+} ParseOptions;
+
+typedef struct ParseResult {
+    enum ParseError error;
+    size_t bytes_allocated; // heap bytes charged to the budget, i.e. held by the tree on success
+    long offset;            // input position where parsing stopped
+} ParseResult;
+
+typedef struct ParseContext ParseContext;
+
 NamedTag* parse_named_tag(FILE*);
 NamedTag* parse_named_tag_from_buffer(char*, size_t);
+/*
+ * Lengths are checked against the limits before anything is allocated for
+ * them, and every allocation is charged to max_total_bytes. On failure NULL
+ * is returned and result (if given) says why; nothing is printed.
+ */
+NamedTag* parse_named_tag_with_options(FILE*, const ParseOptions*, ParseResult*);
+NamedTag* parse_named_tag_from_buffer_with_options(char*, size_t, const ParseOptions*, ParseResult*);
+/* parses a bare Java payload, e.g. one located through an offset index; the result has no name */
+NamedTag* parse_payload(FILE*, enum TAGType);
+
+/* consumes the Java payload of a tag of the given type without building anything */
+bool skip_payload(FILE*, enum TAGType);
+/* same, for count consecutive list elements */
+bool skip_elements(FILE*, enum TAGType, Int count);
 
-Byte_Array* _parse_byte_array(FILE*);
-String* _parse_string(FILE*);
-List* _parse_list(FILE*);
-Compound* _parse_compound(FILE*);
-Int_Array* _parse_int_array(FILE*);
-Long_Array* _parse_long_array(FILE*);
\ No newline at end of file
+#endif // NBT_PARSE_H
@@ -0,0 +1,536 @@
+/*
+ * Decoding core of nbt_parse.c, instantiated once per dialect.
+ *
+ * This file has no include guard on purpose. Before each inclusion define
+ *   DIALECT              suffix of the generated functions, e.g. java
+ *   NBT_TO_HOST16/32/64  conversion from the dialect's byte order
+ * and optionally
+ *   NBT_VARINT           Int and Long values and all lengths are varints
+ *   NBT_NAMELESS_ROOT    the root tag has a type but no name
+ *   NBT_PARALLEL         long lists may be parsed on several threads
+ *   NBT_MUTF8            strings are Modified UTF-8 and honour ParseOptions.strings
+ * Everything is decided at compile time, so each dialect gets its own
+ * specialised code without a branch per value.
+ */
+
+#define _NBT_CAT(a, b) a##_##b
+#define NBT_CAT(a, b) _NBT_CAT(a, b)
+#define D(name) NBT_CAT(name, DIALECT)
+
+#ifdef NBT_VARINT
+#  define NBT_VARINT_ENABLED 1
+#  define NBT_MIN_PAYLOAD_SIZE min_payload_size_varint
+#else
+#  define NBT_VARINT_ENABLED 0
+#  define NBT_MIN_PAYLOAD_SIZE min_payload_size
+#endif
+
+// Int and Long payloads are the ones a varint dialect encodes differently
+#define NBT_IS_VARINT_TYPE(type) (NBT_VARINT_ENABLED && ((type) == TAG_Int || (type) == TAG_Long))
+
+static bool D(_parse_value)(ParseContext* ctx, enum TAGType type, void* dest);
+
+/* Int lengths of arrays and lists */
+static bool D(_read_length)(ParseContext* ctx, Int* length) {
+#ifdef NBT_VARINT
+    return _read_varint32(ctx, length, true);
+#else
+    uint32_t value;
+    if (!_read(ctx, &value, sizeof(value), 1)) {
+        return false;
+    }
+    *length = (Int) NBT_TO_HOST32(value);
+    return true;
+#endif
+}
+
+static bool D(_read_string_length)(ParseContext* ctx, uint16_t* length) {
+#ifdef NBT_VARINT
+    Int value;
+    if (!_read_varint32(ctx, &value, false)) {
+        return false;
+    }
+    if ((uint32_t) value > UINT16_MAX) {
+        return _fail(ctx, PARSE_ERROR_STRING_LENGTH);
+    }
+    *length = (uint16_t) value;
+    return true;
+#else
+    if (!_read(ctx, length, sizeof(*length), 1)) {
+        return false;
+    }
+    *length = NBT_TO_HOST16(*length);
+    return true;
+#endif
+}
+
+/* reads one primitive payload into dest */
+static bool D(_parse_primitive)(ParseContext* ctx, enum TAGType type, void* dest) {
+    switch (type) {
+    case TAG_Byte:
+        return _read(ctx, dest, sizeof(Byte), 1);
+    case TAG_Short:
+    {
+        uint16_t value;
+        if (!_read(ctx, &value, sizeof(value), 1)) {
+            return false;
+        }
+        value = NBT_TO_HOST16(value);
+        memcpy(dest, &value, sizeof(value));
+        return true;
+    }
+    case TAG_Int:
+#ifdef NBT_VARINT
+        return _read_varint32(ctx, (Int*) dest, true);
+#endif
+    case TAG_Float:
+    {
+        uint32_t value;
+        if (!_read(ctx, &value, sizeof(value), 1)) {
+            return false;
+        }
+        value = NBT_TO_HOST32(value);
+        memcpy(dest, &value, sizeof(value));
+        return true;
+    }
+    case TAG_Long:
+#ifdef NBT_VARINT
+        return _read_varint64(ctx, (Long*) dest);
+#endif
+    case TAG_Double:
+    {
+        uint64_t value;
+        if (!_read(ctx, &value, sizeof(value), 1)) {
+            return false;
+        }
+        value = NBT_TO_HOST64(value);
+        memcpy(dest, &value, sizeof(value));
+        return true;
+    }
+    default:
+        return _fail(ctx, PARSE_ERROR_FORMAT);
+    }
+}
+
+/* converts count elements of the given size in place */
+static void D(_swap_elements)(void* data, Int count, size_t element_size) {
+    switch (element_size) {
+    case sizeof(uint16_t):
+        for (Int i = 0; i < count; i++) {
+            ((uint16_t*)data)[i] = NBT_TO_HOST16(((uint16_t*)data)[i]);
+        }
+        break;
+    case sizeof(uint32_t):
+        for (Int i = 0; i < count; i++) {
+            ((uint32_t*)data)[i] = NBT_TO_HOST32(((uint32_t*)data)[i]);
+        }
+        break;
+    case sizeof(uint64_t):
+        for (Int i = 0; i < count; i++) {
+            ((uint64_t*)data)[i] = NBT_TO_HOST64(((uint64_t*)data)[i]);
+        }
+        break;
+    }
+}
+
+/* reads count fixed-size or varint elements into data */
+static bool D(_read_elements)(ParseContext* ctx, enum TAGType type, void* data, Int count) {
+    if (NBT_IS_VARINT_TYPE(type)) {
+        for (Int i = 0; i < count; i++) {
+            if (!D(_parse_primitive)(ctx, type, (char*) data + i * sizeof_type[type])) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (!_read(ctx, data, sizeof_type[type], count)) {
+        return false;
+    }
+    D(_swap_elements)(data, count, sizeof_type[type]);
+    return true;
+}
+
+/* hands an array of length elements to the array callback, a chunk at a time */
+static bool D(_deliver_array)(ParseContext* ctx, Int length, enum TAGType element_type) {
+    const ParseOptions* options = ctx->arrays;
+    Int chunk = options->array_chunk > 0 ? options->array_chunk : 65536;
+    Int capacity = length < chunk ? length : chunk;
+    void* buffer = NULL;
+    if (capacity > 0 && !(buffer = malloc((size_t) capacity * sizeof_type[element_type]))) {
+        return _fail(ctx, PARSE_ERROR_MEMORY);
+    }
+    ArrayChunk piece = {
+        .type = element_type == TAG_Byte ? TAG_Byte_Array : element_type == TAG_Int ? TAG_Int_Array : TAG_Long_Array,
+        .name = ctx->name ? ctx->name : "",
+        .length = length,
+        .data = buffer,
+    };
+    bool ok = true;
+    do {
+        piece.count = length - piece.offset < capacity ? length - piece.offset : capacity;
+        if (!D(_read_elements)(ctx, element_type, buffer, piece.count)) {
+            ok = false;
+            break;
+        }
+        if (!options->array_callback(options->array_userdata, &piece)) {
+            ok = _fail(ctx, PARSE_ERROR_ABORTED);
+            break;
+        }
+        piece.offset += piece.count;
+    } while (piece.offset < length);
+    free(buffer);
+    return ok;
+}
+
+/* reads a length-prefixed array in one allocation */
+static bool D(_parse_array)(ParseContext* ctx, Int* length_out, void** data_out, enum TAGType element_type) {
+    Int length;
+    if (!D(_read_length)(ctx, &length)) {
+        return false;
+    }
+    if (length < 0) {
+        DEBUG_PRINT("Negative array length %d\n", length);
+        return _fail(ctx, PARSE_ERROR_FORMAT);
+    }
+    if (ctx->limits.max_array_length && length > ctx->limits.max_array_length) {
+        return _fail(ctx, PARSE_ERROR_ARRAY_LENGTH);
+    }
+    if (!_check_available(ctx, length, NBT_MIN_PAYLOAD_SIZE[element_type])) {
+        return false;
+    }
+    if (ctx->arrays && length >= ctx->arrays->array_min_length) {
+        *length_out = 0;
+        *data_out = NULL;
+        return D(_deliver_array)(ctx, length, element_type);
+    }
+    void* data = NULL;
+    if (length > 0) {
+        data = _alloc(ctx, length, sizeof_type[element_type]);
+        if (!data) {
+            return false;
+        }
+        if (!D(_read_elements)(ctx, element_type, data, length)) {
+            free(data);
+            return false;
+        }
+    }
+    *length_out = length;
+    *data_out = data;
+    return true;
+}
+
+static bool D(_parse_string)(ParseContext* ctx, String* ret) {
+    uint16_t length;
+    if (!D(_read_string_length)(ctx, &length)) {
+        return false;
+    }
+    if (ctx->limits.max_string_length && length > ctx->limits.max_string_length) {
+        return _fail(ctx, PARSE_ERROR_STRING_LENGTH);
+    }
+    char* str;
+    if (length <= STRING_INLINE_CAPACITY) {
+        str = ret->small;
+    } else {
+        str = (char*) _alloc(ctx, length + 1, sizeof(char));
+        if (!str) {
+            return false;
+        }
+    }
+    if (length && !_read(ctx, str, sizeof(char), length)) {
+        if (length > STRING_INLINE_CAPACITY) {
+            free(str);
+        }
+        return false;
+    }
+    str[length] = '\0';
+#ifdef NBT_MUTF8
+    if (ctx->strings != STRINGS_RAW && length) {
+        size_t converted = ctx->strings == STRINGS_UTF8 ? mutf8_to_utf8(str, length, str)
+                         : mutf8_validate(str, length) ? length : MUTF8_INVALID;
+        if (converted == MUTF8_INVALID) {
+            if (length > STRING_INLINE_CAPACITY) {
+                free(str);
+            }
+            return _fail(ctx, PARSE_ERROR_ENCODING);
+        }
+        str[converted] = '\0';
+        if (length > STRING_INLINE_CAPACITY && converted <= STRING_INLINE_CAPACITY) {
+            // shrank enough to move inside the struct
+            memcpy(ret->small, str, converted + 1);
+            free(str);
+            _refund(ctx, length + 1);
+            ret->length = (uint16_t) converted;
+            return true;
+        }
+        length = (uint16_t) converted;
+    }
+#endif
+    if (length > STRING_INLINE_CAPACITY) {
+        ret->heap = str;
+    }
+    ret->length = length;
+    return true;
+}
+
+static bool D(_parse_compound)(ParseContext* ctx, Compound* ret);
+
+/* a list of compounds, each moved into the columns as soon as it is parsed */
+static bool D(_parse_columnar)(ParseContext* ctx, List* ret, Int length) {
+    if (++ctx->depth > ctx->limits.max_depth) {
+        return _fail(ctx, PARSE_ERROR_DEPTH);
+    }
+    ColumnarList* columns = (ColumnarList*) _alloc(ctx, 1, sizeof(ColumnarList));
+    if (!columns) {
+        return false;
+    }
+    *columns = (ColumnarList){0};
+    ret->columnar = true;
+    ret->length = length; // absent elements are zeroed, so destroying stays safe
+    ret->tags = columns;
+    for (Int i = 0; i < length; i++) {
+        Compound element;
+        bool parsed = D(_parse_compound)(ctx, &element);
+        if (parsed) {
+            // the columns are charged before they are allocated; the element's array is freed
+            size_t allocated, released;
+            if (!ColumnarList_add_cost(columns, length, i, &element, &allocated, &released)) {
+                parsed = _fail(ctx, PARSE_ERROR_MEMORY);
+            } else if (!_charge(ctx, allocated)) {
+                parsed = false;
+            } else if (!ColumnarList_add(columns, length, i, &element)) {
+                _refund(ctx, allocated);
+                parsed = _fail(ctx, PARSE_ERROR_MEMORY);
+            } else {
+                _refund(ctx, released);
+            }
+            if (!parsed) {
+                Compound_destroy(&element);
+            }
+        }
+        if (!parsed) {
+            List_destroy(ret);
+            *ret = (List){ .type = TAG_Compound };
+            return false;
+        }
+    }
+    ctx->depth--;
+    return true;
+}
+
+static bool D(_parse_list)(ParseContext* ctx, List* ret) {
+    Byte type;
+    if (!_read(ctx, &type, sizeof(Byte), 1)) {
+        return false;
+    }
+    Int length;
+    if (!D(_read_length)(ctx, &length)) {
+        return false;
+    }
+    if (length < 0) {
+        DEBUG_PRINT("Negative list length %d\n", length);
+        return _fail(ctx, PARSE_ERROR_FORMAT);
+    }
+    if (type < TAG_End || type > TAG_Long_Array || (type == TAG_End && length > 0)) {
+        DEBUG_PRINT("%d cannot be the type of a list\n", type);
+        return _fail(ctx, PARSE_ERROR_FORMAT);
+    }
+    if (ctx->limits.max_list_length && length > ctx->limits.max_list_length) {
+        return _fail(ctx, PARSE_ERROR_LIST_LENGTH);
+    }
+    if (!_check_available(ctx, length, NBT_MIN_PAYLOAD_SIZE[type])) {
+        return false;
+    }
+
+    *ret = (List){
+        .type = (enum TAGType) type,
+        .length = 0,
+        .tags = NULL,
+    };
+    if (length == 0) {
+        return true;
+    }
+    if (ctx->columnar && type == TAG_Compound) {
+        return D(_parse_columnar)(ctx, ret, length);
+    }
+    void* data = _alloc(ctx, length, sizeof_type[type]);
+    if (!data) {
+        return false;
+    }
+    ret->tags = data;
+
+    if (type >= TAG_Byte && type <= TAG_Double) {
+        // primitives are read as one block where the encoding allows it
+        if (!D(_read_elements)(ctx, (enum TAGType) type, data, length)) {
+            free(data);
+            ret->tags = NULL;
+            return false;
+        }
+        ret->length = length;
+        return true;
+    }
+
+    if (++ctx->depth > ctx->limits.max_depth) {
+        free(data);
+        ret->tags = NULL;
+        return _fail(ctx, PARSE_ERROR_DEPTH);
+    }
+#ifdef NBT_PARALLEL
+    if (ctx->threads > 1 && ctx->buffer && length >= PARALLEL_MIN_ELEMENTS) {
+        if (!_parse_list_parallel(ctx, ret, length)) {
+            free(data);
+            ret->tags = NULL;
+            return false;
+        }
+        ctx->depth--;
+        return true;
+    }
+#endif
+    for (Int i = 0; i < length; i++) {
+        if (!D(_parse_value)(ctx, (enum TAGType) type, (char*) data + i * sizeof_type[type])) {
+            List_destroy(ret); // ret->length only counts the elements parsed so far
+            ret->tags = NULL;
+            return false;
+        }
+        ret->length = i + 1;
+    }
+    ctx->depth--;
+    return true;
+}
+
+static bool D(_parse_named_tag_into)(ParseContext* ctx, NamedTag* ret);
+
+static bool D(_parse_compound)(ParseContext* ctx, Compound* ret) {
+    static const size_t INITIAL_CAPACITY = 8;
+
+    if (++ctx->depth > ctx->limits.max_depth) {
+        return _fail(ctx, PARSE_ERROR_DEPTH);
+    }
+
+    // dynamic array init
+    size_t array_size = 0;
+    size_t array_capacity = INITIAL_CAPACITY;
+    NamedTag* array = (NamedTag*) _alloc(ctx, array_capacity, sizeof(NamedTag));
+    if (!array) {
+        return false;
+    }
+
+    while (1) {
+        if (array_size >= array_capacity) {
+            NamedTag* temp = (NamedTag*) _realloc(ctx, array, array_capacity, array_capacity * 2, sizeof(NamedTag));
+            if (!temp) {
+                goto error;
+            }
+            array = temp;
+            array_capacity *= 2;
+        }
+        // children are parsed in place, no per-tag allocation
+        if (!D(_parse_named_tag_into)(ctx, &array[array_size])) {
+            goto error;
+        }
+        if (array[array_size].type == TAG_End) break;
+        array_size++;
+    }
+
+    if (array_size == 0) {
+        free(array);
+        _refund(ctx, array_capacity * sizeof(NamedTag));
+        array = NULL;
+    } else if (array_size < array_capacity) {
+        NamedTag* temp = (NamedTag*) _realloc(ctx, array, array_capacity, array_size, sizeof(NamedTag));
+        if (temp) {
+            array = temp;
+        }
+    }
+
+    ret->size = array_size;
+    ret->tags = array;
+    ctx->depth--;
+    return true;
+
+    error:
+    for (size_t i = 0; i < array_size; i++) {
+        NamedTag_destroy(&array[i]);
+    }
+    free(array);
+    return false;
+}
+
+/*
+ * Parses a payload of the given type into dest. NamedTag values and list
+ * elements share the same representation, so dest is either the value union
+ * of a NamedTag or a slot of a list.
+ */
+static bool D(_parse_value)(ParseContext* ctx, enum TAGType type, void* dest) {
+    switch (type) {
+    case TAG_Byte:
+    case TAG_Short:
+    case TAG_Int:
+    case TAG_Long:
+    case TAG_Float:
+    case TAG_Double:
+        return D(_parse_primitive)(ctx, type, dest);
+    case TAG_Byte_Array:
+        return D(_parse_array)(ctx, &((Byte_Array*) dest)->length, (void**) &((Byte_Array*) dest)->data, TAG_Byte);
+    case TAG_String:
+        return D(_parse_string)(ctx, (String*) dest);
+    case TAG_List:
+        return D(_parse_list)(ctx, (List*) dest);
+    case TAG_Compound:
+        return D(_parse_compound)(ctx, (Compound*) dest);
+    case TAG_Int_Array:
+        return D(_parse_array)(ctx, &((Int_Array*) dest)->length, (void**) &((Int_Array*) dest)->data, TAG_Int);
+    case TAG_Long_Array:
+        return D(_parse_array)(ctx, &((Long_Array*) dest)->length, (void**) &((Long_Array*) dest)->data, TAG_Long);
+    default:
+        DEBUG_PRINT("Unknown tag type %d\n", type);
+        return _fail(ctx, PARSE_ERROR_FORMAT);
+    }
+}
+
+/* parses a complete tag into ret; a TAG_End has neither name nor payload */
+static bool D(_parse_named_tag_into)(ParseContext* ctx, NamedTag* ret) {
+    Byte type;
+    if (!_read(ctx, &type, sizeof(Byte), 1)) {
+        return false;
+    }
+    *ret = (NamedTag){ .type = (enum TAGType) type };
+    if (type == TAG_End) {
+        return true;
+    }
+    if (!D(_parse_string)(ctx, &ret->name)) {
+        return false;
+    }
+    const char* outer = ctx->name;
+    ctx->name = String_data(&ret->name);
+    bool ok = D(_parse_value)(ctx, ret->type, &ret->byte_value);
+    ctx->name = outer;
+    if (!ok) {
+        String_destroy(&ret->name);
+        return false;
+    }
+    return true;
+}
+
+/* the document root, which network dialects send without a name */
+static bool D(_parse_root)(ParseContext* ctx, NamedTag* ret) {
+#ifdef NBT_NAMELESS_ROOT
+    Byte type;
+    if (!_read(ctx, &type, sizeof(Byte), 1)) {
+        return false;
+    }
+    if (type <= TAG_End || type > TAG_Long_Array) {
+        return _fail(ctx, PARSE_ERROR_FORMAT);
+    }
+    *ret = (NamedTag){ .type = (enum TAGType) type };
+    return D(_parse_value)(ctx, ret->type, &ret->byte_value);
+#else
+    return D(_parse_named_tag_into)(ctx, ret);
+#endif
+}
+
+#undef NBT_IS_VARINT_TYPE
+#undef NBT_MIN_PAYLOAD_SIZE
+#undef NBT_VARINT_ENABLED
+#undef D
+#undef NBT_CAT
+#undef _NBT_CAT
@@ -0,0 +1,733 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_path.h"
+#include "nbt_parse.h"
+#include "nbt_columnar.h"
+#include "nbt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "nbt_endian.h"
+
+/* path parsing */
+
+typedef struct {
+    enum PathSegmentKind kind;
+    char* key;
+    Int first;
+    Int last;
+} _SegmentTemplate;
+
+static void _templates_free(_SegmentTemplate* templates, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(templates[i].key);
+    }
+    free(templates);
+}
+
+static bool _parse_index(const char** cursor, Int* out) {
+    const char* p = *cursor;
+    if (!isdigit((unsigned char) *p)) {
+        return false;
+    }
+    long value = 0;
+    while (isdigit((unsigned char) *p)) {
+        value = value * 10 + (*p - '0');
+        if (value > INT32_MAX) {
+            return false;
+        }
+        p++;
+    }
+    *out = (Int) value;
+    *cursor = p;
+    return true;
+}
+
+static char* _parse_key(const char** cursor) {
+    const char* p = *cursor;
+    const char* start;
+    size_t length;
+    bool quoted = *p == '"';
+    if (quoted) {
+        // \" and \\ stand for " and \ inside the quotes
+        start = ++p;
+        length = 0;
+        while (*p && *p != '"') {
+            if (*p == '\\' && (p[1] == '"' || p[1] == '\\')) {
+                p++;
+            }
+            p++;
+            length++;
+        }
+        if (*p != '"') {
+            return NULL;
+        }
+        p++;
+    } else {
+        start = p;
+        while (*p && *p != '.' && *p != '[') {
+            p++;
+        }
+        length = p - start;
+        if (length == 0) {
+            return NULL;
+        }
+    }
+    char* key = (char*) malloc(length + 1);
+    if (!key) {
+        return NULL;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (quoted && *start == '\\' && (start[1] == '"' || start[1] == '\\')) {
+            start++;
+        }
+        key[i] = *start++;
+    }
+    key[length] = '\0';
+    *cursor = p;
+    return key;
+}
+
+static _SegmentTemplate* _parse_templates(const char* expr, size_t* count) {
+    size_t capacity = 8;
+    size_t size = 0;
+    _SegmentTemplate* templates = (_SegmentTemplate*) calloc(capacity, sizeof(_SegmentTemplate));
+    if (!templates) {
+        return NULL;
+    }
+    const char* p = expr;
+    while (*p) {
+        if (size >= capacity) {
+            capacity *= 2;
+            _SegmentTemplate* temp = (_SegmentTemplate*) realloc(templates, capacity * sizeof(_SegmentTemplate));
+            if (!temp) {
+                goto error;
+            }
+            templates = temp;
+        }
+        _SegmentTemplate* segment = &templates[size];
+        *segment = (_SegmentTemplate){0};
+        if (*p == '[') {
+            p++;
+            if (p[0] == '*' && p[1] == ']') {
+                p += 2;
+                segment->kind = PATH_ANY_INDEX;
+                size++;
+                continue;
+            }
+            segment->kind = PATH_INDEX;
+            if (!_parse_index(&p, &segment->first)) {
+                goto error;
+            }
+            segment->last = segment->first;
+            if (p[0] == '.' && p[1] == '.') {
+                p += 2;
+                if (!_parse_index(&p, &segment->last) || segment->last < segment->first) {
+                    goto error;
+                }
+            }
+            if (*p++ != ']') {
+                goto error;
+            }
+        } else {
+            if (size > 0) {
+                if (*p != '.') {
+                    goto error;
+                }
+                p++;
+            }
+            segment->kind = PATH_KEY;
+            segment->key = _parse_key(&p);
+            if (!segment->key) {
+                goto error;
+            }
+        }
+        size++;
+    }
+    if (size == 0) {
+        goto error;
+    }
+    *count = size;
+    return templates;
+
+    error:
+    _templates_free(templates, size);
+    return NULL;
+}
+
+bool path_key_needs_quotes(const char* key) {
+    return *key == '\0' || strpbrk(key, ".[\"") != NULL;
+}
+
+size_t path_format_key(char* out, const char* key) {
+    if (!path_key_needs_quotes(key)) {
+        size_t length = strlen(key);
+        memcpy(out, key, length + 1);
+        return length;
+    }
+    char* p = out;
+    *p++ = '"';
+    for (; *key; key++) {
+        if (*key == '"' || *key == '\\') {
+            *p++ = '\\';
+        }
+        *p++ = *key;
+    }
+    *p++ = '"';
+    *p = '\0';
+    return p - out;
+}
+
+static char* _format_path(const PathSegment* segments, size_t length) {
+    char* text = NULL;
+    size_t text_length = 0;
+    FILE* out = open_memstream(&text, &text_length);
+    if (!out) {
+        return NULL;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (segments[i].kind == PATH_INDEX) {
+            fprintf(out, "[%d]", segments[i].index);
+        } else if (segments[i].kind == PATH_ANY_INDEX) {
+            fputs("[*]", out);
+        } else {
+            char* key = (char*) malloc(2 * strlen(segments[i].key) + 3);
+            if (!key) {
+                fclose(out);
+                free(text);
+                return NULL;
+            }
+            path_format_key(key, segments[i].key);
+            fprintf(out, "%s%s", i > 0 ? "." : "", key);
+            free(key);
+        }
+    }
+    if (fclose(out) != 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+static bool _append_path(const _SegmentTemplate* templates, size_t length, const Int* indices,
+                         NBTPath** paths, size_t* count) {
+    NBTPath path = {
+        .length = length,
+        .segments = (PathSegment*) calloc(length, sizeof(PathSegment)),
+    };
+    if (!path.segments) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        path.segments[i].kind = templates[i].kind;
+        if (templates[i].kind == PATH_INDEX) {
+            path.segments[i].index = indices[i];
+        } else if (templates[i].kind == PATH_KEY && !(path.segments[i].key = strdup(templates[i].key))) {
+            NBTPath_destroy(&path);
+            return false;
+        }
+    }
+    path.text = _format_path(path.segments, length);
+    if (!path.text) {
+        NBTPath_destroy(&path);
+        return false;
+    }
+    // path_parse() made room for every path beforehand
+    (*paths)[(*count)++] = path;
+    return true;
+}
+
+// appends one path per combination of the indices in every range
+static bool _expand(const _SegmentTemplate* templates, size_t length, size_t position, Int* indices,
+                    NBTPath** paths, size_t* count) {
+    if (position == length) {
+        return _append_path(templates, length, indices, paths, count);
+    }
+    if (templates[position].kind != PATH_INDEX) {
+        return _expand(templates, length, position + 1, indices, paths, count);
+    }
+    // stops on last rather than past it, which may be INT32_MAX
+    for (Int i = templates[position].first;; i++) {
+        indices[position] = i;
+        if (!_expand(templates, length, position + 1, indices, paths, count)) {
+            return false;
+        }
+        if (i == templates[position].last) {
+            return true;
+        }
+    }
+}
+
+// how many paths the ranges expand to, or PATH_MAX_EXPANSION + 1 if more than that
+static size_t _expansion(const _SegmentTemplate* templates, size_t length) {
+    size_t total = 1;
+    for (size_t i = 0; i < length; i++) {
+        if (templates[i].kind == PATH_INDEX) {
+            size_t span = (size_t) templates[i].last - (size_t) templates[i].first + 1;
+            if (span > PATH_MAX_EXPANSION / total) {
+                return PATH_MAX_EXPANSION + 1;
+            }
+            total *= span;
+        }
+    }
+    return total;
+}
+
+size_t path_count(const char* expr) {
+    size_t length;
+    _SegmentTemplate* templates = _parse_templates(expr, &length);
+    if (!templates) {
+        return 0;
+    }
+    size_t total = _expansion(templates, length);
+    _templates_free(templates, length);
+    return total;
+}
+
+size_t path_parse(const char* expr, NBTPath** paths, size_t* count) {
+    size_t length;
+    _SegmentTemplate* templates = _parse_templates(expr, &length);
+    if (!templates) {
+        fprintf(stderr, "Invalid path \"%s\"\n", expr);
+        return 0;
+    }
+    size_t total = _expansion(templates, length);
+    if (total > PATH_MAX_EXPANSION) {
+        fprintf(stderr, "Path \"%s\" expands to more than %d paths\n", expr, PATH_MAX_EXPANSION);
+        _templates_free(templates, length);
+        return 0;
+    }
+    NBTPath* temp = (NBTPath*) realloc(*paths, (*count + total) * sizeof(NBTPath));
+    if (!temp) {
+        _templates_free(templates, length);
+        return 0;
+    }
+    *paths = temp;
+    size_t before = *count;
+    Int* indices = (Int*) calloc(length, sizeof(Int));
+    bool ok = indices && _expand(templates, length, 0, indices, paths, count);
+    free(indices);
+    _templates_free(templates, length);
+    if (!ok) {
+        while (*count > before) {
+            NBTPath_destroy(&(*paths)[--(*count)]);
+        }
+        return 0;
+    }
+    return *count - before;
+}
+
+void NBTPath_destroy(NBTPath* path) {
+    for (size_t i = 0; i < path->length; i++) {
+        if (path->segments[i].kind == PATH_KEY) {
+            free(path->segments[i].key);
+        }
+    }
+    free(path->segments);
+    free(path->text);
+}
+
+/* lookups in trees */
+
+/* elements of a columnar list have no Compound of their own, but their keys are in the columns */
+static void* _columnar_child(List* list, Int index, const PathSegment* segment, enum TAGType* type) {
+    if (!segment || segment->kind != PATH_KEY || index >= list->length) {
+        return NULL;
+    }
+    ColumnarList* columns = (ColumnarList*) list->tags;
+    size_t length = strlen(segment->key);
+    for (Int k = 0; k < columns->width; k++) {
+        const String* key = &columns->keys[k];
+        if (key->length == length && memcmp(String_data(key), segment->key, length) == 0
+                && Column_has(columns->present[k], index)) {
+            *type = columns->types[k];
+            return (char*) columns->columns[k] + (size_t) index * sizeof_type[columns->types[k]];
+        }
+    }
+    NamedTag* child = columns->irregular ? Compound_find(&columns->irregular[index], segment->key) : NULL;
+    if (!child) {
+        return NULL;
+    }
+    *type = child->type;
+    return &child->byte_value;
+}
+
+void* path_resolve(NamedTag* root, const NBTPath* path, enum TAGType* type) {
+    enum TAGType current = root->type;
+    void* value = &root->byte_value;
+    for (size_t i = 0; i < path->length; i++) {
+        const PathSegment* segment = &path->segments[i];
+        if (segment->kind == PATH_KEY) {
+            if (current != TAG_Compound) {
+                return NULL;
+            }
+            NamedTag* child = Compound_find((Compound*) value, segment->key);
+            if (!child) {
+                return NULL;
+            }
+            current = child->type;
+            value = &child->byte_value;
+            continue;
+        }
+        if (segment->kind != PATH_INDEX) {
+            return NULL;
+        }
+        Int length;
+        void* elements;
+        enum TAGType element_type;
+        switch (current) {
+        case TAG_List:
+            if (((List*) value)->columnar) {
+                const PathSegment* next = i + 1 < path->length ? &path->segments[i + 1] : NULL;
+                if (!(value = _columnar_child((List*) value, segment->index, next, &current))) {
+                    return NULL;
+                }
+                i++; // the key was taken as well
+                continue;
+            }
+            length = ((List*) value)->length;
+            elements = ((List*) value)->tags;
+            element_type = ((List*) value)->type;
+            break;
+        case TAG_Byte_Array:
+        case TAG_Int_Array:
+        case TAG_Long_Array:
+            // all three share a layout
+            length = ((Byte_Array*) value)->length;
+            elements = ((Byte_Array*) value)->data;
+            element_type = current == TAG_Byte_Array ? TAG_Byte : current == TAG_Int_Array ? TAG_Int : TAG_Long;
+            break;
+        default:
+            return NULL;
+        }
+        if (segment->index >= length) {
+            return NULL;
+        }
+        current = element_type;
+        value = (char*) elements + (size_t) segment->index * sizeof_type[element_type];
+    }
+    *type = current;
+    return value;
+}
+
+/* streaming matcher */
+
+typedef struct {
+    FILE* file;
+    const NBTPath* paths;
+    size_t count;
+    PathCallback callback;
+    void* userdata;
+    // with until_passed, the walk ends once no path can match anything further on
+    bool until_passed;
+    size_t unpassed;
+    bool* passed;
+    size_t* fixed; // segments before each path's first [*]
+    // path index lists for each level down to the longest path: deeper, then sub
+    size_t* scratch;
+    char name[UINT16_MAX + 1];
+    char string[UINT16_MAX + 1];
+} _Walk;
+
+enum { SCRATCH_DEEPER, SCRATCH_SUB, SCRATCH_LISTS };
+
+/* only called while some path is active, so depth is short of the longest path */
+static size_t* _scratch(_Walk* walk, size_t depth, int list) {
+    return walk->scratch + (depth * SCRATCH_LISTS + list) * (walk->count ? walk->count : 1);
+}
+
+static bool _read_string(FILE* file, char* buffer, uint16_t* length) {
+    uint16_t value;
+    if (!fread(&value, sizeof(value), 1, file)) {
+        return false;
+    }
+    value = be16toh(value);
+    if (value && fread(buffer, 1, value, file) != value) {
+        return false;
+    }
+    buffer[value] = '\0';
+    *length = value;
+    return true;
+}
+
+static bool _read_scalar(_Walk* walk, enum TAGType type, PathValue* value) {
+    FILE* file = walk->file;
+    value->type = type;
+    switch (type) {
+    case TAG_Byte:
+    {
+        Byte v;
+        if (!fread(&v, sizeof(v), 1, file)) {
+            return false;
+        }
+        value->integer = v;
+        return true;
+    }
+    case TAG_Short:
+    {
+        uint16_t v;
+        if (!fread(&v, sizeof(v), 1, file)) {
+            return false;
+        }
+        value->integer = (Short) be16toh(v);
+        return true;
+    }
+    case TAG_Int:
+    case TAG_Float:
+    {
+        uint32_t v;
+        if (!fread(&v, sizeof(v), 1, file)) {
+            return false;
+        }
+        v = be32toh(v);
+        if (type == TAG_Int) {
+            value->integer = (Int) v;
+        } else {
+            Float f;
+            memcpy(&f, &v, sizeof(f));
+            value->real = f;
+        }
+        return true;
+    }
+    case TAG_Long:
+    case TAG_Double:
+    {
+        uint64_t v;
+        if (!fread(&v, sizeof(v), 1, file)) {
+            return false;
+        }
+        v = be64toh(v);
+        if (type == TAG_Long) {
+            value->integer = (Long) v;
+        } else {
+            memcpy(&value->real, &v, sizeof(Double));
+        }
+        return true;
+    }
+    case TAG_String:
+        value->string.data = walk->string;
+        return _read_string(file, walk->string, &value->string.length);
+    default:
+        return false;
+    }
+}
+
+static int _walk_payload(_Walk* walk, enum TAGType type, size_t depth, const size_t* active, size_t active_count);
+
+// walks count elements of the given type, descending into those an index segment asks for
+static int _walk_elements(_Walk* walk, enum TAGType type, Int length, size_t depth,
+                          const size_t* active, size_t active_count) {
+    size_t* sub = _scratch(walk, depth, SCRATCH_SUB);
+    Int skipped = 0;
+    for (Int i = 0; i < length; i++) {
+        size_t sub_count = 0;
+        for (size_t j = 0; j < active_count; j++) {
+            const PathSegment* segment = &walk->paths[active[j]].segments[depth];
+            if ((segment->kind == PATH_INDEX && segment->index == i) || segment->kind == PATH_ANY_INDEX) {
+                sub[sub_count++] = active[j];
+            }
+        }
+        if (sub_count == 0) {
+            skipped++;
+            continue;
+        }
+        if (!skip_elements(walk->file, type, skipped)) {
+            return -1;
+        }
+        skipped = 0;
+        int ret = _walk_payload(walk, type, depth + 1, sub, sub_count);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    return skip_elements(walk->file, type, skipped) ? 0 : -1;
+}
+
+/*
+ * Once the payload a path was active in is over, a path with no [*] up to
+ * there cannot match anywhere else. Returns true when that leaves none.
+ */
+static bool _passed(_Walk* walk, size_t depth, const size_t* active, size_t active_count) {
+    for (size_t i = 0; i < active_count; i++) {
+        if (!walk->passed[active[i]] && depth <= walk->fixed[active[i]]) {
+            walk->passed[active[i]] = true;
+            walk->unpassed--;
+        }
+    }
+    return walk->unpassed == 0;
+}
+
+static int _walk_value(_Walk* walk, enum TAGType type, size_t depth, const size_t* active, size_t active_count);
+
+static int _walk_payload(_Walk* walk, enum TAGType type, size_t depth, const size_t* active, size_t active_count) {
+    int ret = _walk_value(walk, type, depth, active, active_count);
+    if (ret == 0 && walk->until_passed && active_count > 0 && _passed(walk, depth, active, active_count)) {
+        return 1;
+    }
+    return ret;
+}
+
+static int _walk_value(_Walk* walk, enum TAGType type, size_t depth, const size_t* active, size_t active_count) {
+    if (depth > NBT_MAX_DEPTH) {
+        return -1;
+    }
+    if (active_count == 0) {
+        return skip_payload(walk->file, type) ? 0 : -1;
+    }
+
+    // report to the paths that end here, keep the ones that go deeper
+    size_t* deeper = _scratch(walk, depth, SCRATCH_DEEPER);
+    size_t deeper_count = 0;
+    bool scalar = type != TAG_Byte_Array && type != TAG_List && type != TAG_Compound
+               && type != TAG_Int_Array && type != TAG_Long_Array;
+    PathValue value = { .type = type };
+    if (scalar && !_read_scalar(walk, type, &value)) {
+        return -1;
+    }
+    for (size_t i = 0; i < active_count; i++) {
+        if (walk->paths[active[i]].length == depth) {
+            if (walk->callback(walk->userdata, active[i], &value)) {
+                return 1;
+            }
+        } else {
+            deeper[deeper_count++] = active[i];
+        }
+    }
+    if (scalar) {
+        return 0;
+    }
+    if (deeper_count == 0) {
+        return skip_payload(walk->file, type) ? 0 : -1;
+    }
+
+    FILE* file = walk->file;
+    switch (type) {
+    case TAG_Byte_Array:
+    case TAG_Int_Array:
+    case TAG_Long_Array:
+    {
+        Int length;
+        if (!fread(&length, sizeof(Int), 1, file)) {
+            return -1;
+        }
+        length = be32toh(length);
+        if (length < 0) {
+            return -1;
+        }
+        enum TAGType element_type = type == TAG_Byte_Array ? TAG_Byte : type == TAG_Int_Array ? TAG_Int : TAG_Long;
+        return _walk_elements(walk, element_type, length, depth, deeper, deeper_count);
+    }
+    case TAG_List:
+    {
+        Byte element_type;
+        Int length;
+        if (!fread(&element_type, sizeof(Byte), 1, file) || !fread(&length, sizeof(Int), 1, file)) {
+            return -1;
+        }
+        length = be32toh(length);
+        if (length < 0 || element_type < TAG_End || element_type > TAG_Long_Array) {
+            return -1;
+        }
+        return _walk_elements(walk, (enum TAGType) element_type, length, depth, deeper, deeper_count);
+    }
+    case TAG_Compound:
+        while (1) {
+            Byte child_type;
+            uint16_t name_length;
+            if (!fread(&child_type, sizeof(Byte), 1, file)) {
+                return -1;
+            }
+            if (child_type == TAG_End) {
+                return 0;
+            }
+            if (child_type < TAG_End || child_type > TAG_Long_Array) {
+                return -1;
+            }
+            if (!_read_string(file, walk->name, &name_length)) {
+                return -1;
+            }
+            size_t* sub = _scratch(walk, depth, SCRATCH_SUB);
+            size_t sub_count = 0;
+            for (size_t i = 0; i < deeper_count; i++) {
+                const PathSegment* segment = &walk->paths[deeper[i]].segments[depth];
+                if (segment->kind == PATH_KEY && strcmp(segment->key, walk->name) == 0) {
+                    sub[sub_count++] = deeper[i];
+                }
+            }
+            int ret = _walk_payload(walk, (enum TAGType) child_type, depth + 1, sub, sub_count);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+    default:
+        return -1;
+    }
+}
+
+static int _match(FILE* file, const NBTPath* paths, size_t count, PathCallback callback, void* userdata,
+                  bool until_passed) {
+    Byte type;
+    if (!fread(&type, sizeof(Byte), 1, file)) {
+        return -1;
+    }
+    if (type <= TAG_End || type > TAG_Long_Array) {
+        return -1;
+    }
+    _Walk* walk = (_Walk*) malloc(sizeof(_Walk));
+    if (!walk) {
+        return -1;
+    }
+    walk->file = file;
+    walk->paths = paths;
+    walk->count = count;
+    walk->callback = callback;
+    walk->userdata = userdata;
+    walk->until_passed = until_passed;
+    walk->unpassed = count;
+
+    size_t levels = 1;
+    for (size_t i = 0; i < count; i++) {
+        if (paths[i].length + 1 > levels) {
+            levels = paths[i].length + 1;
+        }
+    }
+    // one more list holds the paths active at the root
+    size_t width = count ? count : 1;
+    walk->scratch = (size_t*) malloc((levels * SCRATCH_LISTS + 1) * width * sizeof(size_t));
+    walk->passed = until_passed ? (bool*) calloc(width, sizeof(bool)) : NULL;
+    walk->fixed = until_passed ? (size_t*) malloc(width * sizeof(size_t)) : NULL;
+
+    int ret = -1;
+    uint16_t name_length;
+    if (walk->scratch && (!until_passed || (walk->passed && walk->fixed))
+            && _read_string(file, walk->name, &name_length)) {
+        for (size_t i = 0; until_passed && i < count; i++) {
+            size_t j = 0;
+            while (j < paths[i].length && paths[i].segments[j].kind != PATH_ANY_INDEX) {
+                j++;
+            }
+            walk->fixed[i] = j;
+        }
+        size_t* active = walk->scratch + levels * SCRATCH_LISTS * width;
+        for (size_t i = 0; i < count; i++) {
+            active[i] = i;
+        }
+        ret = _walk_payload(walk, (enum TAGType) type, 0, active, count);
+    }
+    free(walk->scratch);
+    free(walk->passed);
+    free(walk->fixed);
+    free(walk);
+    return ret;
+}
+
+int path_match_stream(FILE* file, const NBTPath* paths, size_t count, PathCallback callback, void* userdata) {
+    return _match(file, paths, count, callback, userdata, false);
+}
+
+int path_match_until_passed(FILE* file, const NBTPath* paths, size_t count, PathCallback callback, void* userdata) {
+    return _match(file, paths, count, callback, userdata, true);
+}
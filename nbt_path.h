@@ -0,0 +1,92 @@
+#ifndef NBT_PATH_H
+#define NBT_PATH_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "nbt.h"
+
+/*
+ * Paths address values below the root tag of a document, e.g.
+ *   Health
+ *   Pos[1]
+ *   Level.Sections[3].Y
+ * A range such as Pos[0..2] expands into one path per index, while
+ * Entities[*].id matches every element of Entities. A key may be written in
+ * double quotes, e.g. "minecraft:a.b", with \" and \\ for " and \.
+ */
+
+// path_parse() fails on an expression whose ranges make more paths than this
+#define PATH_MAX_EXPANSION 65536
+
+enum PathSegmentKind {
+    PATH_KEY,
+    PATH_INDEX,
+    PATH_ANY_INDEX
+};
+
+typedef struct PathSegment {
+    enum PathSegmentKind kind;
+    union {
+        char* key;
+        Int index;
+    };
+} PathSegment;
+
+typedef struct NBTPath {
+    char* text; // canonical form, e.g. "Pos[0]"
+    size_t length;
+    PathSegment* segments;
+} NBTPath;
+
+/* a scalar found at the end of a path; containers only report their type */
+typedef struct PathValue {
+    enum TAGType type;
+    union {
+        Long integer;
+        Double real;
+        struct {
+            const char* data;
+            uint16_t length;
+        } string;
+    };
+} PathValue;
+
+/* return nonzero to stop the walk early */
+typedef int (*PathCallback)(void* userdata, size_t path_index, const PathValue* value);
+
+/* parses expr, appending the resulting paths to *paths; returns how many were added, 0 on error */
+size_t path_parse(const char* expr, NBTPath** paths, size_t* count);
+void NBTPath_destroy(NBTPath*);
+/* how many paths path_parse() would make of expr, without making them; 0 if it is invalid */
+size_t path_count(const char* expr);
+/* keys containing '.', '[' or '"' are written in double quotes */
+bool path_key_needs_quotes(const char*);
+/*
+ * Writes key as it appears in a path, quoted and escaped if need be, to out,
+ * which must hold 2 * strlen(key) + 3 bytes; returns the length written.
+ */
+size_t path_format_key(char* out, const char* key);
+
+/*
+ * Finds what a path without [*] points to in a tree and returns its payload,
+ * in the representation write_payload() takes, or NULL if there is none.
+ * Array elements come back as their element type. An element of a columnar
+ * list cannot be returned, only what is inside it, e.g. Items[0].id.
+ */
+void* path_resolve(NamedTag* root, const NBTPath*, enum TAGType* type);
+
+/*
+ * Reads one document from file and reports every value whose location matches
+ * one of the paths. Subtrees that no path can match are skipped unread.
+ * Returns 0 when the whole document was consumed, 1 when the callback stopped
+ * the walk and -1 on malformed or truncated input.
+ */
+int path_match_stream(FILE* file, const NBTPath* paths, size_t count, PathCallback callback, void* userdata);
+
+/*
+ * The same, but returns 1 as soon as the walk is past every place a path can
+ * match, leaving the file partway through the document.
+ */
+int path_match_until_passed(FILE* file, const NBTPath* paths, size_t count, PathCallback callback, void* userdata);
+
+#endif // NBT_PATH_H
@@ -0,0 +1,188 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_reclaim.h"
+#include "nbt.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct Deferred {
+    NamedTag* tag;
+    size_t bytes;
+} Deferred;
+
+// slots are reused, so deferring rarely allocates and never contends with the
+// worker's frees for the allocator
+#define INITIAL_CAPACITY 64
+
+struct Reclaimer {
+    pthread_mutex_t lock;
+    pthread_cond_t work; // something was queued, or stopping
+    pthread_cond_t idle; // depth dropped to 0
+    pthread_t thread;
+    bool threaded;
+    bool immediate; // a thread was asked for but could not be started
+    bool stopping;
+
+    Deferred* ring;
+    size_t capacity;
+    size_t head; // oldest queued tree; stats.depth counts the ones being freed too
+    size_t count;
+
+    ReclaimStats stats;
+};
+
+/* called with the lock held */
+static bool _pop(Reclaimer* reclaimer, Deferred* item) {
+    if (reclaimer->count == 0) {
+        return false;
+    }
+    *item = reclaimer->ring[reclaimer->head];
+    reclaimer->head = (reclaimer->head + 1) % reclaimer->capacity;
+    reclaimer->count--;
+    return true;
+}
+
+/* called with the lock held */
+static bool _push(Reclaimer* reclaimer, NamedTag* tag, size_t bytes) {
+    if (reclaimer->count == reclaimer->capacity) {
+        size_t capacity = reclaimer->capacity ? reclaimer->capacity * 2 : INITIAL_CAPACITY;
+        Deferred* ring = (Deferred*) malloc(capacity * sizeof(Deferred));
+        if (!ring) {
+            return false;
+        }
+        for (size_t i = 0; i < reclaimer->count; i++) {
+            ring[i] = reclaimer->ring[(reclaimer->head + i) % reclaimer->capacity];
+        }
+        free(reclaimer->ring);
+        reclaimer->ring = ring;
+        reclaimer->capacity = capacity;
+        reclaimer->head = 0;
+    }
+    reclaimer->ring[(reclaimer->head + reclaimer->count) % reclaimer->capacity] = (Deferred){ tag, bytes };
+    reclaimer->count++;
+    return true;
+}
+
+/* called with the lock held, after the tree has gone */
+static void _freed(Reclaimer* reclaimer, size_t bytes) {
+    reclaimer->stats.depth--;
+    reclaimer->stats.bytes_pending -= bytes;
+    reclaimer->stats.freed++;
+    reclaimer->stats.bytes_freed += bytes;
+    if (reclaimer->stats.depth == 0) {
+        pthread_cond_broadcast(&reclaimer->idle);
+    }
+}
+
+static void* _reclaim_worker(void* arg) {
+    Reclaimer* reclaimer = (Reclaimer*) arg;
+    pthread_mutex_lock(&reclaimer->lock);
+    while (1) {
+        Deferred item;
+        if (!_pop(reclaimer, &item)) {
+            if (reclaimer->stopping) {
+                break;
+            }
+            pthread_cond_wait(&reclaimer->work, &reclaimer->lock);
+            continue;
+        }
+        // the walk happens outside the lock so deferring never waits on it
+        pthread_mutex_unlock(&reclaimer->lock);
+        NamedTag_free(item.tag);
+        pthread_mutex_lock(&reclaimer->lock);
+        _freed(reclaimer, item.bytes);
+    }
+    pthread_mutex_unlock(&reclaimer->lock);
+    return NULL;
+}
+
+Reclaimer* Reclaimer_new(bool background) {
+    Reclaimer* reclaimer = (Reclaimer*) calloc(1, sizeof(Reclaimer));
+    if (!reclaimer) {
+        return NULL;
+    }
+    pthread_mutex_init(&reclaimer->lock, NULL);
+    pthread_cond_init(&reclaimer->work, NULL);
+    pthread_cond_init(&reclaimer->idle, NULL);
+    if (background) {
+        reclaimer->threaded = pthread_create(&reclaimer->thread, NULL, _reclaim_worker, reclaimer) == 0;
+        reclaimer->immediate = !reclaimer->threaded;
+    }
+    return reclaimer;
+}
+
+void Reclaimer_free(Reclaimer* reclaimer) {
+    if (!reclaimer) {
+        return;
+    }
+    pthread_mutex_lock(&reclaimer->lock);
+    reclaimer->stopping = true;
+    pthread_cond_signal(&reclaimer->work);
+    pthread_mutex_unlock(&reclaimer->lock);
+    if (reclaimer->threaded) {
+        pthread_join(reclaimer->thread, NULL); // the worker empties the queue first
+    }
+    Reclaimer_drain(reclaimer, 0);
+    free(reclaimer->ring);
+    pthread_cond_destroy(&reclaimer->idle);
+    pthread_cond_destroy(&reclaimer->work);
+    pthread_mutex_destroy(&reclaimer->lock);
+    free(reclaimer);
+}
+
+void Reclaimer_defer(Reclaimer* reclaimer, NamedTag* tag, size_t bytes) {
+    if (!tag) {
+        return;
+    }
+    pthread_mutex_lock(&reclaimer->lock);
+    if (reclaimer->immediate || !_push(reclaimer, tag, bytes)) {
+        reclaimer->stats.deferred++;
+        reclaimer->stats.freed++;
+        reclaimer->stats.bytes_freed += bytes;
+        pthread_mutex_unlock(&reclaimer->lock);
+        NamedTag_free(tag);
+        return;
+    }
+    reclaimer->stats.depth++;
+    reclaimer->stats.bytes_pending += bytes;
+    reclaimer->stats.deferred++;
+    if (reclaimer->threaded) {
+        pthread_cond_signal(&reclaimer->work);
+    }
+    pthread_mutex_unlock(&reclaimer->lock);
+}
+
+size_t Reclaimer_drain(Reclaimer* reclaimer, size_t max_trees) {
+    size_t count = 0;
+    pthread_mutex_lock(&reclaimer->lock);
+    Deferred item;
+    while ((max_trees == 0 || count < max_trees) && _pop(reclaimer, &item)) {
+        pthread_mutex_unlock(&reclaimer->lock);
+        NamedTag_free(item.tag);
+        pthread_mutex_lock(&reclaimer->lock);
+        _freed(reclaimer, item.bytes);
+        count++;
+    }
+    pthread_mutex_unlock(&reclaimer->lock);
+    return count;
+}
+
+void Reclaimer_wait(Reclaimer* reclaimer) {
+    if (!reclaimer->threaded) {
+        Reclaimer_drain(reclaimer, 0);
+        return;
+    }
+    pthread_mutex_lock(&reclaimer->lock);
+    while (reclaimer->stats.depth > 0) {
+        pthread_cond_wait(&reclaimer->idle, &reclaimer->lock);
+    }
+    pthread_mutex_unlock(&reclaimer->lock);
+}
+
+ReclaimStats Reclaimer_stats(Reclaimer* reclaimer) {
+    pthread_mutex_lock(&reclaimer->lock);
+    ReclaimStats stats = reclaimer->stats;
+    pthread_mutex_unlock(&reclaimer->lock);
+    return stats;
+}
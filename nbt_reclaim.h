@@ -0,0 +1,48 @@
+#ifndef NBT_RECLAIM_H
+#define NBT_RECLAIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nbt.h"
+
+/*
+ * Deferred freeing of trees, so that dropping a large chunk or entity tree
+ * costs the caller a queue push rather than a walk over every node.
+ *
+ * A background Reclaimer frees queued trees on its own thread, one at a
+ * time, as they arrive. Otherwise trees wait in the queue until the owner
+ * calls Reclaimer_drain(), e.g. a few at the end of each tick. Either way
+ * trees are freed in the order they were deferred, and Reclaimer_free()
+ * frees whatever is left.
+ */
+
+typedef struct Reclaimer Reclaimer;
+
+typedef struct ReclaimStats {
+    size_t depth;         // trees deferred and not yet freed
+    size_t bytes_pending; // sum of their sizes as given to Reclaimer_defer()
+    uint64_t deferred;
+    uint64_t freed;
+    uint64_t bytes_freed;
+} ReclaimStats;
+
+/* if the thread cannot be started, deferred trees are freed straight away */
+Reclaimer* Reclaimer_new(bool background);
+void Reclaimer_free(Reclaimer*);
+
+/*
+ * Takes ownership of tag, as from parse_named_tag(); NULL is ignored. bytes
+ * only feeds the counters: ParseResult.bytes_allocated, or 0 if not known.
+ */
+void Reclaimer_defer(Reclaimer*, NamedTag* tag, size_t bytes);
+
+/* frees up to max_trees queued trees, 0 for all, on the calling thread; returns how many */
+size_t Reclaimer_drain(Reclaimer*, size_t max_trees);
+
+/* returns once everything deferred so far has been freed */
+void Reclaimer_wait(Reclaimer*);
+
+ReclaimStats Reclaimer_stats(Reclaimer*);
+
+#endif // NBT_RECLAIM_H
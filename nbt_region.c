@@ -0,0 +1,605 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_region.h"
+#include "nbt_write.h"
+#include "nbt_load.h"
+#include "nbt_parse.h"
+#include "nbt_replace.h"
+#include "nbt.h"
+#include "zpipe.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "nbt_endian.h"
+
+#define HEADER_SECTORS 2
+#define MAX_CHUNK_SECTORS 255
+#define EXTERNAL_FLAG 0x80
+
+static const int DEFAULT_THREADS = 4;
+
+struct RegionFile {
+    int fd;
+    char* directory;
+    int region_x;
+    int region_z;
+    uint32_t locations[REGION_CHUNKS]; // sector offset << 8 | sector count
+    uint32_t timestamps[REGION_CHUNKS];
+    unsigned char* used;               // one byte per sector
+    size_t sector_count;               // sectors in the file
+    size_t used_capacity;
+};
+
+static int _chunk_index(int x, int z) {
+    if (x < 0 || x > 31 || z < 0 || z > 31) {
+        return -1;
+    }
+    return x + z * 32;
+}
+
+static bool _read_all(int fd, void* data, size_t length, off_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd, (char*) data + done, length - done, offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+static bool _write_all(int fd, const void* data, size_t length, off_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pwrite(fd, (const char*) data + done, length - done, offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+/* marks sectors [first, first + count) as used or free, growing the map as needed */
+static bool _mark(RegionFile* region, size_t first, size_t count, bool used) {
+    if (first + count > region->used_capacity) {
+        size_t capacity = region->used_capacity ? region->used_capacity : 64;
+        while (capacity < first + count) {
+            capacity *= 2;
+        }
+        unsigned char* temp = (unsigned char*) realloc(region->used, capacity);
+        if (!temp) {
+            return false;
+        }
+        memset(temp + region->used_capacity, 0, capacity - region->used_capacity);
+        region->used = temp;
+        region->used_capacity = capacity;
+    }
+    memset(region->used + first, used, count);
+    if (used && first + count > region->sector_count) {
+        region->sector_count = first + count;
+    }
+    return true;
+}
+
+/* first run of count free sectors; the file grows when there is none */
+static size_t _find_free(const RegionFile* region, size_t count) {
+    size_t run = 0;
+    for (size_t i = HEADER_SECTORS; i < region->sector_count; i++) {
+        run = region->used[i] ? 0 : run + 1;
+        if (run == count) {
+            return i + 1 - count;
+        }
+    }
+    return region->sector_count - run;
+}
+
+static bool _write_header(RegionFile* region) {
+    uint32_t header[2 * REGION_CHUNKS];
+    for (int i = 0; i < REGION_CHUNKS; i++) {
+        header[i] = htobe32(region->locations[i]);
+        header[REGION_CHUNKS + i] = htobe32(region->timestamps[i]);
+    }
+    return _write_all(region->fd, header, sizeof(header), 0);
+}
+
+RegionFile* RegionFile_open(const char* path, bool create) {
+    int fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644);
+    if (fd == -1 && !create && (errno == EACCES || errno == EROFS)) {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd == -1) {
+        return NULL;
+    }
+    RegionFile* region = (RegionFile*) calloc(1, sizeof(RegionFile));
+    char* copy = strdup(path);
+    if (!region || !copy) {
+        free(region);
+        free(copy);
+        close(fd);
+        return NULL;
+    }
+    region->fd = fd;
+    region->directory = strdup(dirname(copy));
+    const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    if (sscanf(name, "r.%d.%d.mca", &region->region_x, &region->region_z) != 2) {
+        region->region_x = region->region_z = 0;
+    }
+    free(copy);
+
+    struct stat st;
+    if (!region->directory || fstat(fd, &st) != 0) {
+        RegionFile_close(region);
+        return NULL;
+    }
+    if (st.st_size == 0) {
+        if (!_write_header(region)) {
+            RegionFile_close(region);
+            return NULL;
+        }
+    } else {
+        uint32_t header[2 * REGION_CHUNKS];
+        if (st.st_size < (off_t) sizeof(header) || !_read_all(fd, header, sizeof(header), 0)) {
+            fprintf(stderr, "%s is not a region file\n", path);
+            RegionFile_close(region);
+            return NULL;
+        }
+        for (int i = 0; i < REGION_CHUNKS; i++) {
+            region->locations[i] = be32toh(header[i]);
+            region->timestamps[i] = be32toh(header[REGION_CHUNKS + i]);
+        }
+    }
+
+    size_t sectors = (st.st_size + REGION_SECTOR_SIZE - 1) / REGION_SECTOR_SIZE;
+    if (!_mark(region, 0, HEADER_SECTORS, true)
+            || (sectors > HEADER_SECTORS && !_mark(region, HEADER_SECTORS, sectors - HEADER_SECTORS, false))) {
+        RegionFile_close(region);
+        return NULL;
+    }
+    region->sector_count = sectors > HEADER_SECTORS ? sectors : HEADER_SECTORS;
+    for (int i = 0; i < REGION_CHUNKS; i++) {
+        size_t offset = region->locations[i] >> 8;
+        size_t count = region->locations[i] & 0xFF;
+        if (count > 0 && offset >= HEADER_SECTORS && offset + count <= region->sector_count) {
+            memset(region->used + offset, 1, count);
+        } else if (region->locations[i]) {
+            // empty or points outside the file; forget it rather than trip over it later
+            region->locations[i] = 0;
+        }
+    }
+    return region;
+}
+
+void RegionFile_close(RegionFile* region) {
+    if (!region) {
+        return;
+    }
+    close(region->fd);
+    free(region->used);
+    free(region->directory);
+    free(region);
+}
+
+bool RegionFile_has_chunk(const RegionFile* region, int x, int z) {
+    int i = _chunk_index(x, z);
+    return i >= 0 && region->locations[i] != 0;
+}
+
+uint32_t RegionFile_timestamp(const RegionFile* region, int x, int z) {
+    int i = _chunk_index(x, z);
+    return i >= 0 ? region->timestamps[i] : 0;
+}
+
+static char* _external_path(const RegionFile* region, int x, int z) {
+    size_t size = strlen(region->directory) + 64;
+    char* path = (char*) malloc(size);
+    if (path) {
+        snprintf(path, size, "%s/c.%d.%d.mcc", region->directory,
+                 region->region_x * 32 + x, region->region_z * 32 + z);
+    }
+    return path;
+}
+
+/* reads the length and compression in front of chunk i; the length is checked against its sectors unless it is external */
+static bool _chunk_header(RegionFile* region, int i, off_t* offset, uint32_t* stored, unsigned char* compression) {
+    if (i < 0 || region->locations[i] == 0) {
+        return false;
+    }
+    *offset = (off_t) (region->locations[i] >> 8) * REGION_SECTOR_SIZE;
+    size_t capacity = (size_t) (region->locations[i] & 0xFF) * REGION_SECTOR_SIZE;
+    unsigned char header[5];
+    if (!_read_all(region->fd, header, sizeof(header), *offset)) {
+        return false;
+    }
+    *stored = (uint32_t) header[0] << 24 | header[1] << 16 | header[2] << 8 | header[3];
+    *compression = header[4];
+    return (*compression & EXTERNAL_FLAG)
+        || (*stored != 0 && capacity >= sizeof(header) && *stored - 1 <= capacity - sizeof(header));
+}
+
+bool RegionFile_read_compressed(RegionFile* region, int x, int z, unsigned char** data, size_t* length,
+                                enum RegionCompression* compression_out) {
+    off_t offset;
+    uint32_t stored;
+    unsigned char compression;
+    if (!_chunk_header(region, _chunk_index(x, z), &offset, &stored, &compression)) {
+        return false;
+    }
+
+    unsigned char* compressed;
+    size_t compressed_length;
+    if (compression & EXTERNAL_FLAG) {
+        char* path = _external_path(region, x, z);
+        bool ok = path && load_file(path, &compressed, &compressed_length);
+        free(path);
+        if (!ok) {
+            return false;
+        }
+        compression &= ~EXTERNAL_FLAG;
+    } else {
+        compressed_length = stored - 1;
+        compressed = (unsigned char*) malloc(compressed_length ? compressed_length : 1);
+        if (!compressed) {
+            return false;
+        }
+        if (!_read_all(region->fd, compressed, compressed_length, offset + 5)) {
+            free(compressed);
+            return false;
+        }
+    }
+    *data = compressed;
+    *length = compressed_length;
+    *compression_out = (enum RegionCompression) compression;
+    return true;
+}
+
+bool RegionFile_stored_length(RegionFile* region, int x, int z, size_t* length) {
+    off_t offset;
+    uint32_t stored;
+    unsigned char compression;
+    if (!_chunk_header(region, _chunk_index(x, z), &offset, &stored, &compression)) {
+        return false;
+    }
+    if (compression & EXTERNAL_FLAG) {
+        char* path = _external_path(region, x, z);
+        struct stat st;
+        bool ok = path && stat(path, &st) == 0;
+        free(path);
+        *length = ok ? (size_t) st.st_size : 0;
+        return ok;
+    }
+    *length = stored - 1;
+    return true;
+}
+
+bool RegionFile_read_raw(RegionFile* region, int x, int z, unsigned char** data, size_t* length) {
+    unsigned char* compressed;
+    size_t compressed_length;
+    enum RegionCompression compression;
+    if (!RegionFile_read_compressed(region, x, z, &compressed, &compressed_length, &compression)) {
+        return false;
+    }
+
+    switch (compression) {
+    case REGION_GZIP:
+    case REGION_ZLIB:
+    {
+        // inf_buffer() tells the two apart by their headers
+        int ret = inf_buffer(compressed, compressed_length, data, length);
+        free(compressed);
+        if (ret != 0) {
+            zerr(ret);
+            return false;
+        }
+        return true;
+    }
+    case REGION_UNCOMPRESSED:
+        *data = compressed;
+        *length = compressed_length;
+        return true;
+    default:
+        fprintf(stderr, "Unsupported chunk compression %d\n", compression);
+        free(compressed);
+        return false;
+    }
+}
+
+NamedTag* RegionFile_read_chunk(RegionFile* region, int x, int z, const ParseOptions* options, ParseResult* result) {
+    unsigned char* data;
+    size_t length;
+    if (!RegionFile_read_raw(region, x, z, &data, &length)) {
+        if (result) {
+            *result = (ParseResult){ .error = PARSE_ERROR_IO };
+        }
+        return NULL;
+    }
+    NamedTag* tag = parse_named_tag_from_buffer_with_options((char*) data, length, options, result);
+    free(data);
+    return tag;
+}
+
+/* compression workers */
+
+typedef struct EncodedChunk {
+    unsigned char* data; // 5 byte header, payload, zero padding to a whole sector
+    size_t length;       // header and payload
+    bool ok;
+} EncodedChunk;
+
+typedef struct EncodeJob {
+    const RegionChunk* chunks;
+    EncodedChunk* encoded;
+    size_t count;
+    size_t next;
+    int level;
+    enum RegionCompression compression;
+} EncodeJob;
+
+static bool _encode(const EncodeJob* job, const RegionChunk* chunk, EncodedChunk* out) {
+    unsigned char* raw = (unsigned char*) chunk->raw;
+    size_t raw_length = chunk->raw_length;
+    bool compressed = !chunk->tag && chunk->compression;
+    enum RegionCompression compression = compressed ? chunk->compression : job->compression;
+    if (chunk->tag && !write_named_tag_to_buffer(chunk->tag, &raw, &raw_length)) {
+        return false;
+    }
+
+    char* buffer = NULL;
+    size_t size = 0;
+    FILE* dest = open_memstream(&buffer, &size);
+    bool ok = dest != NULL;
+    if (ok) {
+        static const unsigned char placeholder[5];
+        ok = fwrite(placeholder, 1, sizeof(placeholder), dest) == sizeof(placeholder);
+    }
+    if (ok && (compressed || compression == REGION_UNCOMPRESSED)) {
+        ok = fwrite(raw, 1, raw_length, dest) == raw_length;
+    } else if (ok) {
+        FILE* source = fmemopen(raw, raw_length ? raw_length : 1, "r");
+        int window_bits = compression == REGION_GZIP ? 15 + 16 : 15;
+        ok = source && def2(source, dest, job->level, window_bits) == 0;
+        if (source) {
+            fclose(source);
+        }
+    }
+    if (dest && fclose(dest) != 0) {
+        ok = false;
+    }
+    if (chunk->tag) {
+        free(raw);
+    }
+    if (!ok) {
+        free(buffer);
+        return false;
+    }
+
+    size_t padded = (size + REGION_SECTOR_SIZE - 1) / REGION_SECTOR_SIZE * REGION_SECTOR_SIZE;
+    unsigned char* temp = (unsigned char*) realloc(buffer, padded);
+    if (!temp) {
+        free(buffer);
+        return false;
+    }
+    memset(temp + size, 0, padded - size);
+    uint32_t stored = htobe32((uint32_t) (size - 4));
+    memcpy(temp, &stored, sizeof(stored));
+    temp[4] = (unsigned char) compression;
+    out->data = temp;
+    out->length = size;
+    return true;
+}
+
+static void* _encode_worker(void* arg) {
+    EncodeJob* job = (EncodeJob*) arg;
+    while (1) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count) {
+            return NULL;
+        }
+        job->encoded[i].ok = _encode(job, &job->chunks[i], &job->encoded[i]);
+    }
+}
+
+/* sector allocation and writing, on the calling thread */
+
+static void _release(RegionFile* region, uint32_t location) {
+    size_t offset = location >> 8;
+    size_t count = location & 0xFF;
+    if (offset >= HEADER_SECTORS && count) {
+        memset(region->used + offset, 0, count);
+    }
+}
+
+static void _remove_external(const RegionFile* region, int x, int z) {
+    char* external = _external_path(region, x, z);
+    if (external && unlink(external) != 0 && errno != ENOENT) {
+        fprintf(stderr, "Could not remove %s: %s\n", external, strerror(errno));
+    }
+    free(external);
+}
+
+/* writes the payload of a chunk too big for the location table to its .mcc file */
+static bool _store_external(const char* external, const EncodedChunk* encoded) {
+    char* temp;
+    FILE* file = replace_open(external, &temp);
+    if (!file) {
+        return false;
+    }
+    size_t length = encoded->length - 5;
+    return replace_close(file, temp, external, fwrite(encoded->data + 5, 1, length, file) == length);
+}
+
+/*
+ * Writes a chunk to sectors that are free on disk and points the in-memory
+ * location at them. Its old sectors stay marked used, so nothing else in the
+ * batch lands on them before the header stops referring to them.
+ */
+static bool _store(RegionFile* region, const RegionChunk* chunk, EncodedChunk* encoded) {
+    int i = _chunk_index(chunk->x, chunk->z);
+    size_t sectors = (encoded->length + REGION_SECTOR_SIZE - 1) / REGION_SECTOR_SIZE;
+    if (sectors > MAX_CHUNK_SECTORS) {
+        char* external = _external_path(region, chunk->x, chunk->z);
+        bool ok = external && _store_external(external, encoded);
+        free(external);
+        if (!ok) {
+            return false;
+        }
+        uint32_t stored = htobe32(1);
+        memcpy(encoded->data, &stored, sizeof(stored));
+        encoded->data[4] |= EXTERNAL_FLAG;
+        memset(encoded->data + 5, 0, REGION_SECTOR_SIZE - 5);
+        encoded->length = 5;
+        sectors = 1;
+    }
+
+    size_t offset = _find_free(region, sectors);
+    if (!_mark(region, offset, sectors, true)) {
+        return false;
+    }
+    if (!_write_all(region->fd, encoded->data, sectors * REGION_SECTOR_SIZE, (off_t) offset * REGION_SECTOR_SIZE)) {
+        memset(region->used + offset, 0, sectors);
+        return false;
+    }
+    region->locations[i] = (uint32_t) offset << 8 | (uint32_t) sectors;
+    region->timestamps[i] = chunk->timestamp ? chunk->timestamp : (uint32_t) time(NULL);
+    return true;
+}
+
+/* drops free sectors at the end of the file */
+static void _trim(RegionFile* region) {
+    size_t end = region->sector_count;
+    while (end > HEADER_SECTORS && !region->used[end - 1]) {
+        end--;
+    }
+    if (end < region->sector_count && ftruncate(region->fd, (off_t) end * REGION_SECTOR_SIZE) == 0) {
+        region->sector_count = end;
+    }
+}
+
+/* where a chunk was before the batch stored it */
+typedef struct _Replaced {
+    uint32_t location;
+    uint32_t timestamp;
+} _Replaced;
+
+bool RegionFile_write_chunks(RegionFile* region, const RegionChunk* chunks, size_t count,
+                             const RegionWriteOptions* options) {
+    for (size_t i = 0; i < count; i++) {
+        if (_chunk_index(chunks[i].x, chunks[i].z) < 0 || (!chunks[i].tag && !chunks[i].raw)) {
+            return false;
+        }
+    }
+    EncodeJob job = {
+        .chunks = chunks,
+        .count = count,
+        .level = options && options->level ? options->level : -1,
+        .compression = options && options->compression ? options->compression : REGION_ZLIB,
+    };
+    int thread_count = options && options->threads > 0 ? options->threads : DEFAULT_THREADS;
+    job.encoded = (EncodedChunk*) calloc(count ? count : 1, sizeof(EncodedChunk));
+    _Replaced* replaced = (_Replaced*) calloc(count ? count : 1, sizeof(_Replaced));
+    pthread_t* threads = (pthread_t*) calloc(thread_count, sizeof(pthread_t));
+    if (!job.encoded || !replaced || !threads) {
+        free(job.encoded);
+        free(replaced);
+        free(threads);
+        return false;
+    }
+    int started = 0;
+    for (int i = 1; i < thread_count && (size_t) i < count; i++) {
+        if (pthread_create(&threads[started], NULL, _encode_worker, &job) != 0) {
+            break;
+        }
+        started++;
+    }
+    _encode_worker(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    // nothing touches the file unless every chunk encoded
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        ok = ok && job.encoded[i].ok;
+    }
+    // as in vanilla: new data goes to free sectors, then the header switches over
+    // to it, and only then are the old sectors and .mcc files given up
+    size_t stored = 0;
+    for (; ok && stored < count; stored++) {
+        int i = _chunk_index(chunks[stored].x, chunks[stored].z);
+        replaced[stored] = (_Replaced) { region->locations[i], region->timestamps[i] };
+        if (!_store(region, &chunks[stored], &job.encoded[stored])) {
+            ok = false;
+            break;
+        }
+    }
+    if (count > 0 && ok && fsync(region->fd) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        // the header still points at the old sectors, so forget the new ones
+        while (stored-- > 0) {
+            int i = _chunk_index(chunks[stored].x, chunks[stored].z);
+            _release(region, region->locations[i]);
+            region->locations[i] = replaced[stored].location;
+            region->timestamps[i] = replaced[stored].timestamp;
+        }
+    } else if (count > 0 && _write_header(region)) {
+        // backwards, so only the last write of a chunk decides whether its .mcc stays
+        bool seen[REGION_CHUNKS] = {false};
+        for (size_t k = count; k-- > 0;) {
+            int i = _chunk_index(chunks[k].x, chunks[k].z);
+            _release(region, replaced[k].location);
+            if (!seen[i] && !(job.encoded[k].data[4] & EXTERNAL_FLAG)) {
+                _remove_external(region, chunks[k].x, chunks[k].z);
+            }
+            seen[i] = true;
+        }
+    } else if (count > 0) {
+        // the header on disk may be either one; keep the sectors of both
+        ok = false;
+    }
+    _trim(region);
+    for (size_t i = 0; i < count; i++) {
+        free(job.encoded[i].data);
+    }
+    free(job.encoded);
+    free(replaced);
+    return ok;
+}
+
+bool RegionFile_remove_chunk(RegionFile* region, int x, int z) {
+    int i = _chunk_index(x, z);
+    if (i < 0) {
+        return false;
+    }
+    uint32_t location = region->locations[i];
+    if (location == 0) {
+        return true;
+    }
+    region->locations[i] = 0;
+    region->timestamps[i] = 0;
+    if (!_write_header(region)) {
+        return false; // the sectors stay used, whichever header is on disk
+    }
+    _release(region, location);
+    _remove_external(region, x, z);
+    _trim(region);
+    return true;
+}
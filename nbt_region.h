@@ -0,0 +1,74 @@
+#ifndef NBT_REGION_H
+#define NBT_REGION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nbt.h"
+#include "nbt_parse.h"
+
+/*
+ * Anvil region files (r.<x>.<z>.mca): an 8 KiB header of 1024 chunk
+ * locations and 1024 timestamps, followed by chunks in 4 KiB sectors, each a
+ * big endian length, a compression type and the compressed NBT. Chunks that
+ * need more than 255 sectors live in c.<x>.<z>.mcc next to the region file.
+ *
+ * Chunk coordinates are local to the region, 0 to 31 on both axes.
+ */
+
+#define REGION_SECTOR_SIZE 4096
+#define REGION_CHUNKS 1024
+
+enum RegionCompression {
+    REGION_GZIP = 1,
+    REGION_ZLIB = 2,
+    REGION_UNCOMPRESSED = 3
+};
+
+typedef struct RegionFile RegionFile;
+
+/* one chunk to store: either a tree, or an already serialized document */
+typedef struct RegionChunk {
+    int x;
+    int z;
+    const NamedTag* tag;
+    const unsigned char* raw; // uncompressed NBT, used when tag is NULL
+    size_t raw_length;
+    uint32_t timestamp;       // 0 for now
+    enum RegionCompression compression; // when set, raw is already compressed this way and is stored as is
+} RegionChunk;
+
+typedef struct RegionWriteOptions {
+    int threads;             // compression workers, 0 for 4
+    int level;               // zlib level 1-9, 0 for zlib's default
+    enum RegionCompression compression; // 0 for REGION_ZLIB
+} RegionWriteOptions;
+
+/* with create, a missing file is created empty */
+RegionFile* RegionFile_open(const char* path, bool create);
+void RegionFile_close(RegionFile*);
+
+bool RegionFile_has_chunk(const RegionFile*, int x, int z);
+uint32_t RegionFile_timestamp(const RegionFile*, int x, int z);
+
+/* the stored bytes of a chunk, as they are, in a malloc'ed buffer */
+bool RegionFile_read_compressed(RegionFile*, int x, int z, unsigned char** data, size_t* length,
+                                enum RegionCompression* compression);
+/* what RegionFile_read_compressed() would return as length, from the chunk's header alone */
+bool RegionFile_stored_length(RegionFile*, int x, int z, size_t* length);
+/* the decompressed NBT of a chunk in a malloc'ed buffer */
+bool RegionFile_read_raw(RegionFile*, int x, int z, unsigned char** data, size_t* length);
+NamedTag* RegionFile_read_chunk(RegionFile*, int x, int z, const ParseOptions*, ParseResult*);
+
+/*
+ * Serializes and compresses the chunks on a pool of workers, then stores them.
+ * Chunks are never rewritten in place: each goes to the first run of sectors
+ * that no chunk in the header on disk uses, or the end of the file, and the
+ * header is written once all of them are on disk. Only then are the sectors
+ * they replaced freed, so a crash leaves either the old or the new chunks.
+ * Everything else in the file is left untouched. options may be NULL.
+ */
+bool RegionFile_write_chunks(RegionFile*, const RegionChunk*, size_t count, const RegionWriteOptions*);
+bool RegionFile_remove_chunk(RegionFile*, int x, int z);
+
+#endif // NBT_REGION_H
@@ -0,0 +1,58 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_replace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static unsigned _next_temp;
+
+FILE* replace_open(const char* path, char** temp) {
+    size_t size = strlen(path) + 32;
+    char* name = (char*) malloc(size);
+    if (!name) {
+        return NULL;
+    }
+    // not mkstemp(), whose 0600 ignores the umask; O_EXCL keeps the name our own
+    int fd = -1;
+    for (int attempt = 0; fd == -1 && attempt < 100; attempt++) {
+        snprintf(name, size, "%s.%ld.%u", path, (long) getpid(), __atomic_fetch_add(&_next_temp, 1, __ATOMIC_RELAXED));
+        fd = open(name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd == -1 && errno != EEXIST) {
+            break;
+        }
+    }
+    FILE* file = fd != -1 ? fdopen(fd, "wb") : NULL;
+    if (!file) {
+        int error = errno;
+        if (fd != -1) {
+            close(fd);
+            unlink(name);
+        }
+        free(name);
+        errno = error;
+        return NULL;
+    }
+    *temp = name;
+    return file;
+}
+
+bool replace_close(FILE* file, char* temp, const char* path, bool ok) {
+    int fd = fileno(file);
+    struct stat st;
+    ok = ok && fflush(file) == 0 && (stat(path, &st) != 0 || fchmod(fd, st.st_mode & 07777) == 0) && fsync(fd) == 0;
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(temp, path) == 0;
+    if (!ok) {
+        int error = errno;
+        unlink(temp);
+        errno = error;
+    }
+    free(temp);
+    return ok;
+}
@@ -0,0 +1,21 @@
+#ifndef NBT_REPLACE_H
+#define NBT_REPLACE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/*
+ * Replacing a file so that readers, and a crash, see either all of the old
+ * contents or all of the new. They are written to a temporary file beside
+ * it, which gets the old file's mode (0666 less the umask when there is no
+ * old file), is synced to disk and is then renamed over it. Neither function
+ * prints anything; on failure errno says why.
+ */
+
+/* a file to write the new contents of path to; *temp receives its name */
+FILE* replace_open(const char* path, char** temp);
+/* closes file and renames it over path when ok and everything reached the disk,
+   otherwise removes it; frees temp either way */
+bool replace_close(FILE* file, char* temp, const char* path, bool ok);
+
+#endif // NBT_REPLACE_H
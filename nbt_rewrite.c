@@ -0,0 +1,584 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_rewrite.h"
+#include "nbt_parse.h"
+#include "nbt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fnmatch.h>
+
+#include "nbt_endian.h"
+
+/* rules */
+
+Rewriter* Rewriter_new(void) {
+    Rewriter* rw = (Rewriter*) calloc(1, sizeof(Rewriter));
+    if (rw) {
+        rw->strip_arrays_over = -1;
+    }
+    return rw;
+}
+
+void Rewriter_free(Rewriter* rw) {
+    if (!rw) {
+        return;
+    }
+    for (size_t i = 0; i < rw->count; i++) {
+        NBTPath_destroy(&rw->paths[i]);
+        free(rw->rules[i].name);
+    }
+    free(rw->paths);
+    free(rw->rules);
+    free(rw);
+}
+
+// adds rule once for every path expr expands into
+static bool _add_rule(Rewriter* rw, const char* expr, const RewriteRule* rule) {
+    size_t before = rw->count;
+    if (!path_parse(expr, &rw->paths, &rw->count)) {
+        return false;
+    }
+    RewriteRule* temp = (RewriteRule*) realloc(rw->rules, rw->count * sizeof(RewriteRule));
+    if (!temp) {
+        goto error;
+    }
+    rw->rules = temp;
+    memset(&rw->rules[before], 0, (rw->count - before) * sizeof(RewriteRule));
+    for (size_t i = before; i < rw->count; i++) {
+        const NBTPath* path = &rw->paths[i];
+        if ((rule->action == REWRITE_DROP || rule->action == REWRITE_RENAME)
+                && path->segments[path->length - 1].kind != PATH_KEY) {
+            fprintf(stderr, "Only compound entries can be dropped or renamed, not \"%s\"\n", path->text);
+            goto error;
+        }
+        rw->rules[i] = *rule;
+        rw->rules[i].name = NULL;
+        if (rule->name && !(rw->rules[i].name = strdup(rule->name))) {
+            goto error;
+        }
+    }
+    return true;
+
+    error:
+    while (rw->count > before) {
+        rw->count--;
+        NBTPath_destroy(&rw->paths[rw->count]);
+        if (temp) {
+            free(rw->rules[rw->count].name);
+        }
+    }
+    return false;
+}
+
+bool Rewriter_drop(Rewriter* rw, const char* path) {
+    RewriteRule rule = { .action = REWRITE_DROP };
+    return _add_rule(rw, path, &rule);
+}
+
+bool Rewriter_rename(Rewriter* rw, const char* path, const char* name) {
+    if (strlen(name) > UINT16_MAX) {
+        fprintf(stderr, "Name too long for \"%s\"\n", path);
+        return false;
+    }
+    RewriteRule rule = { .action = REWRITE_RENAME, .name = (char*) name };
+    return _add_rule(rw, path, &rule);
+}
+
+bool Rewriter_clamp(Rewriter* rw, const char* path, Double minimum, Double maximum) {
+    if (!(minimum <= maximum)) {
+        fprintf(stderr, "Empty range for \"%s\"\n", path);
+        return false;
+    }
+    RewriteRule rule = { .action = REWRITE_CLAMP, .minimum = minimum, .maximum = maximum };
+    return _add_rule(rw, path, &rule);
+}
+
+bool Rewriter_strip_arrays(Rewriter* rw, const char* path, Int max_length) {
+    if (max_length < 0) {
+        return false;
+    }
+    if (!path) {
+        rw->strip_arrays_over = max_length;
+        return true;
+    }
+    RewriteRule rule = { .action = REWRITE_STRIP, .max_length = max_length };
+    return _add_rule(rw, path, &rule);
+}
+
+/* values */
+
+static bool _numeric(enum TAGType type) {
+    return type >= TAG_Byte && type <= TAG_Double;
+}
+
+static uint64_t _load_bits(const unsigned char* raw, size_t size) {
+    switch (size) {
+    case 1:
+        return raw[0];
+    case 2:
+    {
+        uint16_t v;
+        memcpy(&v, raw, sizeof(v));
+        return be16toh(v);
+    }
+    case 4:
+    {
+        uint32_t v;
+        memcpy(&v, raw, sizeof(v));
+        return be32toh(v);
+    }
+    default:
+    {
+        uint64_t v;
+        memcpy(&v, raw, sizeof(v));
+        return be64toh(v);
+    }
+    }
+}
+
+static void _store_bits(unsigned char* raw, size_t size, uint64_t bits) {
+    switch (size) {
+    case 1:
+        raw[0] = (unsigned char) bits;
+        break;
+    case 2:
+    {
+        uint16_t v = htobe16((uint16_t) bits);
+        memcpy(raw, &v, sizeof(v));
+        break;
+    }
+    case 4:
+    {
+        uint32_t v = htobe32((uint32_t) bits);
+        memcpy(raw, &v, sizeof(v));
+        break;
+    }
+    default:
+    {
+        uint64_t v = htobe64(bits);
+        memcpy(raw, &v, sizeof(v));
+        break;
+    }
+    }
+}
+
+static Long _bound(Double value, Long lowest, Long highest) {
+    if (value <= (Double) lowest) {
+        return lowest;
+    }
+    if (value >= (Double) highest) {
+        return highest;
+    }
+    return (Long) value;
+}
+
+// clamps one big-endian number in place; returns true if it changed
+static bool _clamp(enum TAGType type, unsigned char* raw, const RewriteRule* rule) {
+    size_t size = sizeof_type[type];
+    uint64_t bits = _load_bits(raw, size);
+    if (type == TAG_Float || type == TAG_Double) {
+        Double value;
+        if (type == TAG_Float) {
+            uint32_t b = (uint32_t) bits;
+            Float f;
+            memcpy(&f, &b, sizeof(f));
+            value = f;
+        } else {
+            memcpy(&value, &bits, sizeof(value));
+        }
+        if (!(value < rule->minimum) && !(value > rule->maximum)) {
+            return false; // in range, or NaN
+        }
+        value = value < rule->minimum ? rule->minimum : rule->maximum;
+        if (type == TAG_Float) {
+            Float f = (Float) value;
+            uint32_t b;
+            memcpy(&b, &f, sizeof(b));
+            bits = b;
+        } else {
+            memcpy(&bits, &value, sizeof(bits));
+        }
+        _store_bits(raw, size, bits);
+        return true;
+    }
+
+    Long value, lowest, highest;
+    switch (type) {
+    case TAG_Byte:
+        value = (Byte) bits;
+        lowest = INT8_MIN;
+        highest = INT8_MAX;
+        break;
+    case TAG_Short:
+        value = (Short) bits;
+        lowest = INT16_MIN;
+        highest = INT16_MAX;
+        break;
+    case TAG_Int:
+        value = (Int) bits;
+        lowest = INT32_MIN;
+        highest = INT32_MAX;
+        break;
+    default:
+        value = (Long) bits;
+        lowest = INT64_MIN;
+        highest = INT64_MAX;
+        break;
+    }
+    Long clamped = value;
+    if ((Double) value < rule->minimum) {
+        clamped = _bound(ceil(rule->minimum), lowest, highest);
+    } else if ((Double) value > rule->maximum) {
+        clamped = _bound(floor(rule->maximum), lowest, highest);
+    }
+    if (clamped == value) {
+        return false;
+    }
+    _store_bits(raw, size, (uint64_t) clamped);
+    return true;
+}
+
+/* streaming */
+
+typedef struct {
+    FILE* in;
+    FILE* out;
+    const Rewriter* rw;
+    RewriteStats stats;
+    // rule index lists for each level down to the longest path: clamps, deeper, then sub
+    size_t* scratch;
+    size_t levels;
+    char name[UINT16_MAX + 1];
+    unsigned char buffer[4096];
+} _Stream;
+
+enum { SCRATCH_CLAMPS, SCRATCH_DEEPER, SCRATCH_SUB, SCRATCH_LISTS };
+
+/* below the longest path no rule is active, and nothing is written to the list */
+static size_t* _scratch(_Stream* s, size_t depth, int list) {
+    size_t level = depth < s->levels ? depth : s->levels - 1;
+    return s->scratch + (level * SCRATCH_LISTS + list) * (s->rw->count ? s->rw->count : 1);
+}
+
+static bool _read(_Stream* s, void* data, size_t size) {
+    return size == 0 || fread(data, 1, size, s->in) == size;
+}
+
+static bool _write(_Stream* s, const void* data, size_t size) {
+    return size == 0 || fwrite(data, 1, size, s->out) == size;
+}
+
+static bool _copy(_Stream* s, size_t size) {
+    while (size > 0) {
+        size_t chunk = size < sizeof(s->buffer) ? size : sizeof(s->buffer);
+        if (!_read(s, s->buffer, chunk) || !_write(s, s->buffer, chunk)) {
+            return false;
+        }
+        size -= chunk;
+    }
+    return true;
+}
+
+static bool _discard(_Stream* s, size_t size) {
+    while (size > 0) {
+        size_t chunk = size < sizeof(s->buffer) ? size : sizeof(s->buffer);
+        if (!_read(s, s->buffer, chunk)) {
+            return false;
+        }
+        size -= chunk;
+    }
+    return true;
+}
+
+static void _clamp_counted(_Stream* s, enum TAGType type, unsigned char* raw, size_t rule) {
+    if (_clamp(type, raw, &s->rw->rules[rule])) {
+        s->stats.clamped++;
+    }
+}
+
+static bool _rewrite_payload(_Stream* s, enum TAGType type, size_t depth, const size_t* active, size_t active_count);
+
+/*
+ * Copies the elements of a list or array. whole are the clamp rules for the
+ * container itself, deeper the rules that continue into its elements.
+ */
+static bool _rewrite_elements(_Stream* s, enum TAGType type, Int length, size_t depth,
+                              const size_t* whole, size_t whole_count, const size_t* deeper, size_t deeper_count) {
+    bool primitive = _numeric(type);
+    size_t size = primitive ? sizeof_type[type] : 0;
+
+    if (primitive && deeper_count == 0) {
+        if (whole_count == 0) {
+            return _copy(s, (size_t) length * size);
+        }
+        // nothing addresses single elements: convert a buffer at a time
+        size_t per_buffer = sizeof(s->buffer) / size;
+        for (Int done = 0; done < length;) {
+            size_t n = (size_t) (length - done) < per_buffer ? (size_t) (length - done) : per_buffer;
+            if (!_read(s, s->buffer, n * size)) {
+                return false;
+            }
+            for (size_t i = 0; i < n; i++) {
+                for (size_t j = 0; j < whole_count; j++) {
+                    _clamp_counted(s, type, s->buffer + i * size, whole[j]);
+                }
+            }
+            if (!_write(s, s->buffer, n * size)) {
+                return false;
+            }
+            done += (Int) n;
+        }
+        return true;
+    }
+
+    size_t* sub = _scratch(s, depth, SCRATCH_SUB);
+    Int untouched = 0; // primitive elements no rule applies to, copied in one go
+    for (Int i = 0; i < length; i++) {
+        size_t sub_count = 0;
+        for (size_t j = 0; j < deeper_count; j++) {
+            const PathSegment* segment = &s->rw->paths[deeper[j]].segments[depth];
+            if (segment->kind == PATH_ANY_INDEX || (segment->kind == PATH_INDEX && segment->index == i)) {
+                sub[sub_count++] = deeper[j];
+            }
+        }
+        if (!primitive) {
+            if (!_rewrite_payload(s, type, depth + 1, sub, sub_count)) {
+                return false;
+            }
+            continue;
+        }
+        if (whole_count == 0 && sub_count == 0) {
+            untouched++;
+            continue;
+        }
+        if (!_copy(s, (size_t) untouched * size)) {
+            return false;
+        }
+        untouched = 0;
+        unsigned char raw[sizeof(Long)];
+        if (!_read(s, raw, size)) {
+            return false;
+        }
+        for (size_t j = 0; j < whole_count; j++) {
+            _clamp_counted(s, type, raw, whole[j]);
+        }
+        for (size_t j = 0; j < sub_count; j++) {
+            if (s->rw->rules[sub[j]].action == REWRITE_CLAMP && s->rw->paths[sub[j]].length == depth + 1) {
+                _clamp_counted(s, type, raw, sub[j]);
+            }
+        }
+        if (!_write(s, raw, size)) {
+            return false;
+        }
+    }
+    return _copy(s, (size_t) untouched * size);
+}
+
+static bool _rewrite_payload(_Stream* s, enum TAGType type, size_t depth, const size_t* active, size_t active_count) {
+    if (depth > NBT_MAX_DEPTH) {
+        return false;
+    }
+    const Rewriter* rw = s->rw;
+
+    // clamp and strip rules that end here apply to this value, the rest go deeper
+    size_t* clamps = _scratch(s, depth, SCRATCH_CLAMPS);
+    size_t clamp_count = 0;
+    size_t* deeper = _scratch(s, depth, SCRATCH_DEEPER);
+    size_t deeper_count = 0;
+    Int strip_over = rw->strip_arrays_over;
+    for (size_t i = 0; i < active_count; i++) {
+        const RewriteRule* rule = &rw->rules[active[i]];
+        if (rw->paths[active[i]].length > depth) {
+            deeper[deeper_count++] = active[i];
+        } else if (rule->action == REWRITE_CLAMP) {
+            clamps[clamp_count++] = active[i];
+        } else if (rule->action == REWRITE_STRIP && (strip_over < 0 || rule->max_length < strip_over)) {
+            strip_over = rule->max_length;
+        }
+    }
+
+    switch (type) {
+    case TAG_Byte:
+    case TAG_Short:
+    case TAG_Int:
+    case TAG_Long:
+    case TAG_Float:
+    case TAG_Double:
+    {
+        unsigned char raw[sizeof(Long)];
+        if (!_read(s, raw, sizeof_type[type])) {
+            return false;
+        }
+        for (size_t i = 0; i < clamp_count; i++) {
+            _clamp_counted(s, type, raw, clamps[i]);
+        }
+        return _write(s, raw, sizeof_type[type]);
+    }
+    case TAG_String:
+    {
+        uint16_t length;
+        if (!_read(s, &length, sizeof(length)) || !_write(s, &length, sizeof(length))) {
+            return false;
+        }
+        return _copy(s, be16toh(length));
+    }
+    case TAG_Byte_Array:
+    case TAG_Int_Array:
+    case TAG_Long_Array:
+    {
+        Int length;
+        if (!_read(s, &length, sizeof(length))) {
+            return false;
+        }
+        Int host_length = be32toh(length);
+        if (host_length < 0) {
+            return false;
+        }
+        enum TAGType element_type = type == TAG_Byte_Array ? TAG_Byte : type == TAG_Int_Array ? TAG_Int : TAG_Long;
+        if (strip_over >= 0 && host_length > strip_over) {
+            s->stats.stripped++;
+            Int empty = 0;
+            return _write(s, &empty, sizeof(empty))
+                && _discard(s, (size_t) host_length * sizeof_type[element_type]);
+        }
+        if (!_write(s, &length, sizeof(length))) {
+            return false;
+        }
+        return _rewrite_elements(s, element_type, host_length, depth, clamps, clamp_count, deeper, deeper_count);
+    }
+    case TAG_List:
+    {
+        Byte element_type;
+        Int length;
+        if (!_read(s, &element_type, sizeof(element_type)) || !_read(s, &length, sizeof(length))) {
+            return false;
+        }
+        Int host_length = be32toh(length);
+        if (host_length < 0 || element_type < TAG_End || element_type > TAG_Long_Array
+                || (element_type == TAG_End && host_length > 0)) {
+            return false;
+        }
+        if (!_write(s, &element_type, sizeof(element_type)) || !_write(s, &length, sizeof(length))) {
+            return false;
+        }
+        if (!_numeric((enum TAGType) element_type)) {
+            clamp_count = 0;
+        }
+        return _rewrite_elements(s, (enum TAGType) element_type, host_length, depth,
+                                 clamps, clamp_count, deeper, deeper_count);
+    }
+    case TAG_Compound:
+    {
+        size_t* sub = _scratch(s, depth, SCRATCH_SUB);
+        while (1) {
+            Byte child_type;
+            if (!_read(s, &child_type, sizeof(child_type))) {
+                return false;
+            }
+            if (child_type == TAG_End) {
+                return _write(s, &child_type, sizeof(child_type));
+            }
+            if (child_type < TAG_End || child_type > TAG_Long_Array) {
+                return false;
+            }
+            uint16_t name_length;
+            if (!_read(s, &name_length, sizeof(name_length))) {
+                return false;
+            }
+            name_length = be16toh(name_length);
+            if (!_read(s, s->name, name_length)) {
+                return false;
+            }
+            s->name[name_length] = '\0';
+
+            size_t sub_count = 0;
+            bool drop = false;
+            const char* rename = NULL;
+            for (size_t i = 0; i < deeper_count; i++) {
+                const PathSegment* segment = &rw->paths[deeper[i]].segments[depth];
+                if (segment->kind != PATH_KEY || fnmatch(segment->key, s->name, 0) != 0) {
+                    continue;
+                }
+                const RewriteRule* rule = &rw->rules[deeper[i]];
+                if (rw->paths[deeper[i]].length == depth + 1) {
+                    drop |= rule->action == REWRITE_DROP;
+                    if (rule->action == REWRITE_RENAME && !rename) {
+                        rename = rule->name;
+                    }
+                }
+                sub[sub_count++] = deeper[i];
+            }
+            if (drop) {
+                s->stats.dropped++;
+                if (!skip_payload(s->in, (enum TAGType) child_type)) {
+                    return false;
+                }
+                continue;
+            }
+            const char* name = s->name;
+            if (rename) {
+                s->stats.renamed++;
+                name = rename;
+                name_length = (uint16_t) strlen(rename);
+            }
+            uint16_t length = htobe16(name_length);
+            if (!_write(s, &child_type, sizeof(child_type)) || !_write(s, &length, sizeof(length))
+                    || !_write(s, name, name_length)) {
+                return false;
+            }
+            if (!_rewrite_payload(s, (enum TAGType) child_type, depth + 1, sub, sub_count)) {
+                return false;
+            }
+        }
+    }
+    default:
+        return false;
+    }
+}
+
+bool rewrite_stream(const Rewriter* rw, FILE* in, FILE* out, RewriteStats* stats) {
+    _Stream* s = (_Stream*) malloc(sizeof(_Stream));
+    if (!s) {
+        return false;
+    }
+    s->in = in;
+    s->out = out;
+    s->rw = rw;
+    s->stats = (RewriteStats){0};
+    s->levels = 1;
+    for (size_t i = 0; i < rw->count; i++) {
+        if (rw->paths[i].length + 1 > s->levels) {
+            s->levels = rw->paths[i].length + 1;
+        }
+    }
+    // one more list holds the rules active at the root
+    size_t width = rw->count ? rw->count : 1;
+    s->scratch = (size_t*) malloc((s->levels * SCRATCH_LISTS + 1) * width * sizeof(size_t));
+    if (!s->scratch) {
+        free(s);
+        return false;
+    }
+
+    bool ok = false;
+    Byte type;
+    uint16_t name_length;
+    if (_read(s, &type, sizeof(type)) && type > TAG_End && type <= TAG_Long_Array
+            && _read(s, &name_length, sizeof(name_length))
+            && _write(s, &type, sizeof(type)) && _write(s, &name_length, sizeof(name_length))
+            && _copy(s, be16toh(name_length))) {
+        size_t* active = s->scratch + s->levels * SCRATCH_LISTS * width;
+        for (size_t i = 0; i < rw->count; i++) {
+            active[i] = i;
+        }
+        ok = _rewrite_payload(s, (enum TAGType) type, 0, active, rw->count);
+    }
+    if (stats) {
+        *stats = s->stats;
+    }
+    free(s->scratch);
+    free(s);
+    return ok;
+}
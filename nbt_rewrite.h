@@ -0,0 +1,64 @@
+#ifndef NBT_REWRITE_H
+#define NBT_REWRITE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "nbt_path.h"
+
+/*
+ * Rewrites an uncompressed Java document from one stream to another without
+ * building a tree, so memory use does not depend on the size of the document.
+ *
+ * Rules are attached to paths as understood by path_parse(). Key segments
+ * may be shell patterns (fnmatch), e.g. "Entities[*].Custom*" or "*.Items":
+ *   drop    removes matching compound entries
+ *   rename  gives matching compound entries a new name
+ *   clamp   limits matching numbers; on arrays and lists, every element
+ *   strip   empties matching arrays longer than a limit
+ * Drop and rename only apply to compound entries, not to list elements.
+ */
+
+enum RewriteAction {
+    REWRITE_DROP,
+    REWRITE_RENAME,
+    REWRITE_CLAMP,
+    REWRITE_STRIP
+};
+
+typedef struct RewriteRule {
+    enum RewriteAction action;
+    char* name;     // REWRITE_RENAME
+    Double minimum; // REWRITE_CLAMP
+    Double maximum;
+    Int max_length; // REWRITE_STRIP
+} RewriteRule;
+
+typedef struct Rewriter {
+    NBTPath* paths;
+    RewriteRule* rules; // one per path
+    size_t count;
+    Int strip_arrays_over; // applies to every array; -1, the default, keeps them
+} Rewriter;
+
+typedef struct RewriteStats {
+    uint64_t dropped;
+    uint64_t renamed;
+    uint64_t clamped; // values that actually changed
+    uint64_t stripped;
+} RewriteStats;
+
+Rewriter* Rewriter_new(void);
+void Rewriter_free(Rewriter*);
+
+/* each returns false if the path does not parse or does not fit the action */
+bool Rewriter_drop(Rewriter*, const char* path);
+bool Rewriter_rename(Rewriter*, const char* path, const char* name);
+bool Rewriter_clamp(Rewriter*, const char* path, Double minimum, Double maximum);
+/* with a NULL path, applies to every array in the document */
+bool Rewriter_strip_arrays(Rewriter*, const char* path, Int max_length);
+
+/* copies one document from in to out, applying the rules; stats may be NULL */
+bool rewrite_stream(const Rewriter*, FILE* in, FILE* out, RewriteStats* stats);
+
+#endif // NBT_REWRITE_H
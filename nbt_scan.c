@@ -0,0 +1,451 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_scan.h"
+#include "nbt_region.h"
+#include "nbt_path.h"
+#include "nbt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+
+static const int DEFAULT_THREADS = 4;
+
+/* predicate parsing */
+
+static char* _trim(const char* start, const char* end) {
+    while (start < end && isspace((unsigned char) *start)) {
+        start++;
+    }
+    while (end > start && isspace((unsigned char) end[-1])) {
+        end--;
+    }
+    char* text = (char*) malloc(end - start + 1);
+    if (text) {
+        memcpy(text, start, end - start);
+        text[end - start] = '\0';
+    }
+    return text;
+}
+
+/* the first occurrence of any of the operators outside double quotes */
+static const char* _find_operator(const char* start, const char* end, enum ScanOp* op, size_t* op_length) {
+    static const struct { const char* text; enum ScanOp op; } operators[] = {
+        { "==", SCAN_EQ }, { "!=", SCAN_NE }, { "<=", SCAN_LE }, { ">=", SCAN_GE },
+        { "<", SCAN_LT }, { ">", SCAN_GT },
+    };
+    bool quoted = false;
+    for (const char* p = start; p < end; p++) {
+        if (*p == '"') {
+            quoted = !quoted;
+            continue;
+        }
+        if (quoted) {
+            if (*p == '\\' && p + 1 < end) {
+                p++; // an escaped quote in a key
+            }
+            continue;
+        }
+        for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+            size_t length = strlen(operators[i].text);
+            if ((size_t) (end - p) >= length && strncmp(p, operators[i].text, length) == 0) {
+                *op = operators[i].op;
+                *op_length = length;
+                return p;
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool _parse_value(ScanCondition* condition, char* text) {
+    size_t length = strlen(text);
+    if (length >= 2 && text[0] == '"' && text[length - 1] == '"') {
+        memmove(text, text + 1, length - 2);
+        text[length - 2] = '\0';
+        condition->string = text;
+        return true;
+    }
+    char* end;
+    condition->number = strtod(text, &end);
+    if (length > 0 && *end == '\0') {
+        condition->numeric = true;
+        long long integer = strtoll(text, &end, 10);
+        if (*end == '\0') {
+            condition->integral = true;
+            condition->integer = integer;
+        }
+        free(text);
+        return true;
+    }
+    condition->string = text;
+    return true;
+}
+
+static bool _parse_condition(ScanPredicate* predicate, const char* start, const char* end) {
+    ScanCondition* condition = &predicate->conditions[predicate->condition_count];
+    *condition = (ScanCondition){ .op = SCAN_EXISTS };
+    size_t op_length = 0;
+    const char* op = _find_operator(start, end, &condition->op, &op_length);
+    char* path = _trim(start, op ? op : end);
+    if (!path) {
+        return false;
+    }
+    size_t before = predicate->path_count;
+    size_t added = path_parse(path, &predicate->paths, &predicate->path_count);
+    free(path);
+    if (!added) {
+        return false;
+    }
+    size_t* owners = (size_t*) realloc(predicate->path_condition, predicate->path_count * sizeof(size_t));
+    if (!owners) {
+        return false;
+    }
+    predicate->path_condition = owners;
+    condition->locations = added;
+    for (size_t i = before; i < predicate->path_count; i++) {
+        owners[i] = predicate->condition_count;
+        for (size_t j = 0; j < predicate->paths[i].length; j++) {
+            if (predicate->paths[i].segments[j].kind == PATH_ANY_INDEX) {
+                condition->locations = 0;
+            }
+        }
+    }
+    predicate->condition_count++;
+    if (op) {
+        char* value = _trim(op + op_length, end);
+        if (!value || !_parse_value(condition, value)) {
+            free(value);
+            return false;
+        }
+    }
+    return true;
+}
+
+ScanPredicate* ScanPredicate_parse(const char* expr) {
+    ScanPredicate* predicate = (ScanPredicate*) calloc(1, sizeof(ScanPredicate));
+    if (!predicate) {
+        return NULL;
+    }
+    size_t capacity = 1;
+    for (const char* p = expr; (p = strstr(p, "&&")); p += 2) {
+        capacity++;
+    }
+    predicate->conditions = (ScanCondition*) calloc(capacity, sizeof(ScanCondition));
+    if (!predicate->conditions) {
+        free(predicate);
+        return NULL;
+    }
+    const char* start = expr;
+    bool quoted = false;
+    for (const char* p = expr;; p++) {
+        if (quoted && p[0] == '\\' && p[1]) {
+            p++;
+            continue;
+        }
+        if (*p == '"') {
+            quoted = !quoted;
+        }
+        if (*p == '\0' || (!quoted && p[0] == '&' && p[1] == '&')) {
+            if (!_parse_condition(predicate, start, p)) {
+                fprintf(stderr, "Invalid predicate \"%s\"\n", expr);
+                ScanPredicate_free(predicate);
+                return NULL;
+            }
+            if (*p == '\0') {
+                break;
+            }
+            start = ++p + 1;
+        }
+    }
+    return predicate;
+}
+
+void ScanPredicate_free(ScanPredicate* predicate) {
+    if (!predicate) {
+        return;
+    }
+    for (size_t i = 0; i < predicate->condition_count; i++) {
+        free(predicate->conditions[i].string);
+    }
+    for (size_t i = 0; i < predicate->path_count; i++) {
+        NBTPath_destroy(&predicate->paths[i]);
+    }
+    free(predicate->conditions);
+    free(predicate->paths);
+    free(predicate->path_condition);
+    free(predicate);
+}
+
+/* matching */
+
+static bool _compare(enum ScanOp op, int order) {
+    switch (op) {
+    case SCAN_EXISTS:
+        return true;
+    case SCAN_EQ:
+        return order == 0;
+    case SCAN_NE:
+        return order != 0;
+    case SCAN_LT:
+        return order < 0;
+    case SCAN_LE:
+        return order <= 0;
+    case SCAN_GT:
+        return order > 0;
+    case SCAN_GE:
+        return order >= 0;
+    }
+    return false;
+}
+
+static bool _holds(const ScanCondition* condition, const PathValue* value) {
+    if (condition->op == SCAN_EXISTS) {
+        return true;
+    }
+    int order;
+    switch (value->type) {
+    case TAG_Byte:
+    case TAG_Short:
+    case TAG_Int:
+    case TAG_Long:
+        if (!condition->numeric) {
+            return false;
+        }
+        if (condition->integral) {
+            order = (value->integer > condition->integer) - (value->integer < condition->integer);
+        } else {
+            order = ((Double) value->integer > condition->number) - ((Double) value->integer < condition->number);
+        }
+        break;
+    case TAG_Float:
+    case TAG_Double:
+        if (!condition->numeric || value->real != value->real) {
+            return false;
+        }
+        order = (value->real > condition->number) - (value->real < condition->number);
+        break;
+    case TAG_String:
+    {
+        if (!condition->string) {
+            return false;
+        }
+        size_t length = strlen(condition->string);
+        size_t common = value->string.length < length ? value->string.length : length;
+        order = memcmp(value->string.data, condition->string, common);
+        if (order == 0) {
+            order = (value->string.length > length) - (value->string.length < length);
+        }
+        break;
+    }
+    default:
+        return false; // containers only satisfy existence
+    }
+    return _compare(condition->op, order);
+}
+
+typedef struct {
+    const ScanPredicate* predicate;
+    bool* satisfied;
+    size_t* unseen; // values each condition may still find; meaningless when its locations is 0
+    size_t remaining;
+} _MatchState;
+
+static int _on_value(void* userdata, size_t path_index, const PathValue* value) {
+    _MatchState* state = (_MatchState*) userdata;
+    size_t condition = state->predicate->path_condition[path_index];
+    if (state->satisfied[condition]) {
+        return 0;
+    }
+    if (!_holds(&state->predicate->conditions[condition], value)) {
+        // the condition has seen all the values it can, so the chunk is rejected
+        return state->predicate->conditions[condition].locations && --state->unseen[condition] == 0;
+    }
+    state->satisfied[condition] = true;
+    // every condition holds, the rest of the chunk does not matter
+    return --state->remaining == 0;
+}
+
+int scan_match_buffer(const ScanPredicate* predicate, const unsigned char* data, size_t length) {
+    FILE* stream = fmemopen((void*) data, length, "r");
+    if (!stream) {
+        return -1;
+    }
+    bool satisfied[predicate->condition_count ? predicate->condition_count : 1];
+    size_t unseen[predicate->condition_count ? predicate->condition_count : 1];
+    memset(satisfied, 0, sizeof(satisfied));
+    for (size_t i = 0; i < predicate->condition_count; i++) {
+        unseen[i] = predicate->conditions[i].locations;
+    }
+    _MatchState state = {
+        .predicate = predicate,
+        .satisfied = satisfied,
+        .unseen = unseen,
+        .remaining = predicate->condition_count,
+    };
+    // the rest of the chunk is never read once the result is known
+    int ret = path_match_until_passed(stream, predicate->paths, predicate->path_count, _on_value, &state);
+    fclose(stream);
+    if (ret < 0) {
+        return -1;
+    }
+    return state.remaining == 0;
+}
+
+/* world scanning */
+
+typedef struct {
+    char** regions;
+    size_t count;
+    size_t next;
+    const ScanPredicate* predicate;
+    ScanCallback callback;
+    void* userdata;
+    pthread_mutex_t lock;
+    ScanStats stats;
+} _ScanJob;
+
+static bool _add_regions(const char* directory, char*** regions, size_t* count) {
+    DIR* dir = opendir(directory);
+    if (!dir) {
+        return true;
+    }
+    struct dirent* entry;
+    bool ok = true;
+    while (ok && (entry = readdir(dir))) {
+        int x, z;
+        size_t name_length = strlen(entry->d_name);
+        if (sscanf(entry->d_name, "r.%d.%d.", &x, &z) != 2 || name_length < 4
+                || strcmp(entry->d_name + name_length - 4, ".mca") != 0) {
+            continue;
+        }
+        size_t size = strlen(directory) + strlen(entry->d_name) + 2;
+        char* path = (char*) malloc(size);
+        char** temp = path ? (char**) realloc(*regions, (*count + 1) * sizeof(char*)) : NULL;
+        if (!temp) {
+            free(path);
+            ok = false;
+            break;
+        }
+        snprintf(path, size, "%s/%s", directory, entry->d_name);
+        temp[(*count)++] = path;
+        *regions = temp;
+    }
+    closedir(dir);
+    return ok;
+}
+
+static int _compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static void _scan_region(_ScanJob* job, const char* path) {
+    ScanStats stats = { .regions = 1 };
+    RegionFile* region = RegionFile_open(path, false);
+    if (!region) {
+        stats.errors++;
+    }
+    const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    int region_x = 0;
+    int region_z = 0;
+    sscanf(name, "r.%d.%d.mca", &region_x, &region_z);
+    for (int z = 0; region && z < 32; z++) {
+        for (int x = 0; x < 32; x++) {
+            if (!RegionFile_has_chunk(region, x, z)) {
+                continue;
+            }
+            unsigned char* data;
+            size_t length;
+            stats.chunks++;
+            if (!RegionFile_read_raw(region, x, z, &data, &length)) {
+                stats.errors++;
+                continue;
+            }
+            int ret = scan_match_buffer(job->predicate, data, length);
+            free(data);
+            if (ret < 0) {
+                stats.errors++;
+            } else if (ret > 0) {
+                stats.matches++;
+                pthread_mutex_lock(&job->lock);
+                job->callback(job->userdata, path, region_x * 32 + x, region_z * 32 + z);
+                pthread_mutex_unlock(&job->lock);
+            }
+        }
+    }
+    RegionFile_close(region);
+
+    pthread_mutex_lock(&job->lock);
+    job->stats.regions += stats.regions;
+    job->stats.chunks += stats.chunks;
+    job->stats.matches += stats.matches;
+    job->stats.errors += stats.errors;
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void* _scan_worker(void* arg) {
+    _ScanJob* job = (_ScanJob*) arg;
+    while (1) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count) {
+            return NULL;
+        }
+        _scan_region(job, job->regions[i]);
+    }
+}
+
+bool scan_world(const char* world, const ScanPredicate* predicate, int threads, ScanCallback callback,
+                void* userdata, ScanStats* stats) {
+    static const char* const dimensions[] = { "region", "DIM-1/region", "DIM1/region" };
+    _ScanJob job = {
+        .predicate = predicate,
+        .callback = callback,
+        .userdata = userdata,
+    };
+    bool ok = true;
+    for (size_t i = 0; ok && i < sizeof(dimensions) / sizeof(dimensions[0]); i++) {
+        size_t size = strlen(world) + strlen(dimensions[i]) + 2;
+        char* directory = (char*) malloc(size);
+        if (!directory) {
+            ok = false;
+            break;
+        }
+        snprintf(directory, size, "%s/%s", world, dimensions[i]);
+        ok = _add_regions(directory, &job.regions, &job.count);
+        free(directory);
+    }
+    if (ok && job.count == 0) {
+        ok = _add_regions(world, &job.regions, &job.count);
+    }
+    if (ok && job.count > 0) {
+        qsort(job.regions, job.count, sizeof(char*), _compare_paths);
+        if (threads <= 0) {
+            threads = DEFAULT_THREADS;
+        }
+        pthread_mutex_init(&job.lock, NULL);
+        pthread_t workers[threads];
+        int started = 0;
+        for (int i = 1; i < threads && (size_t) i < job.count; i++) {
+            if (pthread_create(&workers[started], NULL, _scan_worker, &job) != 0) {
+                break;
+            }
+            started++;
+        }
+        _scan_worker(&job);
+        for (int i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        pthread_mutex_destroy(&job.lock);
+    }
+    for (size_t i = 0; i < job.count; i++) {
+        free(job.regions[i]);
+    }
+    free(job.regions);
+    if (stats) {
+        *stats = job.stats;
+    }
+    return ok && job.count > 0;
+}
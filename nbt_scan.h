@@ -0,0 +1,77 @@
+#ifndef NBT_SCAN_H
+#define NBT_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nbt_path.h"
+
+/*
+ * Predicate scans over every chunk of a world.
+ *
+ * A predicate is one or more conditions joined by "&&", each a path as
+ * understood by path_parse(), optionally followed by a comparison:
+ *   InhabitedTime > 72000
+ *   block_entities[*].id == minecraft:spawner
+ *   Status == minecraft:full && sections[*].block_states
+ * A bare path only asks for the value to exist. Values that look like numbers
+ * compare numerically, anything else (optionally in double quotes) as a
+ * string. A condition on a [*] path holds when any element satisfies it.
+ *
+ * Chunks are matched by streaming over their decompressed bytes without
+ * building a tree: subtrees no condition refers to are skipped, and a chunk
+ * is settled as soon as every condition has been satisfied.
+ */
+
+enum ScanOp {
+    SCAN_EXISTS,
+    SCAN_EQ,
+    SCAN_NE,
+    SCAN_LT,
+    SCAN_LE,
+    SCAN_GT,
+    SCAN_GE
+};
+
+typedef struct ScanCondition {
+    enum ScanOp op;
+    bool numeric;
+    bool integral; // numeric and a whole number, compared exactly against integers
+    Long integer;
+    Double number;
+    char* string;
+    size_t locations; // how many values its paths can find, 0 when one has [*]
+} ScanCondition;
+
+typedef struct ScanPredicate {
+    ScanCondition* conditions;
+    size_t condition_count;
+    NBTPath* paths;
+    size_t path_count;
+    size_t* path_condition; // which condition each path belongs to
+} ScanPredicate;
+
+typedef struct ScanStats {
+    uint64_t regions;
+    uint64_t chunks;
+    uint64_t matches;
+    uint64_t errors;
+} ScanStats;
+
+/* called once per matching chunk, never concurrently; x and z are world chunk coordinates */
+typedef void (*ScanCallback)(void* userdata, const char* region_path, int x, int z);
+
+ScanPredicate* ScanPredicate_parse(const char* expr);
+void ScanPredicate_free(ScanPredicate*);
+
+/* evaluates the predicate against one uncompressed document: 1 on a match, 0 if not, -1 on bad input */
+int scan_match_buffer(const ScanPredicate*, const unsigned char* data, size_t length);
+
+/*
+ * Scans the .mca files of world/region, world/DIM-1/region and
+ * world/DIM1/region, or of world itself when it holds region files, using
+ * threads workers (0 for 4). Returns false if no region file was found.
+ */
+bool scan_world(const char* world, const ScanPredicate*, int threads, ScanCallback, void* userdata, ScanStats*);
+
+#endif // NBT_SCAN_H
@@ -0,0 +1,800 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_server.h"
+#include "nbt_load.h"
+#include "nbt_parse.h"
+#include "nbt_path.h"
+#include "nbt_replace.h"
+#include "nbt_snbt.h"
+#include "nbt_write.h"
+#include "nbt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+typedef struct _Document {
+    char* path;
+    pthread_rwlock_t lock; // guards everything below
+    NamedTag* tag;
+    int compression;       // 0, or window bits of the file's gzip (31) or zlib (15) framing
+    bool dirty;
+    struct timespec mtime;
+    off_t size;
+
+    int users;             // the rest under the server's lock
+    bool dropped;
+    struct _Document* next;
+} _Document;
+
+typedef struct _Connection _Connection;
+
+typedef struct {
+    int listener;
+    int wake[2]; // written to when a worker finishes, so the loop watches its connection again
+    const ParseOptions* parse;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    _Document* documents;
+    _Connection* queued; // requests waiting for a worker
+    bool stopping;
+    bool quitting;       // the loop has ended; under the lock
+} _Server;
+
+/* documents */
+
+static void _document_free(_Document* doc) {
+    if (doc->tag) {
+        NamedTag_free(doc->tag);
+    }
+    pthread_rwlock_destroy(&doc->lock);
+    free(doc->path);
+    free(doc);
+}
+
+static _Document* _acquire(_Server* server, const char* path) {
+    pthread_mutex_lock(&server->lock);
+    _Document* doc = server->documents;
+    while (doc && strcmp(doc->path, path) != 0) {
+        doc = doc->next;
+    }
+    if (!doc && (doc = (_Document*) calloc(1, sizeof(_Document)))) {
+        if ((doc->path = strdup(path))) {
+            pthread_rwlock_init(&doc->lock, NULL);
+            doc->next = server->documents;
+            server->documents = doc;
+        } else {
+            free(doc);
+            doc = NULL;
+        }
+    }
+    if (doc) {
+        doc->users++;
+    }
+    pthread_mutex_unlock(&server->lock);
+    return doc;
+}
+
+static void _release(_Server* server, _Document* doc) {
+    pthread_mutex_lock(&server->lock);
+    bool last = --doc->users == 0 && doc->dropped;
+    pthread_mutex_unlock(&server->lock);
+    if (last) {
+        _document_free(doc);
+    }
+}
+
+static void _drop(_Server* server, const char* path) {
+    pthread_mutex_lock(&server->lock);
+    _Document** link = &server->documents;
+    while (*link && strcmp((*link)->path, path) != 0) {
+        link = &(*link)->next;
+    }
+    _Document* doc = *link;
+    bool unused = false;
+    if (doc) {
+        *link = doc->next;
+        doc->dropped = true;
+        unused = doc->users == 0;
+    }
+    pthread_mutex_unlock(&server->lock);
+    if (unused) {
+        _document_free(doc);
+    }
+}
+
+// (re)parses the file when there is no tree yet, or it changed and ours has no unsaved changes
+static const char* _refresh(_Server* server, _Document* doc, bool* stale_only) {
+    struct stat st;
+    bool exists = stat(doc->path, &st) == 0;
+    if (doc->tag && (doc->dirty || !exists
+            || (st.st_mtim.tv_sec == doc->mtime.tv_sec && st.st_mtim.tv_nsec == doc->mtime.tv_nsec
+                && st.st_size == doc->size))) {
+        return NULL;
+    }
+    if (stale_only) {
+        *stale_only = true;
+        return NULL;
+    }
+    if (!exists) {
+        return strerror(errno);
+    }
+    unsigned char* data;
+    size_t length;
+    if (!load_file(doc->path, &data, &length)) {
+        return "cannot read file";
+    }
+    ParseResult result;
+    NamedTag* tag = load_named_tag_from_memory(data, length, server->parse, &result);
+    int compression = !is_compressed(data, length) ? 0 : data[0] == 0x1f ? 31 : 15;
+    free(data);
+    if (!tag) {
+        return parse_error_message[result.error];
+    }
+    if (doc->tag) {
+        NamedTag_free(doc->tag);
+    }
+    doc->tag = tag;
+    doc->compression = compression;
+    doc->mtime = st.st_mtim;
+    doc->size = st.st_size;
+    return NULL;
+}
+
+/* locks doc for reading or writing with an up to date tree; returns an error message otherwise */
+static const char* _lock(_Server* server, _Document* doc, bool write) {
+    while (1) {
+        if (write) {
+            pthread_rwlock_wrlock(&doc->lock);
+            const char* error = _refresh(server, doc, NULL);
+            if (error) {
+                pthread_rwlock_unlock(&doc->lock);
+            }
+            return error;
+        }
+        pthread_rwlock_rdlock(&doc->lock);
+        bool stale = false;
+        _refresh(server, doc, &stale);
+        if (!stale) {
+            return NULL;
+        }
+        // reload exclusively, then look again
+        pthread_rwlock_unlock(&doc->lock);
+        pthread_rwlock_wrlock(&doc->lock);
+        const char* error = _refresh(server, doc, NULL);
+        pthread_rwlock_unlock(&doc->lock);
+        if (error) {
+            return error;
+        }
+    }
+}
+
+/* requests */
+
+static void* _resolve(NamedTag* root, const char* expr, enum TAGType* type) {
+    if (*expr == '\0') {
+        *type = root->type;
+        return &root->byte_value;
+    }
+    NBTPath* paths = NULL;
+    size_t count = 0;
+    void* value = NULL;
+    // a range would have to be expanded only to be refused
+    if (path_count(expr) == 1 && path_parse(expr, &paths, &count) == 1) {
+        value = path_resolve(root, &paths[0], type);
+    }
+    for (size_t i = 0; i < count; i++) {
+        NBTPath_destroy(&paths[i]);
+    }
+    free(paths);
+    return value;
+}
+
+static bool _write_plain(enum TAGType type, const void* value, FILE* out) {
+    switch (type) {
+    case TAG_Byte:
+        return fprintf(out, "%d", *(const Byte*) value) > 0;
+    case TAG_Short:
+        return fprintf(out, "%d", *(const Short*) value) > 0;
+    case TAG_Int:
+        return fprintf(out, "%d", *(const Int*) value) > 0;
+    case TAG_Long:
+        return fprintf(out, "%lld", (long long) *(const Long*) value) > 0;
+    case TAG_Float:
+        return fprintf(out, "%.9g", *(const Float*) value) > 0;
+    case TAG_Double:
+        return fprintf(out, "%.17g", *(const Double*) value) > 0;
+    case TAG_String:
+    {
+        const String* str = (const String*) value;
+        return fwrite(String_data(str), 1, str->length, out) == str->length;
+    }
+    default:
+        return write_snbt(type, value, out);
+    }
+}
+
+static const char* _keys(enum TAGType type, const void* value, FILE* out) {
+    if (type == TAG_Compound) {
+        const Compound* compound = (const Compound*) value;
+        for (Int i = 0; i < compound->size; i++) {
+            const NamedTag* child = &compound->tags[i];
+            fprintf(out, "%s\t%s\n", String_data(&child->name), tag_name[child->type]);
+        }
+        return NULL;
+    }
+    if (type == TAG_List) {
+        const List* list = (const List*) value;
+        for (Int i = 0; i < list->length; i++) {
+            fprintf(out, "%d\t%s\n", i, tag_name[list->type]);
+        }
+        return NULL;
+    }
+    return "not a compound or list";
+}
+
+// parses text as a value of the type already at the location, an SNBT suffix allowed
+static const char* _set(enum TAGType type, void* value, const char* text) {
+    if (type == TAG_String) {
+        String str;
+        size_t length = strlen(text);
+        if (length >= 2 && text[0] == '"' && text[length - 1] == '"') {
+            text++;
+            length -= 2;
+        }
+        if (!String_set(&str, text, length)) {
+            return "string too long";
+        }
+        String_destroy((String*) value);
+        *(String*) value = str;
+        return NULL;
+    }
+    if (type < TAG_Byte || type > TAG_Double) {
+        return "only numbers and strings can be set";
+    }
+    char* end;
+    errno = 0;
+    if (type == TAG_Float || type == TAG_Double) {
+        Double d = strtod(text, &end);
+        if (end == text || errno || (*end && !((*end == 'f' || *end == 'F' || *end == 'd' || *end == 'D') && !end[1]))) {
+            return "not a number";
+        }
+        if (type == TAG_Float) {
+            *(Float*) value = (Float) d;
+        } else {
+            *(Double*) value = d;
+        }
+        return NULL;
+    }
+    long long n = strtoll(text, &end, 10);
+    if (end == text || errno || (*end && !(strchr("bBsSlL", *end) && !end[1]))) {
+        return "not an integer";
+    }
+    switch (type) {
+    case TAG_Byte:
+        if (n < INT8_MIN || n > INT8_MAX) {
+            return "out of range";
+        }
+        *(Byte*) value = (Byte) n;
+        break;
+    case TAG_Short:
+        if (n < INT16_MIN || n > INT16_MAX) {
+            return "out of range";
+        }
+        *(Short*) value = (Short) n;
+        break;
+    case TAG_Int:
+        if (n < INT32_MIN || n > INT32_MAX) {
+            return "out of range";
+        }
+        *(Int*) value = (Int) n;
+        break;
+    default:
+        *(Long*) value = (Long) n;
+        break;
+    }
+    return NULL;
+}
+
+static const char* _save(_Document* doc) {
+    if (!doc->dirty) {
+        return NULL;
+    }
+    char* temp;
+    FILE* file = replace_open(doc->path, &temp);
+    if (!file) {
+        return "cannot create file";
+    }
+    CompressOptions options = { .zlib = doc->compression == 15 };
+    bool ok = doc->compression ? write_named_tag_compressed(doc->tag, file, &options)
+                               : write_named_tag(doc->tag, file);
+    struct stat st;
+    if (!replace_close(file, temp, doc->path, ok) || stat(doc->path, &st) != 0) {
+        return "cannot write file";
+    }
+    doc->dirty = false;
+    doc->mtime = st.st_mtim;
+    doc->size = st.st_size;
+    return NULL;
+}
+
+static bool _send(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// runs one request, writing the payload to out; returns an error message on failure
+static const char* _execute(_Server* server, char** fields, size_t count, FILE* out) {
+    const char* command = fields[0];
+    if (strcmp(command, "SHUTDOWN") == 0) {
+        // the loop stops once the requests in flight, this one included, are answered
+        __atomic_store_n(&server->stopping, true, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    if (count < 2) {
+        return "missing file";
+    }
+    if (strcmp(command, "DROP") == 0) {
+        _drop(server, fields[1]);
+        return NULL;
+    }
+    bool save = strcmp(command, "SAVE") == 0;
+    bool set = strcmp(command, "SET") == 0;
+    if (!save && strcmp(command, "GET") != 0 && strcmp(command, "KEYS") != 0 && strcmp(command, "DUMP") != 0 && !set) {
+        return "unknown command";
+    }
+    if (!save && count < (set ? 4u : 3u)) {
+        return set ? "usage: SET <file> <path> <value>" : "missing path";
+    }
+
+    _Document* doc = _acquire(server, fields[1]);
+    if (!doc) {
+        return "out of memory";
+    }
+    const char* error = _lock(server, doc, save || set);
+    if (error) {
+        _release(server, doc);
+        return error;
+    }
+    if (save) {
+        error = _save(doc);
+    } else {
+        enum TAGType type;
+        void* value = _resolve(doc->tag, fields[2], &type);
+        if (!value) {
+            error = "no such path";
+        } else if (set) {
+            if (!(error = _set(type, value, fields[3]))) {
+                doc->dirty = true;
+            }
+        } else if (strcmp(command, "KEYS") == 0) {
+            error = _keys(type, value, out);
+        } else if (!(command[0] == 'G' ? _write_plain(type, value, out) : write_snbt(type, value, out))) {
+            error = "cannot format value";
+        }
+    }
+    pthread_rwlock_unlock(&doc->lock);
+    _release(server, doc);
+    return error;
+}
+
+/* connections */
+
+// a request line longer than this closes the connection
+#define MAX_REQUEST (1 << 20)
+// seconds
+#define SEND_TIMEOUT 30
+
+struct _Connection {
+    int fd;
+    char* buffer; // received, not yet handed to a worker
+    size_t length;
+    size_t capacity;
+    char* request; // the line a worker is answering
+    bool busy;     // a worker has it; under the server's lock
+    bool closed;   // by the peer, or a reply could not be sent
+    _Connection* next_queued;
+};
+
+static void _answer(_Server* server, _Connection* conn) {
+    char* line = conn->request;
+    size_t length = strlen(line);
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+        line[--length] = '\0';
+    }
+    // at most four fields; a value may itself contain tabs
+    char* fields[4];
+    size_t count = 0;
+    char* cursor = line;
+    while (count < 4) {
+        fields[count++] = cursor;
+        char* tab = count < 4 ? strchr(cursor, '\t') : NULL;
+        if (!tab) {
+            break;
+        }
+        *tab = '\0';
+        cursor = tab + 1;
+    }
+
+    char* payload = NULL;
+    size_t payload_length = 0;
+    FILE* out = open_memstream(&payload, &payload_length);
+    const char* error = out ? _execute(server, fields, count, out) : "out of memory";
+    if (out && fclose(out) != 0 && !error) {
+        error = "out of memory";
+    }
+    char header[256];
+    bool ok;
+    if (error) {
+        int header_length = snprintf(header, sizeof(header), "ERR %s\n", error);
+        ok = _send(conn->fd, header, header_length);
+    } else {
+        int header_length = snprintf(header, sizeof(header), "OK %zu\n", payload_length);
+        ok = _send(conn->fd, header, header_length) && _send(conn->fd, payload, payload_length);
+    }
+    free(payload);
+    free(conn->request);
+    conn->request = NULL;
+    if (!ok) {
+        conn->closed = true;
+    }
+}
+
+/* takes the next whole line out of the buffer into conn->request */
+static bool _next_request(_Connection* conn) {
+    char* newline = conn->length ? (char*) memchr(conn->buffer, '\n', conn->length) : NULL;
+    size_t length = newline ? (size_t) (newline - conn->buffer) + 1 : conn->closed ? conn->length : 0;
+    if (length == 0 || !(conn->request = (char*) malloc(length + 1))) {
+        return false;
+    }
+    memcpy(conn->request, conn->buffer, length);
+    conn->request[length] = '\0';
+    conn->length -= length;
+    memmove(conn->buffer, conn->buffer + length, conn->length);
+    return true;
+}
+
+static void _receive(_Connection* conn) {
+    if (conn->capacity - conn->length < 4096) {
+        size_t capacity = conn->capacity ? conn->capacity * 2 : 8192;
+        char* temp = capacity <= 2 * MAX_REQUEST ? (char*) realloc(conn->buffer, capacity) : NULL;
+        if (!temp) {
+            conn->closed = true;
+            conn->length = 0;
+            return;
+        }
+        conn->buffer = temp;
+        conn->capacity = capacity;
+    }
+    ssize_t received = recv(conn->fd, conn->buffer + conn->length, conn->capacity - conn->length, MSG_DONTWAIT);
+    if (received > 0) {
+        conn->length += received;
+        if (conn->length > MAX_REQUEST && !memchr(conn->buffer, '\n', conn->length)) {
+            conn->closed = true;
+            conn->length = 0;
+        }
+    } else if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        conn->closed = true;
+    }
+}
+
+static void _connection_free(_Connection* conn) {
+    close(conn->fd);
+    free(conn->buffer);
+    free(conn->request);
+    free(conn);
+}
+
+/* the pool: workers take connections with a whole request from the queue */
+
+static void _wake(_Server* server) {
+    char byte = 0;
+    ssize_t ignored = write(server->wake[1], &byte, 1); // a full pipe wakes the loop just as well
+    (void) ignored;
+}
+
+static void* _worker(void* arg) {
+    _Server* server = (_Server*) arg;
+    pthread_mutex_lock(&server->lock);
+    while (1) {
+        while (!server->queued && !server->quitting) {
+            pthread_cond_wait(&server->work, &server->lock);
+        }
+        _Connection* conn = server->queued;
+        if (!conn) {
+            break;
+        }
+        server->queued = conn->next_queued;
+        pthread_mutex_unlock(&server->lock);
+        _answer(server, conn);
+        pthread_mutex_lock(&server->lock);
+        conn->busy = false;
+        _wake(server); // the loop watches the connection again
+    }
+    pthread_mutex_unlock(&server->lock);
+    return NULL;
+}
+
+/*
+ * Watches the listener and every idle connection, and queues each request
+ * for the pool, so that a worker is only taken while a request is answered.
+ * Runs requests itself when no worker could be started.
+ */
+static void _serve_loop(_Server* server, bool pooled) {
+    _Connection** conns = NULL;
+    size_t conn_count = 0;
+    size_t conn_capacity = 0;
+    struct pollfd* fds = NULL;
+    _Connection** watched = NULL;
+    size_t fds_capacity = 0;
+
+    while (1) {
+        bool stopping = __atomic_load_n(&server->stopping, __ATOMIC_RELAXED);
+        size_t busy = 0;
+        size_t kept = 0;
+        pthread_mutex_lock(&server->lock);
+        for (size_t i = 0; i < conn_count; i++) {
+            _Connection* conn = conns[i];
+            if (!conn->busy && !stopping && _next_request(conn)) {
+                if (pooled) {
+                    conn->busy = true;
+                    conn->next_queued = NULL;
+                    _Connection** tail = &server->queued;
+                    while (*tail) {
+                        tail = &(*tail)->next_queued;
+                    }
+                    *tail = conn;
+                    pthread_cond_signal(&server->work);
+                } else {
+                    pthread_mutex_unlock(&server->lock);
+                    _answer(server, conn);
+                    pthread_mutex_lock(&server->lock);
+                    stopping = __atomic_load_n(&server->stopping, __ATOMIC_RELAXED);
+                }
+            }
+            if (conn->busy) {
+                busy++;
+            } else if (stopping || (conn->closed && conn->length == 0)) {
+                _connection_free(conn);
+                continue;
+            }
+            conns[kept++] = conn;
+        }
+        conn_count = kept;
+        pthread_mutex_unlock(&server->lock);
+        if (stopping && busy == 0) {
+            break;
+        }
+
+        size_t needed = conn_count + 2;
+        if (needed > fds_capacity) {
+            struct pollfd* temp = (struct pollfd*) realloc(fds, needed * sizeof(struct pollfd));
+            if (temp) {
+                fds = temp;
+                _Connection** temp_watched = (_Connection**) realloc(watched, needed * sizeof(_Connection*));
+                if (temp_watched) {
+                    watched = temp_watched;
+                    fds_capacity = needed;
+                }
+            }
+            if (needed > fds_capacity) {
+                break;
+            }
+        }
+        size_t nfds = 0;
+        fds[nfds++] = (struct pollfd){ .fd = server->wake[0], .events = POLLIN };
+        if (!stopping) {
+            fds[nfds++] = (struct pollfd){ .fd = server->listener, .events = POLLIN };
+        }
+        size_t first_conn = nfds;
+        pthread_mutex_lock(&server->lock);
+        for (size_t i = 0; i < conn_count; i++) {
+            if (!conns[i]->busy && !conns[i]->closed) {
+                watched[nfds - first_conn] = conns[i];
+                fds[nfds++] = (struct pollfd){ .fd = conns[i]->fd, .events = POLLIN };
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        if (fds[0].revents) {
+            char drain[64];
+            while (read(server->wake[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+        for (size_t i = first_conn; i < nfds; i++) {
+            if (fds[i].revents) {
+                _receive(watched[i - first_conn]);
+            }
+        }
+        if (!stopping && fds[1].revents) {
+            int fd;
+            while ((fd = accept(server->listener, NULL, NULL)) >= 0) {
+                _Connection* conn = (_Connection*) calloc(1, sizeof(_Connection));
+                if (conn && conn_count == conn_capacity) {
+                    size_t capacity = conn_capacity ? conn_capacity * 2 : 16;
+                    _Connection** temp = (_Connection**) realloc(conns, capacity * sizeof(_Connection*));
+                    if (temp) {
+                        conns = temp;
+                        conn_capacity = capacity;
+                    }
+                }
+                if (!conn || conn_count == conn_capacity) {
+                    free(conn);
+                    close(fd);
+                    continue;
+                }
+                // a client that stops reading its replies gives up its worker after a while
+                struct timeval timeout = { .tv_sec = SEND_TIMEOUT };
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                conn->fd = fd;
+                conns[conn_count++] = conn;
+            }
+        }
+    }
+
+    // shutting down, or out of memory: idle clients are disconnected
+    for (size_t i = 0; i < conn_count; i++) {
+        _connection_free(conns[i]);
+    }
+    free(conns);
+    free(fds);
+    free(watched);
+}
+
+static bool _address(const char* socket_path, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return false;
+    }
+    strcpy(address->sun_path, socket_path);
+    return true;
+}
+
+bool serve(const char* socket_path, const ServerOptions* options) {
+    struct sockaddr_un address;
+    if (!_address(socket_path, &address)) {
+        return false;
+    }
+    _Server server = {
+        .listener = socket(AF_UNIX, SOCK_STREAM, 0),
+        .parse = options ? options->parse : NULL,
+    };
+    if (server.listener < 0) {
+        perror("socket");
+        return false;
+    }
+
+    // a socket nobody answers on is left over from a previous run
+    struct stat st;
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool live = probe >= 0 && connect(probe, (struct sockaddr*) &address, sizeof(address)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (live) {
+            fprintf(stderr, "Already serving on %s\n", socket_path);
+            close(server.listener);
+            return false;
+        }
+        unlink(socket_path);
+    }
+    if (bind(server.listener, (struct sockaddr*) &address, sizeof(address)) != 0
+            || listen(server.listener, 64) != 0) {
+        perror(socket_path);
+        close(server.listener);
+        return false;
+    }
+    int flags = fcntl(server.listener, F_GETFL);
+    if (flags < 0 || fcntl(server.listener, F_SETFL, flags | O_NONBLOCK) != 0
+            || pipe(server.wake) != 0) {
+        perror(socket_path);
+        close(server.listener);
+        unlink(socket_path);
+        return false;
+    }
+    fcntl(server.wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(server.wake[1], F_SETFL, O_NONBLOCK);
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.work, NULL);
+
+    int thread_count = options && options->threads > 0 ? options->threads : 4;
+    pthread_t* threads = (pthread_t*) calloc(thread_count, sizeof(pthread_t));
+    int started = 0;
+    if (threads) {
+        while (started < thread_count && pthread_create(&threads[started], NULL, _worker, &server) == 0) {
+            started++;
+        }
+    }
+    _serve_loop(&server, started > 0);
+    pthread_mutex_lock(&server.lock);
+    server.quitting = true;
+    pthread_cond_broadcast(&server.work);
+    pthread_mutex_unlock(&server.lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    while (server.documents) {
+        _Document* next = server.documents->next;
+        _document_free(server.documents);
+        server.documents = next;
+    }
+    pthread_cond_destroy(&server.work);
+    pthread_mutex_destroy(&server.lock);
+    close(server.wake[0]);
+    close(server.wake[1]);
+    close(server.listener);
+    unlink(socket_path);
+    return true;
+}
+
+bool server_query(const char* socket_path, const char* request, FILE* out) {
+    struct sockaddr_un address;
+    if (!_address(socket_path, &address)) {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+        perror(socket_path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    FILE* in = fdopen(fd, "r");
+    if (!in) {
+        close(fd);
+        return false;
+    }
+    bool ok = _send(fd, request, strlen(request)) && _send(fd, "\n", 1);
+    char* line = NULL;
+    size_t capacity = 0;
+    if (ok && getline(&line, &capacity, in) > 0) {
+        size_t length;
+        if (sscanf(line, "OK %zu", &length) == 1) {
+            char buffer[4096];
+            while (ok && length > 0) {
+                size_t chunk = length < sizeof(buffer) ? length : sizeof(buffer);
+                ok = fread(buffer, 1, chunk, in) == chunk && fwrite(buffer, 1, chunk, out) == chunk;
+                length -= chunk;
+            }
+        } else {
+            fputs(line, stderr);
+            ok = false;
+        }
+    } else {
+        ok = false;
+    }
+    free(line);
+    fclose(in);
+    return ok;
+}
@@ -0,0 +1,44 @@
+#ifndef NBT_SERVER_H
+#define NBT_SERVER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "nbt_parse.h"
+
+/*
+ * A daemon that keeps documents parsed and answers queries about them over a
+ * Unix domain socket, so that tools need not re-read and re-parse a file for
+ * every question.
+ *
+ * Requests are single lines of tab-separated fields:
+ *   GET    <file> <path>          a scalar as plain text, containers as SNBT
+ *   KEYS   <file> <path>          "<key>\t<type>" per entry of a compound or list
+ *   DUMP   <file> <path>          SNBT
+ *   SET    <file> <path> <value>  replaces a number or string in memory
+ *   SAVE   <file>                 writes changes back, compressed if the file was
+ *   DROP   <file>                 forgets the document, unsaved changes included
+ *   SHUTDOWN
+ * An empty path names the root. Each request is answered with either
+ * "OK <length>\n" followed by length bytes, or "ERR <message>\n".
+ *
+ * Documents are loaded on first use and re-parsed when the file changes on
+ * disk, unless they have unsaved changes. Readers of a document run
+ * concurrently; SET and SAVE take it exclusively.
+ *
+ * One thread watches all connections and hands each request to a pool, so
+ * an idle client holds no worker. SHUTDOWN waits for the requests being
+ * answered, then disconnects every client.
+ */
+
+typedef struct ServerOptions {
+    int threads;                // requests answered at once, 0 for 4
+    const ParseOptions* parse;  // may be NULL
+} ServerOptions;
+
+/* listens on socket_path, replacing a stale socket, until SHUTDOWN; false if that fails */
+bool serve(const char* socket_path, const ServerOptions*);
+
+/* sends one request and writes the reply's payload to out; false on ERR or failure */
+bool server_query(const char* socket_path, const char* request, FILE* out);
+
+#endif // NBT_SERVER_H
@@ -0,0 +1,171 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_snbt.h"
+#include "nbt_columnar.h"
+#include "nbt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+static bool _plain_key(const char* key, size_t length) {
+    if (length == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        char c = key[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+                || c == '_' || c == '-' || c == '.' || c == '+')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool _write_quoted(FILE* file, const char* data, size_t length) {
+    if (putc('"', file) == EOF) {
+        return false;
+    }
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] == '"' || data[i] == '\\') {
+            if (fwrite(data + start, 1, i - start, file) != i - start || putc('\\', file) == EOF) {
+                return false;
+            }
+            start = i;
+        }
+    }
+    return fwrite(data + start, 1, length - start, file) == length - start && putc('"', file) != EOF;
+}
+
+static bool _write_real(FILE* file, Double value, bool single) {
+    char suffix = single ? 'f' : 'd';
+    if (isnan(value)) {
+        errno = EDOM;
+        return false;
+    }
+    if (isinf(value)) {
+        // too large for the type, so it reads back as infinity
+        return fprintf(file, "%s%s%c", value < 0 ? "-" : "", single ? "1e39" : "1e309", suffix) > 0;
+    }
+    // shortest form that reads back to the same value, always with a decimal point
+    int digits = single ? 9 : 17;
+    char text[40];
+    snprintf(text, sizeof(text), "%.*g", digits, value);
+    for (int precision = 1; precision < digits; precision++) {
+        char shorter[40];
+        if (snprintf(shorter, sizeof(shorter), "%.*g", precision, value) >= (int) sizeof(shorter)) {
+            continue;
+        }
+        if (single ? (Float) strtod(shorter, NULL) == (Float) value : strtod(shorter, NULL) == value) {
+            memcpy(text, shorter, sizeof(text));
+            digits = precision;
+            break;
+        }
+    }
+    // %g switches to an exponent once there are fewer digits than places, so 30.0 came out as 3e+01
+    const char* exponent = strchr(text, 'e');
+    int places = exponent ? atoi(exponent + 1) : 0;
+    if (exponent && places >= 0 && places < (single ? 9 : 17)) {
+        snprintf(text, sizeof(text), "%.*f", places >= digits - 1 ? 0 : digits - 1 - places, value);
+    }
+    if (strchr(text, '.')) {
+        return fprintf(file, "%s%c", text, suffix) > 0;
+    }
+    size_t mantissa = strcspn(text, "e"); // 1e+30 becomes 1.0e+30
+    return fprintf(file, "%.*s.0%s%c", (int) mantissa, text, text + mantissa, suffix) > 0;
+}
+
+bool write_snbt(enum TAGType type, const void* value, FILE* file) {
+    switch (type) {
+    case TAG_Byte:
+        return fprintf(file, "%db", *(const Byte*) value) > 0;
+    case TAG_Short:
+        return fprintf(file, "%ds", *(const Short*) value) > 0;
+    case TAG_Int:
+        return fprintf(file, "%d", *(const Int*) value) > 0;
+    case TAG_Long:
+        return fprintf(file, "%lldL", (long long) *(const Long*) value) > 0;
+    case TAG_Float:
+        return _write_real(file, *(const Float*) value, true);
+    case TAG_Double:
+        return _write_real(file, *(const Double*) value, false);
+    case TAG_String:
+    {
+        const String* str = (const String*) value;
+        return _write_quoted(file, String_data(str), str->length);
+    }
+    case TAG_Byte_Array:
+    case TAG_Int_Array:
+    case TAG_Long_Array:
+    {
+        const Byte_Array* arr = (const Byte_Array*) value; // all three share a layout
+        enum TAGType element = type == TAG_Byte_Array ? TAG_Byte : type == TAG_Int_Array ? TAG_Int : TAG_Long;
+        if (fprintf(file, "[%c;", type == TAG_Byte_Array ? 'B' : type == TAG_Int_Array ? 'I' : 'L') < 0) {
+            return false;
+        }
+        for (Int i = 0; i < arr->length; i++) {
+            if ((i > 0 && putc(',', file) == EOF)
+                    || !write_snbt(element, (const char*) arr->data + (size_t) i * sizeof_type[element], file)) {
+                return false;
+            }
+        }
+        return putc(']', file) != EOF;
+    }
+    case TAG_List:
+    {
+        const List* list = (const List*) value;
+        if (putc('[', file) == EOF) {
+            return false;
+        }
+        for (Int i = 0; i < list->length; i++) {
+            if (i > 0 && putc(',', file) == EOF) {
+                return false;
+            }
+            if (list->columnar) {
+                Compound element;
+                if (!List_element_view(list, i, &element)) {
+                    return false;
+                }
+                bool ok = write_snbt(TAG_Compound, &element, file);
+                free(element.tags);
+                if (!ok) {
+                    return false;
+                }
+            } else if (!write_snbt(list->type, (const char*) list->tags + (size_t) i * sizeof_type[list->type], file)) {
+                return false;
+            }
+        }
+        return putc(']', file) != EOF;
+    }
+    case TAG_Compound:
+    {
+        const Compound* compound = (const Compound*) value;
+        if (putc('{', file) == EOF) {
+            return false;
+        }
+        for (Int i = 0; i < compound->size; i++) {
+            const NamedTag* child = &compound->tags[i];
+            const char* key = String_data(&child->name);
+            if (i > 0 && putc(',', file) == EOF) {
+                return false;
+            }
+            bool ok = _plain_key(key, child->name.length)
+                    ? fwrite(key, 1, child->name.length, file) == child->name.length
+                    : _write_quoted(file, key, child->name.length);
+            if (!ok || putc(':', file) == EOF || !write_snbt(child->type, &child->byte_value, file)) {
+                return false;
+            }
+        }
+        return putc('}', file) != EOF;
+    }
+    default:
+        return false;
+    }
+}
+
+bool write_named_tag_snbt(const NamedTag* tag, FILE* file) {
+    return write_snbt(tag->type, &tag->byte_value, file);
+}
@@ -0,0 +1,23 @@
+#ifndef NBT_SNBT_H
+#define NBT_SNBT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "nbt.h"
+
+/*
+ * Stringified NBT, the text form used by Minecraft commands:
+ *   {name:"Bananrama",pos:[I;1,2,3],health:20.0f,tags:["a","b"]}
+ * Output is compact. Keys are quoted when they are not plain words. Strings
+ * are written in double quotes with \ and " escaped. Reals always have a
+ * decimal point, and infinities are written as a literal too large for the
+ * type (1e309d, -1e39f) so they read back as infinity. SNBT has no way to
+ * spell NaN, so writing one fails with errno set to EDOM.
+ */
+
+/* writes a payload as passed to write_payload() */
+bool write_snbt(enum TAGType, const void* value, FILE*);
+/* the root's payload; names of root tags have no place in SNBT */
+bool write_named_tag_snbt(const NamedTag*, FILE*);
+
+#endif // NBT_SNBT_H
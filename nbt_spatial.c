@@ -0,0 +1,621 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_spatial.h"
+#include "nbt_region.h"
+#include "nbt_parse.h"
+#include "nbt_replace.h"
+#include "nbt.h"
+#include "nbt_hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const int DEFAULT_THREADS = 4;
+
+/* labels, interned */
+
+typedef struct {
+    char** names;
+    size_t count;
+    size_t capacity;
+    uint32_t* slots; // index + 1, 0 for empty
+    size_t slot_count;
+} _Labels;
+
+static bool _labels_grow(_Labels* labels) {
+    size_t slot_count = labels->slot_count ? labels->slot_count * 2 : 64;
+    uint32_t* slots = (uint32_t*) calloc(slot_count, sizeof(uint32_t));
+    if (!slots) {
+        return false;
+    }
+    for (size_t i = 0; i < labels->count; i++) {
+        size_t slot = fnv1a_string(labels->names[i]) & (slot_count - 1);
+        while (slots[slot]) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = i + 1;
+    }
+    free(labels->slots);
+    labels->slots = slots;
+    labels->slot_count = slot_count;
+    return true;
+}
+
+/* the index of name, added if it is new; UINT32_MAX when out of memory */
+static uint32_t _labels_intern(_Labels* labels, const char* name) {
+    if (2 * (labels->count + 1) > labels->slot_count && !_labels_grow(labels)) {
+        return UINT32_MAX;
+    }
+    size_t slot = fnv1a_string(name) & (labels->slot_count - 1);
+    for (; labels->slots[slot]; slot = (slot + 1) & (labels->slot_count - 1)) {
+        if (strcmp(labels->names[labels->slots[slot] - 1], name) == 0) {
+            return labels->slots[slot] - 1;
+        }
+    }
+    if (labels->count == labels->capacity) {
+        size_t capacity = labels->capacity ? labels->capacity * 2 : 64;
+        char** temp = (char**) realloc(labels->names, capacity * sizeof(char*));
+        if (!temp) {
+            return UINT32_MAX;
+        }
+        labels->names = temp;
+        labels->capacity = capacity;
+    }
+    if (!(labels->names[labels->count] = strdup(name))) {
+        return UINT32_MAX;
+    }
+    labels->slots[slot] = labels->count + 1;
+    return labels->count++;
+}
+
+static void _labels_destroy(_Labels* labels) {
+    for (size_t i = 0; i < labels->count; i++) {
+        free(labels->names[i]);
+    }
+    free(labels->names);
+    free(labels->slots);
+}
+
+/* extraction */
+
+typedef struct {
+    SpatialRecord* records; // labels are indices into the worker's own labels until written
+    size_t count;
+    size_t capacity;
+    _Labels labels;
+    SpatialStats stats;
+    bool failed;
+} _Worker;
+
+typedef struct {
+    char** regions;
+    bool* entity_files;
+    size_t count;
+    size_t next;
+} _BuildJob;
+
+static void _add(_Worker* w, enum SpatialKind kind, int32_t x, int32_t y, int32_t z, const char* label) {
+    if (w->count == w->capacity) {
+        size_t capacity = w->capacity ? w->capacity * 2 : 1024;
+        SpatialRecord* temp = (SpatialRecord*) realloc(w->records, capacity * sizeof(SpatialRecord));
+        if (!temp) {
+            w->failed = true;
+            return;
+        }
+        w->records = temp;
+        w->capacity = capacity;
+    }
+    uint32_t index = _labels_intern(&w->labels, label ? label : "");
+    if (index == UINT32_MAX) {
+        w->failed = true;
+        return;
+    }
+    w->records[w->count++] = (SpatialRecord){ .x = x, .y = y, .z = z, .label = index, .kind = kind };
+    if (kind == SPATIAL_CHUNK) {
+        w->stats.chunks++;
+    } else if (kind == SPATIAL_ENTITY) {
+        w->stats.entities++;
+    } else {
+        w->stats.block_entities++;
+    }
+}
+
+static NamedTag* _find(Compound* compound, const char* key, enum TAGType type) {
+    NamedTag* tag = Compound_find(compound, key);
+    return tag && tag->type == type ? tag : NULL;
+}
+
+static const char* _string(Compound* compound, const char* key) {
+    NamedTag* tag = _find(compound, key, TAG_String);
+    return tag ? String_data(&tag->string_value) : NULL;
+}
+
+static bool _integer(Compound* compound, const char* key, int32_t* value) {
+    NamedTag* tag = Compound_find(compound, key);
+    if (!tag) {
+        return false;
+    }
+    switch (tag->type) {
+    case TAG_Byte:
+        *value = tag->byte_value;
+        return true;
+    case TAG_Short:
+        *value = tag->short_value;
+        return true;
+    case TAG_Int:
+        *value = tag->int_value;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* entities have a Pos of three doubles */
+static void _add_entities(_Worker* w, Compound* chunk, const char* key) {
+    NamedTag* list = _find(chunk, key, TAG_List);
+    if (!list || list->list_value.type != TAG_Compound) {
+        return;
+    }
+    Compound* entities = (Compound*) list->list_value.tags;
+    for (Int i = 0; i < list->list_value.length; i++) {
+        NamedTag* pos = _find(&entities[i], "Pos", TAG_List);
+        if (!pos || pos->list_value.type != TAG_Double || pos->list_value.length != 3) {
+            continue;
+        }
+        const Double* xyz = (const Double*) pos->list_value.tags;
+        if (!isfinite(xyz[0]) || !isfinite(xyz[1]) || !isfinite(xyz[2])
+                || fabs(xyz[0]) > INT32_MAX || fabs(xyz[1]) > INT32_MAX || fabs(xyz[2]) > INT32_MAX) {
+            continue;
+        }
+        _add(w, SPATIAL_ENTITY, (int32_t) floor(xyz[0]), (int32_t) floor(xyz[1]), (int32_t) floor(xyz[2]),
+             _string(&entities[i], "id"));
+    }
+}
+
+/* block entities have integer x, y and z */
+static void _add_block_entities(_Worker* w, Compound* chunk, const char* key) {
+    NamedTag* list = _find(chunk, key, TAG_List);
+    if (!list || list->list_value.type != TAG_Compound) {
+        return;
+    }
+    Compound* block_entities = (Compound*) list->list_value.tags;
+    for (Int i = 0; i < list->list_value.length; i++) {
+        int32_t x, y, z;
+        if (_integer(&block_entities[i], "x", &x) && _integer(&block_entities[i], "y", &y)
+                && _integer(&block_entities[i], "z", &z)) {
+            _add(w, SPATIAL_BLOCK_ENTITY, x, y, z, _string(&block_entities[i], "id"));
+        }
+    }
+}
+
+static void _visit_chunk(_Worker* w, NamedTag* root, int chunk_x, int chunk_z, bool entity_file) {
+    if (root->type != TAG_Compound) {
+        w->stats.errors++;
+        return;
+    }
+    Compound* chunk = &root->compound_value;
+    if (entity_file) {
+        _add_entities(w, chunk, "Entities");
+        return;
+    }
+    // before 1.18 everything sat in Level and entities were stored with their chunk
+    NamedTag* level = _find(chunk, "Level", TAG_Compound);
+    if (level) {
+        chunk = &level->compound_value;
+    }
+    _add(w, SPATIAL_CHUNK, chunk_x * 16, 0, chunk_z * 16, _string(chunk, "Status"));
+    _add_block_entities(w, chunk, level ? "TileEntities" : "block_entities");
+    _add_entities(w, chunk, "Entities");
+}
+
+static bool _discard_array(void* userdata, const ArrayChunk* chunk) {
+    (void) userdata;
+    (void) chunk;
+    return true;
+}
+
+static void _build_region(_Worker* w, const char* path, bool entity_file) {
+    RegionFile* region = RegionFile_open(path, false);
+    w->stats.regions++;
+    if (!region) {
+        w->stats.errors++;
+        return;
+    }
+    const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    int region_x = 0;
+    int region_z = 0;
+    sscanf(name, "r.%d.%d.mca", &region_x, &region_z);
+    // block states, heightmaps and the like are dropped as they stream past
+    ParseOptions options = {
+        .array_callback = _discard_array,
+        .array_min_length = 16,
+    };
+    for (int z = 0; z < 32 && !w->failed; z++) {
+        for (int x = 0; x < 32 && !w->failed; x++) {
+            if (!RegionFile_has_chunk(region, x, z)) {
+                continue;
+            }
+            NamedTag* root = RegionFile_read_chunk(region, x, z, &options, NULL);
+            if (!root) {
+                w->stats.errors++;
+                continue;
+            }
+            _visit_chunk(w, root, region_x * 32 + x, region_z * 32 + z, entity_file);
+            NamedTag_free(root);
+        }
+    }
+    RegionFile_close(region);
+}
+
+typedef struct {
+    _BuildJob* job;
+    _Worker worker;
+} _Thread;
+
+static void* _build_worker(void* arg) {
+    _Thread* thread = (_Thread*) arg;
+    _BuildJob* job = thread->job;
+    while (!thread->worker.failed) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count) {
+            break;
+        }
+        _build_region(&thread->worker, job->regions[i], job->entity_files[i]);
+    }
+    return NULL;
+}
+
+static bool _add_regions(const char* dimension, const char* directory, bool entity_files, _BuildJob* job) {
+    size_t size = strlen(dimension) + strlen(directory) + 2;
+    char* path = (char*) malloc(size);
+    if (!path) {
+        return false;
+    }
+    snprintf(path, size, "%s/%s", dimension, directory);
+    DIR* dir = opendir(path);
+    if (!dir) {
+        free(path);
+        return true;
+    }
+    struct dirent* entry;
+    bool ok = true;
+    while (ok && (entry = readdir(dir))) {
+        int x, z;
+        size_t name_length = strlen(entry->d_name);
+        if (sscanf(entry->d_name, "r.%d.%d.", &x, &z) != 2 || name_length < 4
+                || strcmp(entry->d_name + name_length - 4, ".mca") != 0) {
+            continue;
+        }
+        size_t full_size = strlen(path) + name_length + 2;
+        char* full = (char*) malloc(full_size);
+        char** regions = full ? (char**) realloc(job->regions, (job->count + 1) * sizeof(char*)) : NULL;
+        bool* flags = regions ? (bool*) realloc(job->entity_files, (job->count + 1) * sizeof(bool)) : NULL;
+        if (regions) {
+            job->regions = regions;
+        }
+        if (!flags) {
+            free(full);
+            ok = false;
+            break;
+        }
+        job->entity_files = flags;
+        snprintf(full, full_size, "%s/%s", path, entry->d_name);
+        job->regions[job->count] = full;
+        job->entity_files[job->count++] = entity_files;
+    }
+    closedir(dir);
+    free(path);
+    return ok;
+}
+
+/* writing */
+
+static int _compare_records(const void* a, const void* b) {
+    const SpatialRecord* x = (const SpatialRecord*) a;
+    const SpatialRecord* y = (const SpatialRecord*) b;
+    int32_t xz = x->z >> SPATIAL_CELL_SHIFT, yz = y->z >> SPATIAL_CELL_SHIFT;
+    int32_t xx = x->x >> SPATIAL_CELL_SHIFT, yx = y->x >> SPATIAL_CELL_SHIFT;
+    if (xz != yz) {
+        return xz < yz ? -1 : 1;
+    }
+    if (xx != yx) {
+        return xx < yx ? -1 : 1;
+    }
+    return x->kind - y->kind;
+}
+
+static bool _write(const char* index_path, SpatialRecord* records, size_t count, const _Labels* labels) {
+    // labels become offsets into the table written at the end
+    uint32_t* offsets = (uint32_t*) malloc((labels->count ? labels->count : 1) * sizeof(uint32_t));
+    if (!offsets) {
+        return false;
+    }
+    uint64_t labels_size = 0;
+    for (size_t i = 0; i < labels->count; i++) {
+        offsets[i] = labels_size;
+        labels_size += strlen(labels->names[i]) + 1;
+    }
+    if (labels_size > UINT32_MAX || count > UINT32_MAX) {
+        free(offsets);
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        records[i].label = offsets[records[i].label];
+    }
+    free(offsets);
+    qsort(records, count, sizeof(SpatialRecord), _compare_records);
+
+    // at most one cell per record
+    SpatialCell* cells = (SpatialCell*) calloc(count ? count : 1, sizeof(SpatialCell));
+    if (!cells) {
+        return false;
+    }
+    size_t cell_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        int32_t x = records[i].x >> SPATIAL_CELL_SHIFT;
+        int32_t z = records[i].z >> SPATIAL_CELL_SHIFT;
+        if (cell_count == 0 || cells[cell_count - 1].x != x || cells[cell_count - 1].z != z) {
+            cells[cell_count++] = (SpatialCell){ .x = x, .z = z, .first = i };
+        }
+        cells[cell_count - 1].count++;
+    }
+
+    char* temp;
+    FILE* out = replace_open(index_path, &temp);
+    if (!out) {
+        perror(index_path);
+        free(cells);
+        return false;
+    }
+    SpatialHeader header = {
+        .magic = SPATIAL_MAGIC,
+        .cell_count = cell_count,
+        .record_count = count,
+        .labels_size = labels_size,
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+            && fwrite(cells, sizeof(SpatialCell), cell_count, out) == cell_count
+            && fwrite(records, sizeof(SpatialRecord), count, out) == count;
+    for (size_t i = 0; ok && i < labels->count; i++) {
+        ok = fwrite(labels->names[i], 1, strlen(labels->names[i]) + 1, out) == strlen(labels->names[i]) + 1;
+    }
+    ok = replace_close(out, temp, index_path, ok);
+    if (!ok) {
+        perror(index_path);
+    }
+    free(cells);
+    return ok;
+}
+
+bool spatial_build(const char* dimension, const char* index_path, int threads, SpatialStats* stats) {
+    _BuildJob job = {0};
+    bool ok = _add_regions(dimension, "region", false, &job) && _add_regions(dimension, "entities", true, &job);
+    if (ok && job.count == 0) {
+        fprintf(stderr, "No region files in %s\n", dimension);
+        ok = false;
+    }
+    if (threads <= 0) {
+        threads = DEFAULT_THREADS;
+    }
+    if ((size_t) threads > job.count) {
+        threads = job.count ? job.count : 1;
+    }
+    _Thread* workers = ok ? (_Thread*) calloc(threads, sizeof(_Thread)) : NULL;
+    pthread_t* ids = ok ? (pthread_t*) calloc(threads, sizeof(pthread_t)) : NULL;
+    int started = 0;
+    if (workers && ids) {
+        for (int i = 0; i < threads; i++) {
+            workers[i].job = &job;
+        }
+        for (int i = 1; i < threads; i++) {
+            if (pthread_create(&ids[started], NULL, _build_worker, &workers[i]) != 0) {
+                break;
+            }
+            started++;
+        }
+        _build_worker(&workers[0]);
+        for (int i = 0; i < started; i++) {
+            pthread_join(ids[i], NULL);
+        }
+    } else {
+        ok = false;
+    }
+
+    // gather every worker's records, with labels renumbered into one table
+    _Labels labels = {0};
+    SpatialRecord* records = NULL;
+    size_t count = 0;
+    SpatialStats total = {0};
+    for (int i = 0; ok && i <= started; i++) {
+        _Worker* w = &workers[i].worker;
+        SpatialRecord* temp = w->failed ? NULL
+                : (SpatialRecord*) realloc(records, (count + w->count + 1) * sizeof(SpatialRecord));
+        uint32_t* renumber = temp ? (uint32_t*) malloc((w->labels.count + 1) * sizeof(uint32_t)) : NULL;
+        if (temp) {
+            records = temp;
+        }
+        if (!renumber) {
+            ok = false;
+            break;
+        }
+        for (size_t j = 0; ok && j < w->labels.count; j++) {
+            renumber[j] = _labels_intern(&labels, w->labels.names[j]);
+            ok = renumber[j] != UINT32_MAX;
+        }
+        for (size_t j = 0; ok && j < w->count; j++) {
+            records[count] = w->records[j];
+            records[count++].label = renumber[w->records[j].label];
+        }
+        free(renumber);
+        total.regions += w->stats.regions;
+        total.chunks += w->stats.chunks;
+        total.entities += w->stats.entities;
+        total.block_entities += w->stats.block_entities;
+        total.errors += w->stats.errors;
+    }
+    if (ok) {
+        ok = _write(index_path, records, count, &labels);
+    }
+    if (stats) {
+        *stats = total;
+    }
+
+    for (int i = 0; workers && i < threads; i++) {
+        free(workers[i].worker.records);
+        _labels_destroy(&workers[i].worker.labels);
+    }
+    free(workers);
+    free(ids);
+    free(records);
+    _labels_destroy(&labels);
+    for (size_t i = 0; i < job.count; i++) {
+        free(job.regions[i]);
+    }
+    free(job.regions);
+    free(job.entity_files);
+    return ok;
+}
+
+/* querying */
+
+/* every cell within the records and every label within the table, so queries need no checks */
+static bool _valid(const SpatialIndex* index) {
+    const SpatialHeader* header = index->header;
+    for (uint32_t i = 0; i < header->cell_count; i++) {
+        const SpatialCell* cell = &index->cells[i];
+        if (cell->first > header->record_count || cell->count > header->record_count - cell->first) {
+            return false;
+        }
+    }
+    if (header->record_count > 0 && (header->labels_size == 0 || index->labels[header->labels_size - 1] != '\0')) {
+        return false;
+    }
+    for (uint32_t i = 0; i < header->record_count; i++) {
+        if (index->records[i].label >= header->labels_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SpatialIndex* SpatialIndex_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    SpatialIndex* index = (SpatialIndex*) calloc(1, sizeof(SpatialIndex));
+    void* map = MAP_FAILED;
+    if (index && fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(SpatialHeader)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "%s is not a spatial index\n", path);
+        free(index);
+        return NULL;
+    }
+    index->header = (const SpatialHeader*) map;
+    index->size = st.st_size;
+
+    const SpatialHeader* header = index->header;
+    size_t records_offset = sizeof(SpatialHeader) + (size_t) header->cell_count * sizeof(SpatialCell);
+    size_t labels_offset = records_offset + (size_t) header->record_count * sizeof(SpatialRecord);
+    if (memcmp(header->magic, SPATIAL_MAGIC, sizeof(header->magic)) != 0
+            || labels_offset > index->size || header->labels_size > index->size - labels_offset) {
+        fprintf(stderr, "%s is not a spatial index\n", path);
+        SpatialIndex_close(index);
+        return NULL;
+    }
+    index->cells = (const SpatialCell*) (header + 1);
+    index->records = (const SpatialRecord*) ((const char*) header + records_offset);
+    index->labels = (const char*) header + labels_offset;
+    if (!_valid(index)) {
+        fprintf(stderr, "%s is corrupt\n", path);
+        SpatialIndex_close(index);
+        return NULL;
+    }
+    return index;
+}
+
+void SpatialIndex_close(SpatialIndex* index) {
+    if (!index) {
+        return;
+    }
+    if (index->header) {
+        munmap((void*) index->header, index->size);
+    }
+    free(index);
+}
+
+/* the first cell at or after (x, z) in z, x order */
+static size_t _first_cell(const SpatialIndex* index, int32_t x, int32_t z) {
+    size_t low = 0;
+    size_t high = index->header->cell_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        const SpatialCell* cell = &index->cells[middle];
+        if (cell->z < z || (cell->z == z && cell->x < x)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static bool _inside(const SpatialRecord* record, const SpatialBox* box) {
+    if (record->kind == SPATIAL_CHUNK) {
+        return record->x <= box->max_x && (int64_t) record->x + 15 >= box->min_x
+            && record->z <= box->max_z && (int64_t) record->z + 15 >= box->min_z;
+    }
+    return record->x >= box->min_x && record->x <= box->max_x
+        && record->y >= box->min_y && record->y <= box->max_y
+        && record->z >= box->min_z && record->z <= box->max_z;
+}
+
+size_t SpatialIndex_query(const SpatialIndex* index, const SpatialBox* box, unsigned kinds,
+                          SpatialCallback callback, void* userdata) {
+    size_t matches = 0;
+    int32_t min_x = box->min_x >> SPATIAL_CELL_SHIFT;
+    int32_t max_x = box->max_x >> SPATIAL_CELL_SHIFT;
+    int32_t max_z = box->max_z >> SPATIAL_CELL_SHIFT;
+    // one binary search per row of cells, then a walk along it
+    for (int64_t z = box->min_z >> SPATIAL_CELL_SHIFT; z <= max_z; z++) {
+        size_t first = _first_cell(index, min_x, (int32_t) z);
+        if (first == index->header->cell_count || index->cells[first].z > z) {
+            // nothing in this row; skip straight to the next row that has cells
+            if (first == index->header->cell_count) {
+                break;
+            }
+            z = index->cells[first].z - 1;
+            continue;
+        }
+        for (size_t c = first; c < index->header->cell_count; c++) {
+            const SpatialCell* cell = &index->cells[c];
+            if (cell->z != z || cell->x > max_x) {
+                break;
+            }
+            for (uint32_t r = cell->first; r < cell->first + cell->count; r++) {
+                const SpatialRecord* record = &index->records[r];
+                if (!(record->kind & kinds) || !_inside(record, box)) {
+                    continue;
+                }
+                matches++;
+                if (callback && !callback(userdata, record, SpatialRecord_label(index, record))) {
+                    return matches;
+                }
+            }
+        }
+    }
+    return matches;
+}
@@ -0,0 +1,101 @@
+#ifndef NBT_SPATIAL_H
+#define NBT_SPATIAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * On-disk spatial index of the chunks, entities and block entities of one
+ * dimension, for box queries that never touch the region files.
+ *
+ * spatial_build() scans the region files in dimension/region and
+ * dimension/entities on a pool of threads, where dimension is a world
+ * directory or its DIM-1 or DIM1 directory. Chunk records carry the chunk's Status,
+ * entities and block entities their id; both the 1.18 layout and the older
+ * one under Level are understood. Large arrays such as block states are
+ * discarded while parsing.
+ *
+ * Records are bucketed in a grid of chunk-sized columns. The file is mapped
+ * by SpatialIndex_open() and its layout is host-endian:
+ *   SpatialHeader
+ *   SpatialCell[cell_count], by z then x
+ *   SpatialRecord[record_count], grouped by cell
+ *   NUL-terminated labels
+ */
+
+#define SPATIAL_MAGIC "NBTSPX1"
+#define SPATIAL_CELL_SHIFT 4
+
+enum SpatialKind {
+    SPATIAL_CHUNK = 1,
+    SPATIAL_ENTITY = 2,
+    SPATIAL_BLOCK_ENTITY = 4
+};
+
+typedef struct SpatialHeader {
+    char magic[8];
+    uint32_t cell_count;
+    uint32_t record_count;
+    uint64_t labels_size;
+} SpatialHeader;
+
+typedef struct SpatialCell {
+    int32_t x; // block coordinate >> SPATIAL_CELL_SHIFT
+    int32_t z;
+    uint32_t first;
+    uint32_t count;
+} SpatialCell;
+
+typedef struct SpatialRecord {
+    int32_t x; // block coordinates; a chunk's lowest corner, with y 0
+    int32_t y;
+    int32_t z;
+    uint32_t label; // offset of the id or status in the labels
+    uint8_t kind;
+    uint8_t reserved[3];
+} SpatialRecord;
+
+typedef struct SpatialStats {
+    uint64_t regions;
+    uint64_t chunks;
+    uint64_t entities;
+    uint64_t block_entities;
+    uint64_t errors;
+} SpatialStats;
+
+typedef struct SpatialIndex {
+    const SpatialHeader* header;
+    size_t size;
+    const SpatialCell* cells;
+    const SpatialRecord* records;
+    const char* labels;
+} SpatialIndex;
+
+/* inclusive; chunks match when their column meets the box, whatever its y range */
+typedef struct SpatialBox {
+    int32_t min_x;
+    int32_t min_y;
+    int32_t min_z;
+    int32_t max_x;
+    int32_t max_y;
+    int32_t max_z;
+} SpatialBox;
+
+/* called for each match; returning false ends the query */
+typedef bool (*SpatialCallback)(void* userdata, const SpatialRecord*, const char* label);
+
+/* threads 0 for 4; stats may be NULL; false if nothing could be written or no region file was found */
+bool spatial_build(const char* dimension, const char* index_path, int threads, SpatialStats*);
+
+SpatialIndex* SpatialIndex_open(const char* path);
+void SpatialIndex_close(SpatialIndex*);
+
+/* kinds is a mask of enum SpatialKind; returns the number of matches reported */
+size_t SpatialIndex_query(const SpatialIndex*, const SpatialBox*, unsigned kinds, SpatialCallback, void* userdata);
+
+static inline const char* SpatialRecord_label(const SpatialIndex* index, const SpatialRecord* record) {
+    return index->labels + record->label;
+}
+
+#endif // NBT_SPATIAL_H
@@ -11,7 +11,7 @@ void traverse(NamedTag* root, const int level) {
 
     if (!root) return;
     _indent(level * 4);
-    printf("%s(\"%s\")", tag_name[root->type], root->name.data ? (char*)root->name.data : "");
+    printf("%s(\"%s\")", tag_name[root->type], String_data(&root->name));
     
     switch (root->type) {
         struct {
@@ -43,48 +43,48 @@ void traverse(NamedTag* root, const int level) {
         printf(": %f", root->double_value);
         break;
     case TAG_Byte_Array:
-        array_options.length = root->byte_array_value->length;
+        array_options.length = root->byte_array_value.length;
         array_options.element_size = sizeof(Byte);
         array_options.type = TAG_Byte;
         array_options.format_specifier = "%hhd";
-        array_options.pointer = root->byte_array_value->data;
+        array_options.pointer = root->byte_array_value.data;
         goto array;
     case TAG_String:
-        printf(": \"%s\"", root->string_value->data);
+        printf(": \"%s\"", String_data(&root->string_value));
         break;
     case TAG_List:
-        printf(": %d entries of type %s\n", root->list_value->length, tag_name[root->list_value->type]);
+        printf(": %d entries of type %s\n", root->list_value.length, tag_name[root->list_value.type]);
         // _indent(level * 4);
         // puts("{");
-        // for (int i = 0; i < root->list_value->length; ++i) {
-        //     _traverse(&root->list_value->tags[i], level + 1);
+        // for (int i = 0; i < root->list_value.length; ++i) {
+        //     _traverse(&root->list_value.tags[i], level + 1);
         // }
         // _indent(level * 4);
         // putchar('}');
         break;
     case TAG_Compound:
-        printf(": %d entries\n", root->compound_value->size);
+        printf(": %d entries\n", root->compound_value.size);
         _indent(level * 4);
         puts("{");
-        for (Int i = 0; i < root->compound_value->size; ++i) {
-            traverse(&root->compound_value->tags[i], level + 1);
+        for (Int i = 0; i < root->compound_value.size; ++i) {
+            traverse(&root->compound_value.tags[i], level + 1);
         }
         _indent(level * 4);
         printf("}");
         break;
     case TAG_Int_Array:
-        array_options.length = root->int_array_value->length;
+        array_options.length = root->int_array_value.length;
         array_options.element_size = sizeof(Int);
         array_options.type = TAG_Int;
         array_options.format_specifier = "%d";
-        array_options.pointer = root->int_array_value->data;
+        array_options.pointer = root->int_array_value.data;
         goto array;
     case TAG_Long_Array:
-        array_options.length = root->long_array_value->length;
+        array_options.length = root->long_array_value.length;
         array_options.element_size = sizeof(Long);
         array_options.type = TAG_Long;
         array_options.format_specifier = "%ld";
-        array_options.pointer = root->long_array_value->data;
+        array_options.pointer = root->long_array_value.data;
         goto array;
     array:
         printf(": %d elements of type %s\n", array_options.length, tag_name[array_options.type]);
@@ -0,0 +1,229 @@
+#define _DEFAULT_SOURCE
+
+#include "nbt_write.h"
+#include "nbt_mutf8.h"
+#include "nbt_columnar.h"
+#include "zpipe.h"
+#include "nbt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nbt_endian.h"
+
+static bool _write(FILE* file, const void* data, size_t size, size_t count) {
+    return fwrite(data, size, count, file) == count;
+}
+
+static bool _write_string(FILE* file, const String* str, const WriteOptions* options) {
+    const char* data = String_data(str);
+    size_t length = str->length;
+    char* converted = NULL;
+    if (options && options->utf8_strings) {
+        length = utf8_to_mutf8_length(data, str->length);
+        if (length == MUTF8_INVALID || length > UINT16_MAX) {
+            return false;
+        }
+        if (length != str->length) {
+            // only strings with NULs or characters beyond the BMP change
+            converted = (char*) malloc(length);
+            if (!converted) {
+                return false;
+            }
+            utf8_to_mutf8(data, str->length, converted);
+            data = converted;
+        }
+    }
+    uint16_t header = htobe16((uint16_t) length);
+    bool ok = _write(file, &header, sizeof(header), 1) && _write(file, data, sizeof(char), length);
+    free(converted);
+    return ok;
+}
+
+static bool _write_length(FILE* file, Int length) {
+    uint32_t value = htobe32((uint32_t) length);
+    return _write(file, &value, sizeof(value), 1);
+}
+
+/* writes count big endian elements, converting through a small buffer */
+static bool _write_elements(FILE* file, const void* data, Int count, size_t element_size) {
+    if (element_size == 1) {
+        return _write(file, data, 1, count);
+    }
+    unsigned char buffer[4096];
+    size_t per_block = sizeof(buffer) / element_size;
+    for (Int done = 0; done < count;) {
+        size_t n = (size_t) (count - done) < per_block ? (size_t) (count - done) : per_block;
+        const unsigned char* src = (const unsigned char*) data + done * element_size;
+        for (size_t i = 0; i < n; i++) {
+            switch (element_size) {
+            case sizeof(uint16_t): {
+                uint16_t v;
+                memcpy(&v, src + i * 2, 2);
+                v = htobe16(v);
+                memcpy(buffer + i * 2, &v, 2);
+                break;
+            }
+            case sizeof(uint32_t): {
+                uint32_t v;
+                memcpy(&v, src + i * 4, 4);
+                v = htobe32(v);
+                memcpy(buffer + i * 4, &v, 4);
+                break;
+            }
+            case sizeof(uint64_t): {
+                uint64_t v;
+                memcpy(&v, src + i * 8, 8);
+                v = htobe64(v);
+                memcpy(buffer + i * 8, &v, 8);
+                break;
+            }
+            }
+        }
+        if (!_write(file, buffer, element_size, n)) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+static bool _write_named_tag(const NamedTag*, FILE*, const WriteOptions*);
+
+static bool _write_payload(enum TAGType type, const void* value, FILE* file, const WriteOptions* options) {
+    switch (type) {
+    case TAG_End:
+        return true;
+    case TAG_Byte:
+    case TAG_Short:
+    case TAG_Int:
+    case TAG_Long:
+    case TAG_Float:
+    case TAG_Double:
+        return _write_elements(file, value, 1, sizeof_type[type]);
+    case TAG_Byte_Array:
+    {
+        const Byte_Array* arr = (const Byte_Array*) value;
+        return _write_length(file, arr->length) && _write_elements(file, arr->data, arr->length, sizeof(Byte));
+    }
+    case TAG_Int_Array:
+    {
+        const Int_Array* arr = (const Int_Array*) value;
+        return _write_length(file, arr->length) && _write_elements(file, arr->data, arr->length, sizeof(Int));
+    }
+    case TAG_Long_Array:
+    {
+        const Long_Array* arr = (const Long_Array*) value;
+        return _write_length(file, arr->length) && _write_elements(file, arr->data, arr->length, sizeof(Long));
+    }
+    case TAG_String:
+        return _write_string(file, (const String*) value, options);
+    case TAG_List:
+    {
+        const List* list = (const List*) value;
+        Byte element_type = (Byte) list->type;
+        if (!_write(file, &element_type, sizeof(Byte), 1) || !_write_length(file, list->length)) {
+            return false;
+        }
+        if (list->type >= TAG_Byte && list->type <= TAG_Double) {
+            return _write_elements(file, list->tags, list->length, sizeof_type[list->type]);
+        }
+        if (list->columnar) {
+            for (Int i = 0; i < list->length; i++) {
+                Compound element;
+                if (!List_element_view(list, i, &element)) {
+                    return false;
+                }
+                bool ok = _write_payload(TAG_Compound, &element, file, options);
+                free(element.tags);
+                if (!ok) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        for (Int i = 0; i < list->length; i++) {
+            if (!_write_payload(list->type, (const char*) list->tags + i * sizeof_type[list->type], file, options)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    case TAG_Compound:
+    {
+        const Compound* compound = (const Compound*) value;
+        for (Int i = 0; i < compound->size; i++) {
+            if (!_write_named_tag(&compound->tags[i], file, options)) {
+                return false;
+            }
+        }
+        Byte end = TAG_End;
+        return _write(file, &end, sizeof(Byte), 1);
+    }
+    }
+    return false;
+}
+
+static bool _write_named_tag(const NamedTag* tag, FILE* file, const WriteOptions* options) {
+    Byte type = (Byte) tag->type;
+    if (!_write(file, &type, sizeof(Byte), 1)) {
+        return false;
+    }
+    if (tag->type == TAG_End) {
+        return true;
+    }
+    return _write_string(file, &tag->name, options) && _write_payload(tag->type, &tag->byte_value, file, options);
+}
+
+bool write_payload(enum TAGType type, const void* value, FILE* file) {
+    return _write_payload(type, value, file, NULL);
+}
+
+bool write_named_tag(const NamedTag* tag, FILE* file) {
+    return _write_named_tag(tag, file, NULL);
+}
+
+bool write_named_tag_with_options(const NamedTag* tag, FILE* file, const WriteOptions* options) {
+    return _write_named_tag(tag, file, options);
+}
+
+bool write_named_tag_to_buffer(const NamedTag* tag, unsigned char** data, size_t* length) {
+    char* buffer = NULL;
+    size_t size = 0;
+    FILE* stream = open_memstream(&buffer, &size);
+    if (!stream) {
+        return false;
+    }
+    bool ok = write_named_tag(tag, stream);
+    if (fclose(stream) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        free(buffer);
+        return false;
+    }
+    *data = (unsigned char*) buffer;
+    *length = size;
+    return true;
+}
+
+bool write_named_tag_compressed(const NamedTag* tag, FILE* file, const CompressOptions* options) {
+    CompressOptions defaults = {0};
+    if (!options) {
+        options = &defaults;
+    }
+    unsigned char* data;
+    size_t length;
+    if (!write_named_tag_to_buffer(tag, &data, &length)) {
+        return false;
+    }
+    int ret = def_parallel(data, length, file, options->level ? options->level : -1,
+                           options->zlib ? 15 : 31, options->block_size, options->threads);
+    free(data);
+    if (ret != 0) {
+        zerr(ret);
+        return false;
+    }
+    return true;
+}
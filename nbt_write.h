@@ -0,0 +1,32 @@
+#ifndef NBT_WRITE_H
+#define NBT_WRITE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "nbt.h"
+
+/* serializes trees back to uncompressed Java NBT */
+
+typedef struct WriteOptions {
+    bool utf8_strings; // strings hold standard UTF-8, as parsed with STRINGS_UTF8
+} WriteOptions;
+
+typedef struct CompressOptions {
+    int level;         // zlib level 1-9, 0 for zlib's default
+    bool zlib;         // zlib framing instead of gzip
+    int threads;       // 0 for 4
+    size_t block_size; // bytes of serialized NBT per job, 0 for 128 KiB
+} CompressOptions;
+
+bool write_named_tag(const NamedTag*, FILE*);
+/* fails on strings that are not valid UTF-8 when options->utf8_strings is set */
+bool write_named_tag_with_options(const NamedTag*, FILE*, const WriteOptions*);
+/* writes a payload in the representation parse_payload() and list slots use */
+bool write_payload(enum TAGType, const void* value, FILE*);
+/* serializes into a malloc'ed buffer */
+bool write_named_tag_to_buffer(const NamedTag*, unsigned char** data, size_t* length);
+/* serializes, then compresses on several threads with def_parallel(); options may be NULL */
+bool write_named_tag_compressed(const NamedTag*, FILE*, const CompressOptions*);
+
+#endif // NBT_WRITE_H
@@ -5,7 +5,10 @@ Below source is derived from https://zlib.net/zpipe.c
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include "zlib.h"
+#include "zpipe.h"
 
 #if defined(MSDOS) || defined(OS2) || defined(WIN32) || defined(__CYGWIN__)
 #  include <fcntl.h>
@@ -25,6 +28,15 @@ Below source is derived from https://zlib.net/zpipe.c
    version of the library linked do not match, or Z_ERRNO if there is
    an error reading or writing the files. */
 int def(FILE *source, FILE *dest, int level)
+{
+    // gzip
+    return def2(source, dest, level, MAX_WBITS + 16);
+}
+
+/* Same as def(), with the stream format chosen by window_bits as for
+   deflateInit2(): MAX_WBITS for zlib, MAX_WBITS + 16 for gzip and
+   -MAX_WBITS for a raw deflate stream. */
+int def2(FILE *source, FILE *dest, int level, int window_bits)
 {
     int ret, flush;
     unsigned have;
@@ -36,8 +48,7 @@ int def(FILE *source, FILE *dest, int level)
     strm.zalloc = Z_NULL;
     strm.zfree = Z_NULL;
     strm.opaque = Z_NULL;
-    // gzip
-    ret = deflateInit2(&strm, level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+    ret = deflateInit2(&strm, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
     if (ret != Z_OK)
         return ret;
 
@@ -75,6 +86,198 @@ int def(FILE *source, FILE *dest, int level)
     return Z_OK;
 }
 
+/* One block of def_parallel(): compressed on its own, primed with the
+   window of input that precedes it. */
+struct par_block {
+    const unsigned char *in;
+    size_t len;
+    size_t dict_len;
+    int last;
+    unsigned char *out;
+    size_t out_len;
+    uLong check;
+    int ret;
+};
+
+struct par_job {
+    struct par_block *blocks;
+    size_t count;
+    size_t next;
+    int level;
+    int gzip;
+};
+
+static int par_deflate(z_stream *strm, struct par_block *block)
+{
+    int ret, flush;
+    size_t capacity = deflateBound(strm, block->len) + 16;
+
+    if (block->dict_len) {
+        ret = deflateSetDictionary(strm, block->in - block->dict_len, block->dict_len);
+        if (ret != Z_OK)
+            return ret;
+    }
+    block->out = malloc(capacity);
+    if (block->out == NULL)
+        return Z_MEM_ERROR;
+
+    /* all but the last block end on a byte boundary with an empty stored
+       block, so that the raw streams can simply be concatenated */
+    flush = block->last ? Z_FINISH : Z_SYNC_FLUSH;
+    strm->next_in = (unsigned char *)block->in;
+    strm->avail_in = block->len;
+    strm->next_out = block->out;
+    strm->avail_out = capacity;
+    while (1) {
+        ret = deflate(strm, flush);
+        if (ret == Z_STREAM_ERROR)
+            return ret;
+        if (flush == Z_FINISH ? ret == Z_STREAM_END : strm->avail_out != 0)
+            break;
+        if (strm->avail_out == 0) {
+            size_t used = capacity;
+            unsigned char *temp = realloc(block->out, capacity * 2);
+            if (temp == NULL)
+                return Z_MEM_ERROR;
+            block->out = temp;
+            capacity *= 2;
+            strm->next_out = block->out + used;
+            strm->avail_out = capacity - used;
+        }
+    }
+    block->out_len = strm->next_out - block->out;
+    return Z_OK;
+}
+
+static void *par_worker(void *arg)
+{
+    struct par_job *job = arg;
+    z_stream strm;
+    int ret;
+    size_t i;
+
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    ret = deflateInit2(&strm, job->level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        struct par_block *block = &job->blocks[i];
+        if (ret != Z_OK) {
+            block->ret = ret;
+            continue;
+        }
+        (void)deflateReset(&strm);
+        block->ret = par_deflate(&strm, block);
+        block->check = job->gzip ? crc32(0L, block->in, block->len)
+                                 : adler32(1L, block->in, block->len);
+    }
+    if (ret == Z_OK)
+        (void)deflateEnd(&strm);
+    return NULL;
+}
+
+/* Compress a whole buffer to dest the way pigz does: the input is cut
+   into blocks of block_size bytes, which are deflated concurrently on up
+   to threads threads, each with the 32K of input before it as its
+   dictionary, and joined into one stream whose check value is combined
+   from the blocks'. window_bits chooses the format as for def2(). The
+   compressed blocks are held in memory until all are done. Returns as
+   def() does. */
+int def_parallel(const unsigned char *in, size_t in_len, FILE *dest, int level,
+                 int window_bits, size_t block_size, int threads)
+{
+    struct par_job job;
+    pthread_t *workers;
+    int started = 0, ret = Z_OK;
+    size_t i;
+    uLong check;
+    int gzip = window_bits > MAX_WBITS, zlib = window_bits > 0 && !gzip;
+
+    if (block_size == 0)
+        block_size = 128 * 1024;
+    if (block_size > (1u << 30))
+        block_size = 1u << 30;  /* avail_in is an unsigned int */
+    if (threads <= 0)
+        threads = 4;
+
+    job.count = in_len ? (in_len + block_size - 1) / block_size : 1;
+    job.next = 0;
+    job.level = level;
+    job.gzip = gzip;
+    job.blocks = calloc(job.count, sizeof(struct par_block));
+    if (job.blocks == NULL)
+        return Z_MEM_ERROR;
+    for (i = 0; i < job.count; i++) {
+        size_t offset = i * block_size;
+        job.blocks[i].in = in + offset;
+        job.blocks[i].len = in_len - offset < block_size ? in_len - offset : block_size;
+        job.blocks[i].dict_len = offset < 32768 ? offset : 32768;
+        job.blocks[i].last = i == job.count - 1;
+    }
+
+    if ((size_t)threads > job.count)
+        threads = job.count;
+    workers = calloc(threads, sizeof(pthread_t));
+    if (workers != NULL)
+        for (; started < threads - 1; started++)
+            if (pthread_create(&workers[started], NULL, par_worker, &job) != 0)
+                break;  /* fewer threads, same result */
+    par_worker(&job);
+    for (i = 0; i < (size_t)started; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    /* header */
+    if (gzip) {
+        unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+        header[8] = level == 9 ? 2 : level == 1 ? 4 : 0;
+        if (fwrite(header, 1, sizeof(header), dest) != sizeof(header))
+            ret = Z_ERRNO;
+    }
+    else if (zlib) {
+        unsigned char header[2] = {0x78, 0};
+        int flevel = level == Z_DEFAULT_COMPRESSION || level == 6 ? 2
+                   : level < 2 ? 0 : level < 6 ? 1 : 3;
+        header[1] = flevel << 6;
+        header[1] += 31 - (header[0] * 256 + header[1]) % 31;
+        if (fwrite(header, 1, sizeof(header), dest) != sizeof(header))
+            ret = Z_ERRNO;
+    }
+
+    /* blocks, in order, combining their check values */
+    check = gzip ? crc32(0L, Z_NULL, 0) : adler32(0L, Z_NULL, 0);
+    for (i = 0; i < job.count; i++) {
+        struct par_block *block = &job.blocks[i];
+        if (ret == Z_OK && block->ret != Z_OK)
+            ret = block->ret;
+        if (ret == Z_OK && fwrite(block->out, 1, block->out_len, dest) != block->out_len)
+            ret = Z_ERRNO;
+        check = gzip ? crc32_combine(check, block->check, (z_off_t)block->len)
+                     : adler32_combine(check, block->check, (z_off_t)block->len);
+        free(block->out);
+    }
+    free(job.blocks);
+
+    /* trailer */
+    if (ret == Z_OK && gzip) {
+        unsigned char trailer[8];
+        for (i = 0; i < 4; i++) {
+            trailer[i] = check >> (8 * i);
+            trailer[4 + i] = (uLong)in_len >> (8 * i);
+        }
+        if (fwrite(trailer, 1, sizeof(trailer), dest) != sizeof(trailer))
+            ret = Z_ERRNO;
+    }
+    else if (ret == Z_OK && zlib) {
+        unsigned char trailer[4];
+        for (i = 0; i < 4; i++)
+            trailer[i] = check >> (24 - 8 * i);
+        if (fwrite(trailer, 1, sizeof(trailer), dest) != sizeof(trailer))
+            ret = Z_ERRNO;
+    }
+    return ret;
+}
+
 /* Decompress from file source to file dest until stream ends or EOF.
    inf() returns Z_OK on success, Z_MEM_ERROR if memory could not be
    allocated for processing, Z_DATA_ERROR if the deflate data is
@@ -139,6 +342,267 @@ int inf(FILE *source, FILE *dest)
     return ret == Z_STREAM_END ? Z_OK : Z_DATA_ERROR;
 }
 
+/* Decompress a whole gzip or zlib buffer into a newly allocated one.
+   inf_buffer() returns Z_OK on success and stores the result in *out and
+   *out_len, which the caller frees; otherwise it returns Z_MEM_ERROR or
+   Z_DATA_ERROR as inf() does and leaves *out untouched. */
+int inf_buffer(const unsigned char *in, size_t in_len, unsigned char **out, size_t *out_len)
+{
+    int ret;
+    z_stream strm;
+    size_t capacity = in_len * 4 > CHUNK ? in_len * 4 : CHUNK;
+    unsigned char *buf = malloc(capacity);
+    unsigned char *temp;
+
+    if (buf == NULL)
+        return Z_MEM_ERROR;
+
+    /* allocate inflate state */
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+    ret = inflateInit2(&strm, 15 + 32);
+    if (ret != Z_OK) {
+        free(buf);
+        return ret;
+    }
+
+    strm.next_in = (unsigned char *)in;
+    strm.next_out = buf;
+    do {
+        /* feed at most UINT_MAX at a time, avail_* are unsigned */
+        if (strm.avail_in == 0) {
+            size_t left = in_len - (strm.next_in - in);
+            strm.avail_in = left > 0x7fffffff ? 0x7fffffff : left;
+        }
+        if (strm.next_out == buf + capacity) {
+            size_t used = capacity;
+            capacity *= 2;
+            temp = realloc(buf, capacity);
+            if (temp == NULL) {
+                (void)inflateEnd(&strm);
+                free(buf);
+                return Z_MEM_ERROR;
+            }
+            buf = temp;
+            strm.next_out = buf + used;
+        }
+        {
+            size_t room = capacity - (strm.next_out - buf);
+            strm.avail_out = room > 0x7fffffff ? 0x7fffffff : room;
+        }
+        ret = inflate(&strm, Z_NO_FLUSH);
+        switch (ret) {
+        case Z_NEED_DICT:
+            ret = Z_DATA_ERROR;     /* and fall through */
+        case Z_DATA_ERROR:
+        case Z_MEM_ERROR:
+        case Z_STREAM_ERROR:
+            (void)inflateEnd(&strm);
+            free(buf);
+            return ret;
+        case Z_BUF_ERROR:
+            /* no progress possible: input ended before the stream did */
+            if (strm.avail_in == 0 && strm.avail_out != 0) {
+                (void)inflateEnd(&strm);
+                free(buf);
+                return Z_DATA_ERROR;
+            }
+        }
+    } while (ret != Z_STREAM_END);
+
+    *out_len = strm.next_out - buf;
+    (void)inflateEnd(&strm);
+    *out = buf;
+    return Z_OK;
+}
+
+/* Decompress a gzip or zlib stream from source to dest, which may be NULL,
+   recording an access point at the first deflate block boundary and then
+   at the first one at least span bytes of output after the last point, as
+   zran.c does. *points receives a new array of *count points, which the
+   caller frees. Returns as inf() does. */
+int inf_index(FILE *source, FILE *dest, size_t span, struct inf_point **points, size_t *count)
+{
+    int ret;
+    z_stream strm;
+    unsigned char in[CHUNK];
+    unsigned char window[INF_WINDOW];
+    unsigned long long totin = 0, totout = 0, last = 0;
+    struct inf_point *list = NULL, *temp;
+    size_t have = 0, capacity = 0;
+
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+    ret = inflateInit2(&strm, 15 + 32);
+    if (ret != Z_OK)
+        return ret;
+    memset(window, 0, sizeof(window));
+    strm.avail_out = 0;
+
+    do {
+        strm.avail_in = fread(in, 1, CHUNK, source);
+        if (ferror(source)) {
+            ret = Z_ERRNO;
+            break;
+        }
+        if (strm.avail_in == 0) {
+            ret = Z_DATA_ERROR;
+            break;
+        }
+        strm.next_in = in;
+
+        /* inflate a block at a time, the output wrapping around window */
+        do {
+            unsigned char *start;
+            if (strm.avail_out == 0) {
+                strm.avail_out = INF_WINDOW;
+                strm.next_out = window;
+            }
+            start = strm.next_out;
+            totin += strm.avail_in;
+            totout += strm.avail_out;
+            ret = inflate(&strm, Z_BLOCK);
+            totin -= strm.avail_in;
+            totout -= strm.avail_out;
+            if (ret == Z_NEED_DICT)
+                ret = Z_DATA_ERROR;
+            if (ret == Z_MEM_ERROR || ret == Z_DATA_ERROR)
+                break;
+            if (dest != NULL && fwrite(start, 1, strm.next_out - start, dest) != (size_t)(strm.next_out - start)) {
+                ret = Z_ERRNO;
+                break;
+            }
+            if (ret == Z_STREAM_END)
+                break;
+
+            /* at the end of a block that is not the last one */
+            if ((strm.data_type & 128) && !(strm.data_type & 64) && (have == 0 || totout - last >= span)) {
+                unsigned left = strm.avail_out;
+                if (have == capacity) {
+                    capacity = capacity ? capacity * 2 : 8;
+                    temp = realloc(list, capacity * sizeof(struct inf_point));
+                    if (temp == NULL) {
+                        ret = Z_MEM_ERROR;
+                        break;
+                    }
+                    list = temp;
+                }
+                list[have].out = totout;
+                list[have].in = totin;
+                list[have].bits = strm.data_type & 7;
+                /* oldest output first: what follows next_out, then what precedes it */
+                memcpy(list[have].window, window + INF_WINDOW - left, left);
+                memcpy(list[have].window + left, window, INF_WINDOW - left);
+                have++;
+                last = totout;
+            }
+        } while (strm.avail_in != 0);
+    } while (ret == Z_OK || ret == Z_BUF_ERROR);
+
+    (void)inflateEnd(&strm);
+    if (ret != Z_STREAM_END) {
+        free(list);
+        return ret;
+    }
+    *points = list;
+    *count = have;
+    return Z_OK;
+}
+
+/* Decompress len bytes starting at offset in the uncompressed data into
+   buf, beginning at the last of the count points from inf_index() that is
+   not past offset. in is the whole compressed file. Returns Z_OK, or
+   Z_DATA_ERROR if the stream is damaged or ends first. */
+int inf_extract(const unsigned char *in, size_t in_len, const struct inf_point *points, size_t count,
+                unsigned long long offset, unsigned char *buf, size_t len)
+{
+    int ret;
+    z_stream strm;
+    unsigned char discard[CHUNK];
+    const struct inf_point *point;
+    size_t low = 0, high = count, start, skip;
+
+    /* last point with out <= offset */
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (points[middle].out <= offset)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low == 0)
+        return Z_DATA_ERROR;
+    point = &points[low - 1];
+    start = point->in - (point->bits ? 1 : 0);
+    if (point->in > in_len || start >= in_len)
+        return Z_DATA_ERROR;
+
+    /* raw inflate, primed with the bits of the point's first byte and its window */
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+    ret = inflateInit2(&strm, -15);
+    if (ret != Z_OK)
+        return ret;
+    if (point->bits)
+        ret = inflatePrime(&strm, point->bits, in[start] >> (8 - point->bits));
+    if (ret == Z_OK)
+        ret = inflateSetDictionary(&strm, point->window, INF_WINDOW);
+    if (ret != Z_OK) {
+        (void)inflateEnd(&strm);
+        return Z_DATA_ERROR;
+    }
+    strm.next_in = (unsigned char *)in + point->in;
+
+    skip = offset - point->out;
+    while (len > 0 || skip > 0) {
+        if (strm.avail_in == 0) {
+            size_t left = in_len - (strm.next_in - in);
+            if (left == 0) {
+                ret = Z_DATA_ERROR;
+                break;
+            }
+            strm.avail_in = left > 0x7fffffff ? 0x7fffffff : left;
+        }
+        /* output that comes before offset is thrown away */
+        if (skip > 0) {
+            strm.next_out = discard;
+            strm.avail_out = skip > CHUNK ? CHUNK : skip;
+        }
+        else {
+            strm.next_out = buf;
+            strm.avail_out = len > 0x7fffffff ? 0x7fffffff : len;
+        }
+        {
+            unsigned wanted = strm.avail_out;
+            ret = inflate(&strm, Z_NO_FLUSH);
+            if (ret == Z_NEED_DICT || ret == Z_MEM_ERROR || ret == Z_DATA_ERROR || ret == Z_STREAM_ERROR)
+                break;
+            if (skip > 0)
+                skip -= wanted - strm.avail_out;
+            else {
+                buf += wanted - strm.avail_out;
+                len -= wanted - strm.avail_out;
+            }
+            if (ret == Z_STREAM_END && (len > 0 || skip > 0)) {
+                ret = Z_DATA_ERROR;
+                break;
+            }
+            ret = Z_OK;
+        }
+    }
+    (void)inflateEnd(&strm);
+    return ret == Z_MEM_ERROR ? ret : ret == Z_OK ? Z_OK : Z_DATA_ERROR;
+}
+
 /* report a zlib or i/o error */
 void zerr(int ret)
 {
@@ -164,6 +628,8 @@ void zerr(int ret)
     }
 }
 
+#ifndef ZPIPE_NO_MAIN
+
 /* compress or decompress from stdin to stdout */
 int main(int argc, char **argv)
 {
@@ -194,4 +660,6 @@ int main(int argc, char **argv)
         fputs("zpipe usage: zpipe [-d] < source > dest\n", stderr);
         return 1;
     }
-}
\ No newline at end of file
+}
+
+#endif // ZPIPE_NO_MAIN
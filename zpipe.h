@@ -0,0 +1,36 @@
+#ifndef ZPIPE_H
+#define ZPIPE_H
+
+/*
+ * Compression helpers from zpipe.c. This header deliberately does not include
+ * zlib.h, whose Byte typedef clashes with the one in nbt.h; return values are
+ * zlib status codes, Z_OK being 0.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+
+int def(FILE *source, FILE *dest, int level);
+/* window_bits as for deflateInit2(): 15 for zlib, 31 for gzip */
+int def2(FILE *source, FILE *dest, int level, int window_bits);
+/* pigz-style: a whole buffer, deflated in blocks of block_size bytes (0 for
+   128K) on up to threads threads (0 for 4), as one stream */
+int def_parallel(const unsigned char *in, size_t in_len, FILE *dest, int level,
+                 int window_bits, size_t block_size, int threads);
+int inf(FILE *source, FILE *dest);
+int inf_buffer(const unsigned char *in, size_t in_len, unsigned char **out, size_t *out_len);
+
+/* zran-style random access into a gzip or zlib stream */
+#define INF_WINDOW 32768
+struct inf_point {
+    unsigned long long out;             /* offset in the uncompressed data */
+    unsigned long long in;              /* offset of the first full byte in the compressed file */
+    int bits;                           /* bits of the byte before in that also belong to it */
+    unsigned char window[INF_WINDOW];   /* the output leading up to out */
+};
+int inf_index(FILE *source, FILE *dest, size_t span, struct inf_point **points, size_t *count);
+int inf_extract(const unsigned char *in, size_t in_len, const struct inf_point *points, size_t count,
+                unsigned long long offset, unsigned char *buf, size_t len);
+void zerr(int ret);
+
+#endif // ZPIPE_H